@@ -0,0 +1,187 @@
+/*
+ *     Copyright (C) 2020 Kyle Kloberdanz
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+
+#include "bracket.h"
+
+/*
+ * the brackets of a line are kept in its brackets field as BRACKET_KNOWN
+ * and, for each kind of bracket, how many of them close brackets opened
+ * before the line and how many are left open after it, in BRACKET_BITS
+ * each. a count that reaches BRACKET_MANY stops there, and such a line is
+ * looked through a byte at a time
+ */
+#define BRACKET_KNOWN 1UL
+#define BRACKET_BITS 5
+#define BRACKET_MANY ((1UL << BRACKET_BITS) - 1)
+
+#define BRACKET_CLOSED(SUMMARY, KIND) \
+    (((SUMMARY) >> (1 + (KIND) * 2 * BRACKET_BITS)) & BRACKET_MANY)
+
+#define BRACKET_OPEN(SUMMARY, KIND) \
+    (((SUMMARY) >> (1 + BRACKET_BITS + (KIND) * 2 * BRACKET_BITS)) & \
+        BRACKET_MANY)
+
+static const char opens[] = "([{";
+static const char closes[] = ")]}";
+
+#define KINDS 3
+
+#define MIN(A, B) ((A) < (B) ? (A) : (B))
+
+static unsigned long summarize(const char *data) {
+    unsigned long closed[KINDS] = {0, 0, 0};
+    unsigned long open[KINDS] = {0, 0, 0};
+    unsigned long summary = BRACKET_KNOWN;
+    const char *p;
+    int kind;
+
+    for (; *data; data++) {
+        if ((p = strchr(opens, *data))) {
+            kind = p - opens;
+            open[kind] += (open[kind] < BRACKET_MANY);
+        } else if ((p = strchr(closes, *data))) {
+            kind = p - closes;
+            if (open[kind] == BRACKET_MANY) {
+                /* how many are open is no longer known */
+                continue;
+            } else if (open[kind] > 0) {
+                open[kind]--;
+            } else {
+                closed[kind] += (closed[kind] < BRACKET_MANY);
+            }
+        }
+    }
+    for (kind = 0; kind < KINDS; kind++) {
+        summary |= closed[kind] << (1 + kind * 2 * BRACKET_BITS);
+        summary |= open[kind] << (1 + BRACKET_BITS + kind * 2 * BRACKET_BITS);
+    }
+    return summary;
+}
+
+static unsigned long line_brackets(struct Text *line) {
+    if (!(line->brackets & BRACKET_KNOWN)) {
+        line->brackets = summarize(text_peek(line));
+    }
+    return line->brackets;
+}
+
+/*
+ * looks for the bracket that brings depth to 0 in the n bytes of data,
+ * forwards from the start or backwards from the end. up is the bracket that
+ * goes deeper that way and down the one that comes back. returns its
+ * index, or n with depth left as it is at the other end
+ */
+static size_t scan(
+    const char *data,
+    size_t n,
+    int up,
+    int down,
+    int forward,
+    size_t *depth
+) {
+    size_t i;
+    size_t at;
+
+    for (i = 0; i < n; i++) {
+        at = forward ? i : n - 1 - i;
+        if (data[at] == up) {
+            (*depth)++;
+        } else if (data[at] == down && --(*depth) == 0) {
+            return at;
+        }
+    }
+    return n;
+}
+
+int bracket_match(struct Text **line, size_t *line_no, size_t *index) {
+    struct Text *at = *line;
+    const char *data = text_peek(at);
+    const char *p;
+    unsigned long summary;
+    unsigned long passing;
+    unsigned long leaving;
+    size_t len = strlen(data);
+    size_t depth = 1;
+    size_t no = *line_no;
+    size_t i;
+    int forward = 1;
+    int kind;
+    int up = 0;
+    int down = 0;
+
+    /* the first bracket from the cursor on is the one matched */
+    for (i = MIN(*index, len); i < len; i++) {
+        if ((p = strchr(opens, data[i]))) {
+            up = *p;
+            down = closes[p - opens];
+            break;
+        }
+        if ((p = strchr(closes, data[i]))) {
+            forward = 0;
+            up = *p;
+            down = opens[p - closes];
+            break;
+        }
+    }
+    if (i == len) {
+        return 0;
+    }
+    kind = strchr(opens, forward ? up : down) - opens;
+
+    if (forward) {
+        i += 1 + scan(data + i + 1, len - i - 1, up, down, 1, &depth);
+    } else {
+        i = scan(data, i, up, down, 0, &depth);
+    }
+
+    /*
+     * a line whose brackets close fewer than depth cannot hold the match,
+     * so it only moves depth on by what it leaves open
+     */
+    while (depth) {
+        at = forward ? at->next : at->prev;
+        if (!at) {
+            return 0;
+        }
+        if (forward) {
+            no++;
+        } else {
+            no--;
+        }
+        summary = line_brackets(at);
+        passing = forward ? BRACKET_CLOSED(summary, kind) :
+            BRACKET_OPEN(summary, kind);
+        leaving = forward ? BRACKET_OPEN(summary, kind) :
+            BRACKET_CLOSED(summary, kind);
+        if (passing < depth && passing < BRACKET_MANY &&
+            leaving < BRACKET_MANY
+        ) {
+            depth = depth - passing + leaving;
+            continue;
+        }
+        data = text_peek(at);
+        len = strlen(data);
+        i = scan(data, len, up, down, forward, &depth);
+    }
+
+    *line = at;
+    *line_no = no;
+    *index = i;
+    return 1;
+}
@@ -0,0 +1,32 @@
+/*
+ *     Copyright (C) 2020 Kyle Kloberdanz
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef BRACKET_H
+#define BRACKET_H
+
+#include "text.h"
+
+/**
+ * finds the bracket that matches the first of ()[]{} at or after index on
+ * line, as % does. on success sets *line, *line_no and *index to where it is
+ * and returns 1. lines between the two are passed over by how many
+ * brackets they leave open or closed, worked out once and kept with the
+ * line until it changes
+ */
+int bracket_match(struct Text **line, size_t *line_no, size_t *index);
+
+#endif /* BRACKET_H */
@@ -0,0 +1,160 @@
+/*
+ *     Copyright (C) 2020 Kyle Kloberdanz
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "buffer.h"
+
+static void buffer_load(struct Buffer *buf) {
+    if (buf->filename) {
+        buf->top_of_text = text_load(buf->filename, &buf->crlf);
+        undo_load(&buf->history, buf->top_of_text, buf->filename);
+        buf->written = buf->history.undo ? buf->history.undo->group : 0;
+    } else {
+        buf->top_of_text = text_make_line();
+        buf->crlf = 0;
+    }
+    buf->line = buf->top_of_text;
+    buf->line_no = 1;
+    syntax_init(&buf->syntax, buf->filename);
+}
+
+/*
+ * loads every buffer after the first. only the text of a buffer is written
+ * here, and the main thread does not look at it until loaded is set
+ */
+static void *load_rest(void *arg) {
+    struct Buffers *bufs = arg;
+    struct Buffer tmp;
+    size_t i;
+    int stop;
+
+    for (i = 1; i < bufs->preload; i++) {
+        memset(&tmp, 0, sizeof(tmp));
+        pthread_mutex_lock(&bufs->lock);
+        stop = bufs->stop;
+        tmp.filename = bufs->list[i].filename;
+        pthread_mutex_unlock(&bufs->lock);
+        if (stop) {
+            break;
+        }
+
+        buffer_load(&tmp);
+
+        pthread_mutex_lock(&bufs->lock);
+        bufs->list[i].top_of_text = tmp.top_of_text;
+        bufs->list[i].line = tmp.line;
+        bufs->list[i].line_no = tmp.line_no;
+        bufs->list[i].crlf = tmp.crlf;
+        bufs->list[i].history = tmp.history;
+        bufs->list[i].syntax = tmp.syntax;
+        bufs->list[i].loaded = 1;
+        pthread_cond_broadcast(&bufs->ready);
+        pthread_mutex_unlock(&bufs->lock);
+    }
+    return NULL;
+}
+
+static char *copy_name(const char *name) {
+    char *copy = malloc(strlen(name) + 1);
+    strcpy(copy, name);
+    return copy;
+}
+
+void buffers_open(struct Buffers *bufs, char **filenames, size_t n) {
+    size_t i;
+
+    bufs->n = n ? n : 1;
+    bufs->preload = bufs->n;
+    bufs->list = calloc(bufs->n, sizeof(struct Buffer));
+    bufs->current = 0;
+    bufs->stop = 0;
+    for (i = 0; i < n; i++) {
+        bufs->list[i].filename = copy_name(filenames[i]);
+    }
+    pthread_mutex_init(&bufs->lock, NULL);
+    pthread_cond_init(&bufs->ready, NULL);
+
+    buffer_load(&bufs->list[0]);
+    bufs->list[0].loaded = 1;
+
+    bufs->loading = (bufs->n > 1) &&
+        !pthread_create(&bufs->loader, NULL, load_rest, bufs);
+    if (!bufs->loading) {
+        for (i = 1; i < bufs->n; i++) {
+            buffer_load(&bufs->list[i]);
+            bufs->list[i].loaded = 1;
+        }
+    }
+}
+
+size_t buffers_add(struct Buffers *bufs, const char *filename) {
+    struct Buffer *buf;
+    size_t i;
+
+    for (i = 0; i < bufs->n; i++) {
+        if (bufs->list[i].filename &&
+            !strcmp(bufs->list[i].filename, filename)
+        ) {
+            return i;
+        }
+    }
+
+    /* the loader may be writing to the list while it moves */
+    pthread_mutex_lock(&bufs->lock);
+    bufs->list = realloc(bufs->list, (bufs->n + 1) * sizeof(struct Buffer));
+    buf = &bufs->list[bufs->n];
+    memset(buf, 0, sizeof(struct Buffer));
+    buf->filename = copy_name(filename);
+    pthread_mutex_unlock(&bufs->lock);
+
+    buffer_load(buf);
+    buf->loaded = 1;
+    return bufs->n++;
+}
+
+struct Buffer *buffers_get(struct Buffers *bufs, size_t i) {
+    pthread_mutex_lock(&bufs->lock);
+    while (!bufs->list[i].loaded) {
+        pthread_cond_wait(&bufs->ready, &bufs->lock);
+    }
+    pthread_mutex_unlock(&bufs->lock);
+    return &bufs->list[i];
+}
+
+void buffers_free(struct Buffers *bufs) {
+    size_t i;
+
+    if (bufs->loading) {
+        pthread_mutex_lock(&bufs->lock);
+        bufs->stop = 1;
+        pthread_mutex_unlock(&bufs->lock);
+        pthread_join(bufs->loader, NULL);
+    }
+    for (i = 0; i < bufs->n; i++) {
+        if (bufs->list[i].loaded) {
+            text_free_lines(bufs->list[i].top_of_text);
+            undo_free(&bufs->list[i].history);
+        }
+        fold_free(&bufs->list[i].folds);
+        free(bufs->list[i].filename);
+    }
+    pthread_mutex_destroy(&bufs->lock);
+    pthread_cond_destroy(&bufs->ready);
+    free(bufs->list);
+}
@@ -0,0 +1,93 @@
+/*
+ *     Copyright (C) 2020 Kyle Kloberdanz
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef BUFFER_H
+#define BUFFER_H
+
+#include <pthread.h>
+
+#include "text.h"
+#include "undo.h"
+#include "ex.h"
+#include "syntax.h"
+#include "fold.h"
+
+/*
+ * a file being edited. while it is the current buffer the cursor holds its
+ * text, history and marks, and they are put back here when another buffer
+ * is switched to. its folds stay here all along, as does written, the group
+ * of the last change in the history when the text was last written, which
+ * tells whether it has changed since
+ */
+struct Buffer {
+    char *filename;
+    struct Text *top_of_text;
+    struct Text *line;
+    size_t line_no;
+    size_t x;
+    size_t y;
+    struct History history;
+    size_t marks[EX_MARKS];
+    int crlf;
+    struct Syntax syntax;
+    struct Folds folds;
+    unsigned long written;
+    int loaded;
+};
+
+/*
+ * the files being edited. of those named on the command line the first is
+ * loaded straight away and the rest, up to preload, by a thread in the
+ * background, in order, so moving on to the next one usually finds it
+ * already there
+ */
+struct Buffers {
+    struct Buffer *list;
+    size_t n;
+    size_t preload;
+    size_t current;
+    pthread_t loader;
+    int loading;
+    int stop;
+    pthread_mutex_t lock;
+    pthread_cond_t ready;
+};
+
+/**
+ * opens a buffer for each of the n filenames, or one empty buffer with no
+ * file if n is 0. returns once the first one is loaded
+ */
+void buffers_open(struct Buffers *bufs, char **filenames, size_t n);
+
+/**
+ * the index of the buffer for filename, opening a new one for it if there
+ * is none yet
+ */
+size_t buffers_add(struct Buffers *bufs, const char *filename);
+
+/**
+ * the buffer at index i, waiting for the background thread to finish
+ * loading it if it has not got that far yet
+ */
+struct Buffer *buffers_get(struct Buffers *bufs, size_t i);
+
+/**
+ * stops loading and frees every buffer with its text and history
+ */
+void buffers_free(struct Buffers *bufs);
+
+#endif /* BUFFER_H */
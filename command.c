@@ -15,6 +15,10 @@
  *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
  */
 
+#include <ctype.h>
+#include <limits.h>
+#include <string.h>
+
 #include "command.h"
 
 void command_add_char(struct Command *cmd, char c) {
@@ -22,3 +26,28 @@ void command_add_char(struct Command *cmd, char c) {
         cmd->data[cmd->len++] = c;
     }
 }
+
+void command_clear(struct Command *cmd) {
+    cmd->len = 0;
+    cmd->reg = 0;
+    memset(cmd->data, 0, sizeof(cmd->data));
+}
+
+int command_is_count(struct Command *cmd, int c) {
+    if (c < 0 || c > UCHAR_MAX || !isdigit(c)) {
+        return 0;
+    }
+    return (c != '0') || (cmd->len > 0);
+}
+
+size_t command_count(struct Command *cmd) {
+    size_t i;
+    size_t count = 0;
+    for (i = 0; i < cmd->len && isdigit((unsigned char)cmd->data[i]); i++) {
+        if (count > ((size_t)-1 - 9) / 10) {
+            break;
+        }
+        count = (count * 10) + (cmd->data[i] - '0');
+    }
+    return count ? count : 1;
+}
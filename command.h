@@ -6,8 +6,24 @@
 struct Command {
     size_t len;
     char data[80];
+    int reg;
 };
 
 void command_add_char(struct Command *cmd, char c);
 
+/**
+ * forget any keys typed so far
+ */
+void command_clear(struct Command *cmd);
+
+/**
+ * true when c continues a count prefix, a leading 0 is a motion
+ */
+int command_is_count(struct Command *cmd, int c);
+
+/**
+ * the count typed before a command, 1 if none was given
+ */
+size_t command_count(struct Command *cmd);
+
 #endif /* COMMAND_H */
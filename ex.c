@@ -0,0 +1,305 @@
+/*
+ *     Copyright (C) 2020 Kyle Kloberdanz
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <ctype.h>
+#include <string.h>
+
+#include "ex.h"
+
+/* long names of the commands, and the short name each one runs as */
+static const char *const aliases[][2] = {
+    {"delete", "d"},
+    {"yank", "y"},
+    {"move", "m"},
+    {"copy", "t"},
+    {"co", "t"},
+    {"join", "j"},
+    {"write", "w"},
+    {"quit", "q"},
+    {"next", "n"},
+    {"Next", "N"},
+    {"prev", "N"},
+    {"previous", "N"},
+    {"buffer", "b"},
+    {"split", "sp"},
+    {"vsplit", "vs"},
+    {"close", "clo"},
+    {"only", "on"},
+    {"cnext", "cn"},
+    {"cprevious", "cp"},
+    {"cprev", "cp"},
+    {"cN", "cp"},
+    {"se", "set"},
+    {"fold", "fo"}
+};
+
+static size_t total_lines(struct ExContext *ctx) {
+    if (ctx->total == 0) {
+        ctx->total = text_total_lines(ctx->top_of_text);
+    }
+    return ctx->total;
+}
+
+static const char *skip_blanks(const char *p) {
+    while (*p == ' ' || *p == '\t') {
+        p++;
+    }
+    return p;
+}
+
+static size_t read_number(const char **p) {
+    size_t n = 0;
+    for (; isdigit((unsigned char)**p); (*p)++) {
+        if (n <= ((size_t)-1 - 9) / 10) {
+            n = (n * 10) + (**p - '0');
+        }
+    }
+    return n;
+}
+
+/* the first line after the current one, wrapping around, containing pat */
+static const char *find_line(
+    struct ExContext *ctx,
+    const char *pat,
+    size_t *line_no
+) {
+    struct Text *line = ctx->line;
+    size_t no = ctx->line_no;
+
+    do {
+        if (line->next) {
+            line = line->next;
+            no++;
+        } else {
+            line = ctx->top_of_text;
+            no = 1;
+        }
+        if (strstr(text_peek(line), pat)) {
+            *line_no = no;
+            return NULL;
+        }
+    } while (line != ctx->line);
+    return "pattern not found";
+}
+
+/*
+ * reads one address at *p, moving *p past it. *found is cleared when there
+ * is no address there
+ */
+static const char *read_address(
+    struct ExContext *ctx,
+    const char **p,
+    size_t *line_no,
+    int *found
+) {
+    const char *err;
+    char pat[80];
+    size_t n;
+    int c;
+
+    *found = 1;
+    *p = skip_blanks(*p);
+    switch (**p) {
+        case '.':
+            (*p)++;
+            *line_no = ctx->line_no;
+            break;
+
+        case '$':
+            (*p)++;
+            *line_no = total_lines(ctx);
+            break;
+
+        case '\'':
+            c = (*p)[1];
+            if (c < 'a' || c > 'z') {
+                return "unknown mark";
+            }
+            *p += 2;
+            *line_no = ctx->marks[c - 'a'];
+            if (*line_no == 0) {
+                return "mark not set";
+            }
+            break;
+
+        case '/':
+            for (n = 0, (*p)++; **p && **p != '/'; (*p)++) {
+                if (**p == '\\' && (*p)[1] == '/') {
+                    (*p)++;
+                }
+                if (n == sizeof(pat) - 1) {
+                    return "pattern too long";
+                }
+                pat[n++] = **p;
+            }
+            pat[n] = '\0';
+            if (**p == '/') {
+                (*p)++;
+            }
+            if ((err = find_line(ctx, pat, line_no))) {
+                return err;
+            }
+            break;
+
+        case '+':
+        case '-':
+            *line_no = ctx->line_no;
+            break;
+
+        default:
+            if (!isdigit((unsigned char)**p)) {
+                *found = 0;
+                return NULL;
+            }
+            *line_no = read_number(p);
+            break;
+    }
+
+    /* offsets such as .+3 or $-1, a bare + or - counts as one */
+    for (*p = skip_blanks(*p); **p == '+' || **p == '-'; *p = skip_blanks(*p)) {
+        c = *(*p)++;
+        n = isdigit((unsigned char)**p) ? read_number(p) : 1;
+        if (c == '+') {
+            *line_no += n;
+        } else if (n >= *line_no) {
+            *line_no = 0;
+        } else {
+            *line_no -= n;
+        }
+    }
+    return NULL;
+}
+
+/* the short name of the command at *p, moving *p past it */
+static void read_name(const char **p, char *name, size_t size) {
+    size_t n = 0;
+    size_t i;
+
+    if (isalpha((unsigned char)**p)) {
+        while (isalpha((unsigned char)**p)) {
+            if (n < size - 1) {
+                name[n++] = **p;
+            }
+            (*p)++;
+        }
+    } else if (**p && !isspace((unsigned char)**p)) {
+        name[n++] = *(*p)++;
+    }
+    name[n] = '\0';
+
+    for (i = 0; i < sizeof(aliases) / sizeof(aliases[0]); i++) {
+        if (strcmp(name, aliases[i][0]) == 0) {
+            strcpy(name, aliases[i][1]);
+            break;
+        }
+    }
+}
+
+const char *ex_parse(
+    struct ExContext *ctx,
+    const char *line,
+    struct ExCommand *cmd
+) {
+    const char *p = line;
+    const char *err;
+    size_t tmp;
+    int found;
+
+    memset(cmd, 0, sizeof(struct ExCommand));
+    cmd->first = ctx->line_no;
+    cmd->last = ctx->line_no;
+    cmd->count = 1;
+
+    p = skip_blanks(p);
+    if (*p == '%') {
+        p++;
+        cmd->first = 1;
+        cmd->last = total_lines(ctx);
+        cmd->addresses = 2;
+    } else {
+        if ((err = read_address(ctx, &p, &cmd->first, &found))) {
+            return err;
+        }
+        if (found) {
+            cmd->last = cmd->first;
+            cmd->addresses = 1;
+        }
+        p = skip_blanks(p);
+        if (*p == ',') {
+            p++;
+            if ((err = read_address(ctx, &p, &cmd->last, &found))) {
+                return err;
+            }
+            if (!found) {
+                cmd->last = cmd->first;
+            }
+            cmd->addresses = 2;
+        }
+    }
+    if (cmd->first > cmd->last) {
+        tmp = cmd->first;
+        cmd->first = cmd->last;
+        cmd->last = tmp;
+    }
+
+    p = skip_blanks(p);
+    read_name(&p, cmd->name, sizeof(cmd->name));
+
+    /* without a range these work on the whole text */
+    if (!cmd->addresses &&
+        (!strcmp(cmd->name, "sort") || !strcmp(cmd->name, "uniq"))
+    ) {
+        cmd->first = 1;
+        cmd->last = total_lines(ctx);
+    }
+
+    /* > and < shift once more for each time they are repeated */
+    if (cmd->name[0] == '>' || cmd->name[0] == '<') {
+        for (; *p == cmd->name[0]; p++) {
+            cmd->count++;
+        }
+    }
+    p = skip_blanks(p);
+
+    if (!strcmp(cmd->name, "m") || !strcmp(cmd->name, "t")) {
+        if ((err = read_address(ctx, &p, &cmd->dest, &found))) {
+            return err;
+        }
+        if (!found) {
+            return "missing address";
+        }
+    } else if (!strcmp(cmd->name, "d") || !strcmp(cmd->name, "y")) {
+        if (*p && !isdigit((unsigned char)*p) && !isspace((unsigned char)*p)) {
+            cmd->reg = *p++;
+        }
+        p = skip_blanks(p);
+        if (isdigit((unsigned char)*p)) {
+            cmd->count = read_number(&p);
+        }
+    }
+
+    /* a count covers that many lines starting at the last address */
+    if (cmd->count > 1 && (!strcmp(cmd->name, "d") || !strcmp(cmd->name, "y"))) {
+        cmd->first = cmd->last;
+        cmd->last = cmd->first + cmd->count - 1;
+    }
+    if (cmd->count == 0) {
+        return "invalid count";
+    }
+    cmd->arg = skip_blanks(p);
+    return NULL;
+}
@@ -0,0 +1,60 @@
+/*
+ *     Copyright (C) 2020 Kyle Kloberdanz
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef EX_H
+#define EX_H
+
+#include "text.h"
+
+#define EX_MARKS 26
+
+/* what the addresses of an ex command are counted from */
+struct ExContext {
+    struct Text *top_of_text;
+    struct Text *line;
+    size_t line_no;
+    size_t total;
+    const size_t *marks;
+};
+
+/*
+ * an ex command line taken apart. first and last are the range it covers,
+ * dest the address that m and t take, reg and count the optional register
+ * and count of d and y, and arg whatever follows the command name
+ */
+struct ExCommand {
+    size_t first;
+    size_t last;
+    int addresses;
+    char name[16];
+    size_t dest;
+    int reg;
+    size_t count;
+    const char *arg;
+};
+
+/**
+ * parses an ex command line, such as "10,$d" or "'a,.m0", without its
+ * leading colon. returns NULL on success or a message saying what is wrong
+ */
+const char *ex_parse(
+    struct ExContext *ctx,
+    const char *line,
+    struct ExCommand *cmd
+);
+
+#endif /* EX_H */
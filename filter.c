@@ -0,0 +1,250 @@
+/*
+ *     Copyright (C) 2020 Kyle Kloberdanz
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "filter.h"
+
+/* output of the command is read this much at a time */
+#define FILTER_READ (1 << 20)
+
+/* lines handed to a single writev */
+#define FILTER_IOV 1024
+
+/* where the writer has got to in the lines being fed to the command */
+struct Feed {
+    struct Text *line;
+    size_t left;
+    size_t offset;
+};
+
+/* the lines built from the output so far */
+struct Sink {
+    struct Text *head;
+    struct Text *tail;
+    size_t n;
+};
+
+/*
+ * writes as many of the remaining lines as the pipe takes, straight out of
+ * their payloads. returns 1 once everything is written, -1 if the command
+ * stopped reading, and 0 if there is more to write
+ */
+static int feed_write(int fd, struct Feed *feed) {
+    struct iovec iov[FILTER_IOV];
+    struct Text *line = feed->line;
+    size_t offset = feed->offset;
+    size_t left = feed->left;
+    int count = 0;
+    ssize_t written;
+    int i;
+
+    for (; line && left && count < FILTER_IOV; line = line->next, left--) {
+        text_thaw(line);
+        iov[count].iov_base = line->data + offset;
+        iov[count].iov_len = strlen(line->data + offset);
+        offset = 0;
+        count++;
+    }
+    if (count == 0) {
+        return 1;
+    }
+
+    written = writev(fd, iov, count);
+    if (written < 0) {
+        return ((errno == EAGAIN) || (errno == EINTR)) ? 0 : -1;
+    }
+    for (i = 0; i < count; i++) {
+        if ((size_t)written < iov[i].iov_len) {
+            feed->offset += written;
+            break;
+        }
+        written -= iov[i].iov_len;
+        feed->line = feed->line->next;
+        feed->left--;
+        feed->offset = 0;
+    }
+    return (feed->line && feed->left) ? 0 : 1;
+}
+
+/* adds n bytes of output, finishing the last line if it was cut short */
+static void sink_add(struct Sink *sink, const char *chars, size_t n) {
+    struct Text *list;
+    const char *newline;
+    size_t len;
+
+    if (sink->tail && (sink->tail->data[sink->tail->len - 1] != '\n')) {
+        newline = memchr(chars, '\n', n);
+        len = newline ? (size_t)(newline - chars) + 1 : n;
+        text_insert_chars(sink->tail, TEXT_ALL_LINES, chars, len);
+        chars += len;
+        n -= len;
+    }
+    if (n == 0) {
+        return;
+    }
+
+    list = text_from_chars(chars, n);
+    if (sink->tail) {
+        text_splice_lines(sink->tail, list);
+    } else {
+        sink->head = list;
+    }
+    for (; list; list = list->next) {
+        sink->tail = list;
+        sink->n++;
+    }
+}
+
+/* starts cmd with its input and output on new pipes */
+static pid_t filter_start(const char *cmd, int *to_fd, int *from_fd) {
+    int to[2];
+    int from[2];
+    pid_t pid;
+
+    if (pipe(to) < 0) {
+        return -1;
+    }
+    if (pipe(from) < 0) {
+        close(to[0]);
+        close(to[1]);
+        return -1;
+    }
+
+    pid = fork();
+    if (pid == 0) {
+        /* the command gets the usual SIGPIPE whatever we inherited */
+        signal(SIGPIPE, SIG_DFL);
+        dup2(to[0], STDIN_FILENO);
+        dup2(from[1], STDOUT_FILENO);
+        dup2(from[1], STDERR_FILENO);
+        close(to[0]);
+        close(to[1]);
+        close(from[0]);
+        close(from[1]);
+        execl("/bin/sh", "sh", "-c", cmd, (char *)NULL);
+        _exit(127);
+    }
+
+    close(to[0]);
+    close(from[1]);
+    if (pid < 0) {
+        close(to[1]);
+        close(from[0]);
+        return -1;
+    }
+    *to_fd = to[1];
+    *from_fd = from[0];
+    return pid;
+}
+
+int filter_lines(
+    struct Text *first,
+    size_t n,
+    const char *cmd,
+    struct Text **out,
+    size_t *lines
+) {
+    struct pollfd fds[2];
+    struct Feed feed;
+    struct Sink sink;
+    void (*old_pipe)(int);
+    char *buf;
+    ssize_t got;
+    pid_t pid;
+    int status = 0;
+    int to_fd;
+    int from_fd;
+
+    buf = malloc(FILTER_READ);
+    if (!buf) {
+        return -1;
+    }
+    pid = filter_start(cmd, &to_fd, &from_fd);
+    if (pid < 0) {
+        free(buf);
+        return -1;
+    }
+
+    /* a command that exits without reading everything must not kill us */
+    old_pipe = signal(SIGPIPE, SIG_IGN);
+    fcntl(to_fd, F_SETFL, fcntl(to_fd, F_GETFL) | O_NONBLOCK);
+
+    feed.line = first;
+    feed.left = n;
+    feed.offset = 0;
+    memset(&sink, 0, sizeof(struct Sink));
+
+    fds[0].fd = to_fd;
+    fds[0].events = POLLOUT;
+    fds[1].fd = from_fd;
+    fds[1].events = POLLIN;
+    if (feed_write(to_fd, &feed)) {
+        close(to_fd);
+        fds[0].fd = -1;
+    }
+
+    while (fds[1].fd >= 0) {
+        if (poll(fds, 2, -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+        if ((fds[0].fd >= 0) && fds[0].revents) {
+            if (feed_write(fds[0].fd, &feed)) {
+                close(fds[0].fd);
+                fds[0].fd = -1;
+            }
+        }
+        if (fds[1].revents) {
+            got = read(fds[1].fd, buf, FILTER_READ);
+            if (got > 0) {
+                sink_add(&sink, buf, got);
+            } else if ((got == 0) || (errno != EINTR)) {
+                close(fds[1].fd);
+                fds[1].fd = -1;
+            }
+        }
+    }
+    if (fds[0].fd >= 0) {
+        close(fds[0].fd);
+    }
+    if (fds[1].fd >= 0) {
+        close(fds[1].fd);
+    }
+    signal(SIGPIPE, old_pipe);
+    free(buf);
+
+    while ((waitpid(pid, &status, 0) < 0) && (errno == EINTR)) {
+    }
+    *out = sink.head;
+    *lines = sink.n;
+    if (WIFSIGNALED(status)) {
+        return 128 + WTERMSIG(status);
+    }
+    return WEXITSTATUS(status);
+}
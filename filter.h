@@ -0,0 +1,39 @@
+/*
+ *     Copyright (C) 2020 Kyle Kloberdanz
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef FILTER_H
+#define FILTER_H
+
+#include "text.h"
+
+/**
+ * runs cmd through /bin/sh with the n lines from first on its standard
+ * input, and collects what it writes to standard output and standard error
+ * as new lines in *out, with their number in *lines. the lines are written
+ * while the output is read, so a command such as sort(1) that reads
+ * everything first cannot block on a full pipe. returns the exit status of
+ * the command, or -1 if it could not be run at all
+ */
+int filter_lines(
+    struct Text *first,
+    size_t n,
+    const char *cmd,
+    struct Text **out,
+    size_t *lines
+);
+
+#endif /* FILTER_H */
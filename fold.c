@@ -0,0 +1,362 @@
+/*
+ *     Copyright (C) 2020 Kyle Kloberdanz
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "fold.h"
+
+#define MAX(A, B) ((A) > (B) ? (A) : (B))
+
+/* folds in the order they are kept in: by first line, the outer one first */
+static int compare_folds(const void *a, const void *b) {
+    const struct Fold *x = a;
+    const struct Fold *y = b;
+
+    if (x->first_no != y->first_no) {
+        return x->first_no < y->first_no ? -1 : 1;
+    }
+    if (x->last_no != y->last_no) {
+        return x->last_no > y->last_no ? -1 : 1;
+    }
+    return 0;
+}
+
+/* works out which closed folds are not inside another closed fold */
+static void find_closed(struct Folds *folds) {
+    size_t end = 0;
+    size_t i;
+
+    free(folds->closed);
+    folds->closed = malloc(MAX(folds->n, 1) * sizeof(size_t));
+    folds->nclosed = 0;
+    for (i = 0; i < folds->n; i++) {
+        if (folds->nclosed && folds->list[i].first_no <= end) {
+            continue;
+        }
+        if (folds->list[i].closed) {
+            folds->closed[folds->nclosed++] = i;
+            end = folds->list[i].last_no;
+        }
+    }
+}
+
+static struct Fold *fold_push(
+    struct Folds *folds,
+    size_t first_no,
+    size_t last_no
+) {
+    struct Fold *fold;
+
+    if (folds->n == folds->capacity) {
+        folds->capacity = 1 + (folds->capacity * 2);
+        folds->list = realloc(
+            folds->list,
+            folds->capacity * sizeof(struct Fold)
+        );
+    }
+    fold = &folds->list[folds->n++];
+    memset(fold, 0, sizeof(struct Fold));
+    fold->first_no = first_no;
+    fold->last_no = last_no;
+    fold->closed = 1;
+    return fold;
+}
+
+const char *fold_add(struct Folds *folds, size_t first_no, size_t last_no) {
+    struct Fold *fold;
+    size_t i;
+
+    for (i = 0; i < folds->n; i++) {
+        fold = &folds->list[i];
+        if (fold->first_no == first_no && fold->last_no == last_no) {
+            fold->closed = 1;
+            find_closed(folds);
+            return NULL;
+        }
+        if ((fold->first_no < first_no && first_no <= fold->last_no &&
+                fold->last_no < last_no) ||
+            (first_no < fold->first_no && fold->first_no <= last_no &&
+                last_no < fold->last_no)
+        ) {
+            return "folds cannot cross";
+        }
+    }
+    fold_push(folds, first_no, last_no);
+    qsort(folds->list, folds->n, sizeof(struct Fold), compare_folds);
+    find_closed(folds);
+    return NULL;
+}
+
+/* how many columns of indent the line has, or -1 if it is blank */
+static long indent_of(const char *data) {
+    long indent = 0;
+
+    for (;; data++) {
+        if (*data == ' ') {
+            indent++;
+        } else if (*data == '\t') {
+            indent += 8 - (indent % 8);
+        } else {
+            break;
+        }
+    }
+    return (*data == '\0' || *data == '\n') ? -1 : indent;
+}
+
+/* a run of lines indented at least indent, still open */
+struct Run {
+    long indent;
+    size_t first_no;
+    struct Text *first;
+};
+
+void fold_indent(struct Folds *folds, struct Text *top_of_text) {
+    struct Run *runs = NULL;
+    struct Run *run;
+    struct Text *line;
+    struct Text *last = NULL;
+    struct Fold *fold;
+    size_t capacity = 0;
+    size_t n = 0;
+    size_t line_no;
+    size_t last_no = 0;
+    long indent;
+
+    folds->n = 0;
+    for (line = top_of_text, line_no = 1; ; line = line->next, line_no++) {
+        indent = line ? indent_of(text_peek(line)) : 0;
+        if (indent < 0) {
+            continue;
+        }
+
+        /* the runs indented further than this line end at the line before */
+        for (; n > 0 && runs[n - 1].indent > indent; n--) {
+            run = &runs[n - 1];
+            if (last_no > run->first_no) {
+                fold = fold_push(folds, run->first_no, last_no);
+                fold->first = run->first;
+                fold->last = last;
+            }
+        }
+        if (!line) {
+            break;
+        }
+        if (indent > (n > 0 ? runs[n - 1].indent : 0)) {
+            if (n == capacity) {
+                capacity = 1 + (capacity * 2);
+                runs = realloc(runs, capacity * sizeof(struct Run));
+            }
+            runs[n].indent = indent;
+            runs[n].first_no = line_no;
+            runs[n].first = line;
+            n++;
+        }
+        last = line;
+        last_no = line_no;
+    }
+    free(runs);
+    qsort(folds->list, folds->n, sizeof(struct Fold), compare_folds);
+    find_closed(folds);
+}
+
+struct Fold *fold_at(struct Folds *folds, size_t line_no) {
+    struct Fold *fold;
+    size_t lo = 0;
+    size_t hi = folds->nclosed;
+    size_t mid;
+
+    /* the last closed fold that starts at or before line_no */
+    while (lo < hi) {
+        mid = lo + (hi - lo) / 2;
+        if (folds->list[folds->closed[mid]].first_no <= line_no) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    if (lo == 0) {
+        return NULL;
+    }
+    fold = &folds->list[folds->closed[lo - 1]];
+    return fold->last_no >= line_no ? fold : NULL;
+}
+
+/* walks from a known line to the line numbered line_no, or the last line */
+static struct Text *seek(struct Text *from, size_t from_no, size_t line_no) {
+    for (; from->next && from_no < line_no; from_no++) {
+        from = from->next;
+    }
+    for (; from->prev && from_no > line_no; from_no--) {
+        from = from->prev;
+    }
+    return from;
+}
+
+struct Text *fold_first(struct Fold *fold, struct Text *from, size_t from_no) {
+    if (!fold->first) {
+        fold->first = seek(from, from_no, fold->first_no);
+    }
+    return fold->first;
+}
+
+struct Text *fold_last(struct Fold *fold, struct Text *from, size_t from_no) {
+    size_t from_first;
+    size_t from_here;
+
+    if (!fold->last) {
+        /* walk from whichever of the two known lines is nearer */
+        from_here = from_no > fold->last_no ? from_no - fold->last_no :
+            fold->last_no - from_no;
+        from_first = fold->last_no - fold->first_no;
+        if (fold->first && from_first < from_here) {
+            from = fold->first;
+            from_no = fold->first_no;
+        }
+        fold->last = seek(from, from_no, fold->last_no);
+    }
+    return fold->last;
+}
+
+/* the innermost fold around the line numbered line_no, or NULL */
+static struct Fold *fold_around(
+    struct Folds *folds,
+    size_t line_no,
+    struct Fold *inside
+) {
+    struct Fold *found = NULL;
+    struct Fold *fold;
+    size_t i;
+
+    for (i = 0; i < folds->n && folds->list[i].first_no <= line_no; i++) {
+        fold = &folds->list[i];
+        if (fold->last_no >= line_no && fold != inside &&
+            (!inside || (fold->first_no <= inside->first_no &&
+                fold->last_no >= inside->last_no))
+        ) {
+            found = fold;
+        }
+    }
+    return found;
+}
+
+int fold_open(struct Folds *folds, size_t line_no) {
+    struct Fold *fold = fold_at(folds, line_no);
+
+    if (!fold) {
+        return 0;
+    }
+    fold->closed = 0;
+    find_closed(folds);
+    return 1;
+}
+
+int fold_close(struct Folds *folds, size_t line_no) {
+    struct Fold *shown = fold_at(folds, line_no);
+    struct Fold *fold = fold_around(folds, line_no, shown);
+
+    if (!fold) {
+        return 0;
+    }
+    fold->closed = 1;
+    find_closed(folds);
+    return 1;
+}
+
+void fold_all(struct Folds *folds, int closed) {
+    size_t i;
+
+    for (i = 0; i < folds->n; i++) {
+        folds->list[i].closed = closed;
+    }
+    find_closed(folds);
+}
+
+int fold_delete(struct Folds *folds, size_t line_no) {
+    struct Fold *fold = fold_at(folds, line_no);
+    size_t i;
+
+    if (!fold) {
+        fold = fold_around(folds, line_no, NULL);
+    }
+    if (!fold) {
+        return 0;
+    }
+    i = (size_t)(fold - folds->list);
+    memmove(fold, fold + 1, (folds->n - i - 1) * sizeof(struct Fold));
+    folds->n--;
+    find_closed(folds);
+    return 1;
+}
+
+void fold_changed(struct Folds *folds, size_t first, size_t end, long shift) {
+    struct Fold *fold;
+    size_t new_end;
+    size_t kept = 0;
+    size_t i;
+    int moved = 0;
+    int cut = 0;
+
+    if (!first || !folds->n) {
+        return;
+    }
+    new_end = shift < 0 ? end - (size_t)-shift : end + (size_t)shift;
+
+    for (i = 0; i < folds->n; i++) {
+        fold = &folds->list[i];
+        if (fold->last_no < first) {
+            folds->list[kept++] = *fold;
+            continue;
+        }
+        moved = 1;
+        if (fold->first_no >= end) {
+            fold->first_no = fold->first_no - end + new_end;
+        } else if (fold->first_no >= first) {
+            fold->first = NULL;
+            if (fold->first_no > new_end) {
+                fold->first_no = new_end;
+                cut = 1;
+            }
+        }
+        if (fold->last_no >= end) {
+            fold->last_no = fold->last_no - end + new_end;
+        } else {
+            fold->last = NULL;
+            if (fold->last_no >= new_end) {
+                fold->last_no = new_end - 1;
+                cut = 1;
+            }
+        }
+        if (fold->first_no <= fold->last_no) {
+            folds->list[kept++] = *fold;
+        }
+    }
+    folds->n = kept;
+    if (cut) {
+        /* folds cut down to the same lines may have changed places */
+        qsort(folds->list, folds->n, sizeof(struct Fold), compare_folds);
+    }
+    if (moved) {
+        find_closed(folds);
+    }
+}
+
+void fold_free(struct Folds *folds) {
+    free(folds->list);
+    free(folds->closed);
+    memset(folds, 0, sizeof(struct Folds));
+}
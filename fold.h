@@ -0,0 +1,116 @@
+/*
+ *     Copyright (C) 2020 Kyle Kloberdanz
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef FOLD_H
+#define FOLD_H
+
+#include "text.h"
+
+/*
+ * a run of lines that can be hidden behind its first one. a closed fold is
+ * drawn and moved over as one line, and so is everything inside it. the
+ * first and last lines are found from their numbers when first needed and
+ * kept until a change reaches them, so passing a fold of any size is one
+ * step
+ */
+struct Fold {
+    size_t first_no;
+    size_t last_no;
+    struct Text *first;
+    struct Text *last;
+    int closed;
+};
+
+/*
+ * the folds of a buffer, in order of their first lines with a fold before
+ * the folds inside it. folds nest but never cross. closed holds where in
+ * list the closed folds not inside another closed fold are, in order
+ */
+struct Folds {
+    struct Fold *list;
+    size_t n;
+    size_t capacity;
+    size_t *closed;
+    size_t nclosed;
+};
+
+/**
+ * adds a closed fold over the lines first_no to last_no, or closes the one
+ * already there. returns an error if it would cross another fold
+ */
+const char *fold_add(struct Folds *folds, size_t first_no, size_t last_no);
+
+/**
+ * replaces the folds with closed ones made from how far the lines of the
+ * text are indented: one over each run of two or more lines indented
+ * further than the line before the run, with blank lines going along with
+ * the lines around them
+ */
+void fold_indent(struct Folds *folds, struct Text *top_of_text);
+
+/**
+ * the closed fold that the line numbered line_no is hidden in, or NULL if
+ * it is shown
+ */
+struct Fold *fold_at(struct Folds *folds, size_t line_no);
+
+/**
+ * the first line of fold. from is any line of the text and from_no its
+ * number, which the line is walked to from if it is not known
+ */
+struct Text *fold_first(struct Fold *fold, struct Text *from, size_t from_no);
+
+/**
+ * the last line of fold, found the same way
+ */
+struct Text *fold_last(struct Fold *fold, struct Text *from, size_t from_no);
+
+/**
+ * opens the closed fold shown at line_no, leaving the folds inside it as
+ * they were. returns 0 if there is none
+ */
+int fold_open(struct Folds *folds, size_t line_no);
+
+/**
+ * closes the innermost open fold around what is shown at line_no. returns 0
+ * if there is none
+ */
+int fold_close(struct Folds *folds, size_t line_no);
+
+/**
+ * opens or closes every fold
+ */
+void fold_all(struct Folds *folds, int closed);
+
+/**
+ * deletes the fold that fold_open or else fold_close would act on, leaving
+ * the lines where they are. returns 0 if there is none
+ */
+int fold_delete(struct Folds *folds, size_t line_no);
+
+/**
+ * moves the folds along after a change. the lines first to end, not
+ * including end, were replaced by shift more lines than there were, and
+ * lines outside those are the same lines they were. folds reaching into
+ * the change are cut down to what is left of them and forget the lines at
+ * their ends that it touched
+ */
+void fold_changed(struct Folds *folds, size_t first, size_t end, long shift);
+
+void fold_free(struct Folds *folds);
+
+#endif /* FOLD_H */
@@ -0,0 +1,358 @@
+/*
+ *     Copyright (C) 2020 Kyle Kloberdanz
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <glob.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "grep.h"
+
+#define MIN(A, B) ((A) < (B) ? (A) : (B))
+
+#define GREP_MAX_THREADS 16
+
+int lstat(const char *path, struct stat *buf);
+
+/* a file with a NUL this near the start is taken to be binary and skipped */
+#define GREP_BINARY_CHECK 4096
+
+struct Names {
+    char **names;
+    size_t n;
+    size_t capacity;
+};
+
+/* the matches found in one file */
+struct Found {
+    struct Match *matches;
+    size_t n;
+    size_t capacity;
+};
+
+/* what the threads share. each takes the next file not yet searched */
+struct GrepJob {
+    const char *pattern;
+    size_t len;
+    struct Names *files;
+    struct Found *found;
+    size_t next;
+    pthread_mutex_t lock;
+};
+
+static void names_add(struct Names *names, const char *name, size_t len) {
+    if (names->n == names->capacity) {
+        names->capacity = names->capacity ? names->capacity * 2 : 64;
+        names->names = realloc(names->names, names->capacity * sizeof(char *));
+    }
+    names->names[names->n] = malloc(len + 1);
+    memcpy(names->names[names->n], name, len);
+    names->names[names->n][len] = '\0';
+    names->n++;
+}
+
+static int compare_names(const void *a, const void *b) {
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+/* adds path, or every file below it if it is a directory, in name order */
+static void add_path(struct Names *files, const char *path, int top) {
+    struct Names entries;
+    struct stat st;
+    struct dirent *entry;
+    DIR *dir;
+    char *sub;
+    size_t len;
+    size_t i;
+
+    /*
+     * a path named to :grep is followed wherever it leads, but a link found
+     * under it is only followed to a file, as a link to a directory may
+     * lead back up the tree
+     */
+    if ((top ? stat(path, &st) : lstat(path, &st)) < 0) {
+        return;
+    }
+    if (S_ISLNK(st.st_mode) && (stat(path, &st) < 0 || S_ISDIR(st.st_mode))) {
+        return;
+    }
+    if (!S_ISDIR(st.st_mode)) {
+        if (S_ISREG(st.st_mode)) {
+            names_add(files, path, strlen(path));
+        }
+        return;
+    }
+
+    dir = opendir(path);
+    if (!dir) {
+        return;
+    }
+    memset(&entries, 0, sizeof(entries));
+    while ((entry = readdir(dir))) {
+        /* leaves out . and .. as well as hidden ones such as .git */
+        if (entry->d_name[0] != '.') {
+            names_add(&entries, entry->d_name, strlen(entry->d_name));
+        }
+    }
+    closedir(dir);
+    qsort(entries.names, entries.n, sizeof(char *), compare_names);
+
+    len = strlen(path);
+    for (i = 0; i < entries.n; i++) {
+        sub = malloc(len + strlen(entries.names[i]) + 2);
+        strcpy(sub, path);
+        if (len && path[len - 1] != '/') {
+            strcat(sub, "/");
+        }
+        strcat(sub, entries.names[i]);
+        add_path(files, sub, 0);
+        free(sub);
+        free(entries.names[i]);
+    }
+    free(entries.names);
+}
+
+static const char *find(
+    const char *p,
+    const char *end,
+    const char *pattern,
+    size_t len
+) {
+    for (; (size_t)(end - p) >= len; p++) {
+        p = memchr(p, pattern[0], (end - p) - len + 1);
+        if (!p) {
+            return NULL;
+        }
+        if (!memcmp(p, pattern, len)) {
+            return p;
+        }
+    }
+    return NULL;
+}
+
+static void found_add(struct Found *found, size_t line_no, size_t col) {
+    if (found->n == found->capacity) {
+        found->capacity = found->capacity ? found->capacity * 2 : 16;
+        found->matches = realloc(
+            found->matches,
+            found->capacity * sizeof(struct Match)
+        );
+    }
+    found->matches[found->n].line_no = line_no;
+    found->matches[found->n].col = col;
+    found->n++;
+}
+
+/*
+ * finds the lines of a mapped file that hold the pattern. lines are
+ * counted only between one match and the next, with memchr
+ */
+static void search(
+    struct GrepJob *job,
+    const char *data,
+    size_t size,
+    struct Found *found
+) {
+    const char *end = data + size;
+    const char *line = data;
+    const char *p = data;
+    const char *hit;
+    const char *newline;
+    size_t line_no = 1;
+
+    if (memchr(data, '\0', MIN(size, GREP_BINARY_CHECK))) {
+        return;
+    }
+    while ((hit = find(p, end, job->pattern, job->len))) {
+        while ((newline = memchr(line, '\n', hit - line))) {
+            line = newline + 1;
+            line_no++;
+        }
+        found_add(found, line_no, hit - line);
+
+        /* one match is enough for a line */
+        newline = memchr(hit, '\n', end - hit);
+        if (!newline) {
+            break;
+        }
+        p = newline + 1;
+        line = p;
+        line_no++;
+    }
+}
+
+static void search_file(struct GrepJob *job, size_t i) {
+    struct stat st;
+    void *data;
+    int fd = open(job->files->names[i], O_RDONLY);
+
+    if (fd < 0) {
+        return;
+    }
+    if ((fstat(fd, &st) == 0) && (st.st_size > 0)) {
+        data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data != MAP_FAILED) {
+            search(job, data, st.st_size, &job->found[i]);
+            munmap(data, st.st_size);
+        }
+    }
+    close(fd);
+}
+
+static void *grep_thread(void *arg) {
+    struct GrepJob *job = arg;
+    size_t i;
+
+    for (;;) {
+        pthread_mutex_lock(&job->lock);
+        i = job->next++;
+        pthread_mutex_unlock(&job->lock);
+        if (i >= job->files->n) {
+            break;
+        }
+        search_file(job, i);
+    }
+    return NULL;
+}
+
+static void grep_parallel(struct GrepJob *job) {
+    pthread_t threads[GREP_MAX_THREADS];
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    size_t nthreads = 0;
+    size_t i;
+
+    pthread_mutex_init(&job->lock, NULL);
+    for (i = 1; (i < (size_t)cpus) && (i < GREP_MAX_THREADS) &&
+        (i < job->files->n); i++
+    ) {
+        if (pthread_create(&threads[nthreads], NULL, grep_thread, job)) {
+            break;
+        }
+        nthreads++;
+    }
+    grep_thread(job);
+    for (i = 0; i < nthreads; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    pthread_mutex_destroy(&job->lock);
+}
+
+/* moves the matches of each file into qf, keeping only the files with any */
+static void collect(
+    struct Quickfix *qf,
+    struct Names *files,
+    struct Found *found
+) {
+    size_t total = 0;
+    size_t i;
+    size_t j;
+
+    for (i = 0; i < files->n; i++) {
+        total += found[i].n;
+    }
+    qf->matches = malloc((total ? total : 1) * sizeof(struct Match));
+    qf->files = malloc((files->n ? files->n : 1) * sizeof(char *));
+    for (i = 0; i < files->n; i++) {
+        if (!found[i].n) {
+            free(files->names[i]);
+            continue;
+        }
+        for (j = 0; j < found[i].n; j++) {
+            qf->matches[qf->n] = found[i].matches[j];
+            qf->matches[qf->n].file = qf->nfiles;
+            qf->n++;
+        }
+        qf->files[qf->nfiles++] = files->names[i];
+        free(found[i].matches);
+    }
+    free(files->names);
+}
+
+const char *grep(struct Quickfix *qf, const char *arg) {
+    struct Names files;
+    struct GrepJob job;
+    glob_t paths;
+    const char *word;
+    char *path;
+    size_t len;
+    size_t i;
+
+    memset(&files, 0, sizeof(files));
+    while (*arg == ' ' || *arg == '\t') {
+        arg++;
+    }
+    for (len = 0; arg[len] && arg[len] != ' ' && arg[len] != '\t'; len++) {
+    }
+    if (len == 0) {
+        return "missing pattern";
+    }
+    job.pattern = arg;
+    job.len = len;
+
+    for (word = arg + len; *word; word += len) {
+        while (*word == ' ' || *word == '\t') {
+            word++;
+        }
+        for (len = 0; word[len] && word[len] != ' ' && word[len] != '\t'; len++) {
+        }
+        if (len == 0) {
+            break;
+        }
+        path = malloc(len + 1);
+        memcpy(path, word, len);
+        path[len] = '\0';
+        if (glob(path, GLOB_NOCHECK, NULL, &paths) == 0) {
+            for (i = 0; i < paths.gl_pathc; i++) {
+                add_path(&files, paths.gl_pathv[i], 1);
+            }
+            globfree(&paths);
+        }
+        free(path);
+    }
+    if (files.n == 0) {
+        free(files.names);
+        return "no files to search";
+    }
+
+    job.files = &files;
+    job.found = calloc(files.n, sizeof(struct Found));
+    job.next = 0;
+    grep_parallel(&job);
+
+    grep_free(qf);
+    collect(qf, &files, job.found);
+    free(job.found);
+    if (qf->n == 0) {
+        return "no matches";
+    }
+    return NULL;
+}
+
+void grep_free(struct Quickfix *qf) {
+    size_t i;
+    for (i = 0; i < qf->nfiles; i++) {
+        free(qf->files[i]);
+    }
+    free(qf->files);
+    free(qf->matches);
+    memset(qf, 0, sizeof(struct Quickfix));
+}
@@ -0,0 +1,55 @@
+/*
+ *     Copyright (C) 2020 Kyle Kloberdanz
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef GREP_H
+#define GREP_H
+
+#include <stddef.h>
+
+/* a line that matched, col being where the match starts on it */
+struct Match {
+    size_t file;
+    size_t line_no;
+    size_t col;
+};
+
+/*
+ * the matches of the last :grep, in the order of the files and lines they
+ * are on, and the one that was jumped to last. files holds the names of
+ * only those files that had a match
+ */
+struct Quickfix {
+    char **files;
+    size_t nfiles;
+    struct Match *matches;
+    size_t n;
+    size_t current;
+};
+
+/**
+ * runs ":grep pattern path...", where arg is everything after the command
+ * name. each path may be a glob, and directories are searched all the way
+ * down. files are mapped into memory and searched by several threads at
+ * once for lines that hold the pattern as it is written. the quickfix list
+ * is replaced with what was found. returns NULL on success or a message
+ * saying what is wrong
+ */
+const char *grep(struct Quickfix *qf, const char *arg);
+
+void grep_free(struct Quickfix *qf);
+
+#endif /* GREP_H */
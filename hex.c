@@ -0,0 +1,163 @@
+/*
+ *     Copyright (C) 2020 Kyle Kloberdanz
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "hex.h"
+
+/* patched bytes next to each other are written to the file this many at once */
+#define HEX_RUN 4096
+
+/* where in the patches the one for offset is, or would go */
+static size_t find_patch(const struct Hex *hex, size_t offset) {
+    size_t lo = 0;
+    size_t hi = hex->n;
+    size_t mid;
+
+    while (lo < hi) {
+        mid = lo + (hi - lo) / 2;
+        if (hex->patches[mid].offset < offset) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+const char *hex_open(struct Hex *hex, const char *filename) {
+    struct stat st;
+    void *mapped = NULL;
+    int fd;
+
+    memset(hex, 0, sizeof(struct Hex));
+    fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        return "cannot open file";
+    }
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+        close(fd);
+        return "not a regular file";
+    }
+    if (st.st_size > 0) {
+        /* shared, so that what is saved shows up in the mapping */
+        mapped = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    if (mapped == MAP_FAILED) {
+        return "cannot map file";
+    }
+    hex->map = mapped;
+    hex->size = (size_t)st.st_size;
+    hex->filename = malloc(strlen(filename) + 1);
+    strcpy(hex->filename, filename);
+    return NULL;
+}
+
+unsigned char hex_byte(const struct Hex *hex, size_t offset) {
+    size_t i = find_patch(hex, offset);
+
+    if (i < hex->n && hex->patches[i].offset == offset) {
+        return hex->patches[i].byte;
+    }
+    return hex->map[offset];
+}
+
+int hex_patched(const struct Hex *hex, size_t offset) {
+    size_t i = find_patch(hex, offset);
+    return i < hex->n && hex->patches[i].offset == offset;
+}
+
+void hex_set(struct Hex *hex, size_t offset, unsigned char byte) {
+    size_t i = find_patch(hex, offset);
+    int found = i < hex->n && hex->patches[i].offset == offset;
+
+    if (hex->map[offset] == byte) {
+        if (found) {
+            memmove(&hex->patches[i], &hex->patches[i + 1],
+                (hex->n - i - 1) * sizeof(struct Patch));
+            hex->n--;
+        }
+        return;
+    }
+    if (!found) {
+        if (hex->n == hex->capacity) {
+            hex->capacity = 1 + (hex->capacity * 2);
+            hex->patches = realloc(
+                hex->patches,
+                hex->capacity * sizeof(struct Patch)
+            );
+        }
+        memmove(&hex->patches[i + 1], &hex->patches[i],
+            (hex->n - i) * sizeof(struct Patch));
+        hex->n++;
+        hex->patches[i].offset = offset;
+    }
+    hex->patches[i].byte = byte;
+}
+
+const char *hex_save(struct Hex *hex) {
+    unsigned char run[HEX_RUN];
+    size_t i = 0;
+    size_t n;
+    int fd;
+
+    if (hex->n == 0) {
+        return NULL;
+    }
+    fd = open(hex->filename, O_WRONLY);
+    if (fd < 0) {
+        return "cannot open file for writing";
+    }
+    while (i < hex->n) {
+        run[0] = hex->patches[i].byte;
+        for (n = 1; n < HEX_RUN && i + n < hex->n &&
+            hex->patches[i + n].offset == hex->patches[i].offset + n; n++
+        ) {
+            run[n] = hex->patches[i + n].byte;
+        }
+        if (lseek(fd, (off_t)hex->patches[i].offset, SEEK_SET) < 0 ||
+            write(fd, run, n) != (ssize_t)n
+        ) {
+            close(fd);
+            return "cannot write file";
+        }
+        i += n;
+    }
+    close(fd);
+
+    /* the file now holds the bytes the patches did */
+    free(hex->patches);
+    hex->patches = NULL;
+    hex->n = 0;
+    hex->capacity = 0;
+    return NULL;
+}
+
+void hex_close(struct Hex *hex) {
+    if (hex->map) {
+        munmap(hex->map, hex->size);
+    }
+    free(hex->patches);
+    free(hex->filename);
+    memset(hex, 0, sizeof(struct Hex));
+}
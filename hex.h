@@ -0,0 +1,75 @@
+/*
+ *     Copyright (C) 2020 Kyle Kloberdanz
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef HEX_H
+#define HEX_H
+
+#include <stddef.h>
+
+/* a byte written over the one in the file at offset */
+struct Patch {
+    size_t offset;
+    unsigned char byte;
+};
+
+/*
+ * a file looked at as bytes. it is mapped for reading rather than read, so
+ * only the pages shown are ever brought in, however big it is. bytes
+ * written over are kept in patches, in order of offset, until they are
+ * saved
+ */
+struct Hex {
+    char *filename;
+    unsigned char *map;
+    size_t size;
+    struct Patch *patches;
+    size_t n;
+    size_t capacity;
+};
+
+/**
+ * maps filename to be looked at as bytes. returns NULL on success or a
+ * message saying what is wrong
+ */
+const char *hex_open(struct Hex *hex, const char *filename);
+
+/**
+ * the byte at offset as it is now, with any patch over it
+ */
+unsigned char hex_byte(const struct Hex *hex, size_t offset);
+
+/**
+ * whether the byte at offset has been written over
+ */
+int hex_patched(const struct Hex *hex, size_t offset);
+
+/**
+ * writes byte over the one at offset. writing back the byte the file has
+ * drops the patch
+ */
+void hex_set(struct Hex *hex, size_t offset, unsigned char byte);
+
+/**
+ * writes the patched bytes into the file where they are, leaving the rest
+ * of it untouched, and forgets the patches. returns NULL on success or a
+ * message saying what is wrong
+ */
+const char *hex_save(struct Hex *hex);
+
+void hex_close(struct Hex *hex);
+
+#endif /* HEX_H */
@@ -0,0 +1,173 @@
+/*
+ *     Copyright (C) 2020 Kyle Kloberdanz
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+
+#include "lz.h"
+
+/*
+ * the compressed bytes are a run of sequences, each a token byte holding
+ * how many literal bytes follow it in the top four bits and how much longer
+ * than LZ_MIN_MATCH the repeat after them is in the bottom four. a count of
+ * 15 goes on in the bytes after it, each 255 adding to it until one that is
+ * less. the literals come next, then the distance back to the repeat in two
+ * bytes, low byte first. the last sequence is only literals
+ */
+
+#define LZ_HASH_BITS 12
+
+#define LZ_MIN_MATCH 4
+
+#define LZ_MAX_OFFSET 65535
+
+/* no position has been seen with this hash yet */
+#define LZ_NONE ((size_t)-1)
+
+static unsigned long read32(const unsigned char *p) {
+    return (unsigned long)p[0] | ((unsigned long)p[1] << 8) |
+        ((unsigned long)p[2] << 16) | ((unsigned long)p[3] << 24);
+}
+
+static size_t hash(unsigned long word) {
+    return (size_t)(((word * 2654435761UL) & 0xffffffffUL) >>
+        (32 - LZ_HASH_BITS));
+}
+
+/* writes what is left of a count over 15 */
+static unsigned char *put_count(unsigned char *out, size_t n) {
+    for (; n >= 255; n -= 255) {
+        *out++ = 255;
+    }
+    *out++ = (unsigned char)n;
+    return out;
+}
+
+/* the literals from, up to a repeat of len bytes offset back, if len */
+static unsigned char *put_sequence(
+    unsigned char *out,
+    const unsigned char *from,
+    size_t literals,
+    size_t offset,
+    size_t len
+) {
+    size_t extra = len ? len - LZ_MIN_MATCH : 0;
+
+    *out++ = (unsigned char)(((literals < 15 ? literals : 15) << 4) |
+        (extra < 15 ? extra : 15));
+    if (literals >= 15) {
+        out = put_count(out, literals - 15);
+    }
+    memcpy(out, from, literals);
+    out += literals;
+    if (len) {
+        *out++ = (unsigned char)(offset & 0xff);
+        *out++ = (unsigned char)(offset >> 8);
+        if (extra >= 15) {
+            out = put_count(out, extra - 15);
+        }
+    }
+    return out;
+}
+
+size_t lz_bound(size_t n) {
+    return n + n / 255 + 16;
+}
+
+size_t lz_compress(const unsigned char *src, size_t n, unsigned char *dst) {
+    size_t table[1 << LZ_HASH_BITS];
+    unsigned char *out = dst;
+    size_t anchor = 0;
+    size_t i = 0;
+    size_t seen;
+    size_t len;
+    size_t h;
+
+    for (h = 0; h < (1 << LZ_HASH_BITS); h++) {
+        table[h] = LZ_NONE;
+    }
+    while (i + LZ_MIN_MATCH <= n) {
+        h = hash(read32(src + i));
+        seen = table[h];
+        table[h] = i;
+        if (seen == LZ_NONE || i - seen > LZ_MAX_OFFSET ||
+            read32(src + seen) != read32(src + i)
+        ) {
+            i++;
+            continue;
+        }
+        for (len = LZ_MIN_MATCH; i + len < n && src[seen + len] == src[i + len];
+            len++
+        ) {
+        }
+        out = put_sequence(out, src + anchor, i - anchor, i - seen, len);
+        i += len;
+        anchor = i;
+    }
+    out = put_sequence(out, src + anchor, n - anchor, 0, 0);
+    return (size_t)(out - dst);
+}
+
+/* reads the rest of a count that was 15 in its token */
+static size_t get_count(const unsigned char **in, size_t n) {
+    unsigned char c;
+    if (n < 15) {
+        return n;
+    }
+    do {
+        c = *(*in)++;
+        n += c;
+    } while (c == 255);
+    return n;
+}
+
+void lz_expand(
+    const unsigned char *src,
+    size_t size,
+    unsigned char *dst,
+    size_t n
+) {
+    const unsigned char *in = src;
+    const unsigned char *end = src + size;
+    unsigned char *out = dst;
+    const unsigned char *from;
+    size_t literals;
+    size_t len;
+    unsigned char token;
+
+    while (in < end && (size_t)(out - dst) < n) {
+        token = *in++;
+        literals = get_count(&in, token >> 4);
+        memcpy(out, in, literals);
+        in += literals;
+        out += literals;
+        if (in >= end) {
+            break;
+        }
+        from = out - (in[0] | (in[1] << 8));
+        in += 2;
+        len = get_count(&in, token & 15) + LZ_MIN_MATCH;
+        if ((size_t)(out - from) >= len) {
+            memcpy(out, from, len);
+            out += len;
+        } else {
+            /* the repeat runs on into the bytes it is writing */
+            for (; len; len--) {
+                *out++ = *from++;
+            }
+        }
+    }
+}
@@ -0,0 +1,45 @@
+/*
+ *     Copyright (C) 2020 Kyle Kloberdanz
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef LZ_H
+#define LZ_H
+
+#include <stddef.h>
+
+/**
+ * the most bytes compressing n bytes can take
+ */
+size_t lz_bound(size_t n);
+
+/**
+ * compresses the n bytes at src into dst, which has room for lz_bound(n)
+ * bytes, and returns how many it took. repeats are found by hashing every
+ * four bytes and looking back at most 64K for the last place they were seen
+ */
+size_t lz_compress(const unsigned char *src, size_t n, unsigned char *dst);
+
+/**
+ * expands size bytes made by lz_compress back into the n bytes at dst
+ */
+void lz_expand(
+    const unsigned char *src,
+    size_t size,
+    unsigned char *dst,
+    size_t n
+);
+
+#endif /* LZ_H */
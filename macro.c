@@ -0,0 +1,125 @@
+/*
+ *     Copyright (C) 2020 Kyle Kloberdanz
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "macro.h"
+
+void macro_record(struct Macro *macro, int name) {
+    macro->recording = name;
+    macro->len = 0;
+}
+
+void macro_key(struct Macro *macro, int c) {
+    if (!macro->recording || c <= 0) {
+        return;
+    }
+    if (macro->len >= macro->capacity) {
+        macro->capacity = 1 + (macro->capacity * 2);
+        macro->keys = realloc(macro->keys, macro->capacity);
+    }
+    macro->keys[macro->len++] = (char)c;
+}
+
+struct Text *macro_stop(struct Macro *macro) {
+    size_t len = macro->len;
+    macro->recording = 0;
+    if (len > 0) {
+        len--;
+    }
+    return text_from_chars(macro->keys ? macro->keys : "", len);
+}
+
+/* drops replays that have no keys left */
+static void macro_pop_finished(struct Macro *macro) {
+    struct Replay *replay;
+    while ((replay = macro->replay) && (replay->pos >= replay->len)) {
+        if (--replay->repeat > 0) {
+            replay->pos = 0;
+            break;
+        }
+        macro->replay = replay->next;
+        free(replay->keys);
+        free(replay);
+    }
+}
+
+void macro_play(struct Macro *macro, struct Text *text, size_t count) {
+    struct Replay *replay;
+    struct Text *line;
+    size_t size = 0;
+    char *p;
+
+    for (line = text; line; line = line->next) {
+        size += strlen(text_peek(line));
+    }
+    if ((size == 0) || (count == 0)) {
+        return;
+    }
+
+    /*
+     * a macro that ends by running itself would otherwise stack one replay
+     * per run, so a finished replay is dropped before the new one starts
+     */
+    if (macro->replay && macro->replay->pos >= macro->replay->len
+            && macro->replay->repeat == 1) {
+        macro_pop_finished(macro);
+    }
+
+    replay = malloc(sizeof(struct Replay));
+    replay->keys = malloc(size);
+    for (p = replay->keys, line = text; line; line = line->next) {
+        const char *data = text_peek(line);
+        size_t n = strlen(data);
+        memcpy(p, data, n);
+        p += n;
+    }
+    replay->len = size;
+    replay->pos = 0;
+    replay->repeat = count;
+    replay->next = macro->replay;
+    macro->replay = replay;
+}
+
+int macro_next(struct Macro *macro) {
+    macro_pop_finished(macro);
+    if (!macro->replay) {
+        return -1;
+    }
+    return (unsigned char)macro->replay->keys[macro->replay->pos++];
+}
+
+int macro_pending(struct Macro *macro) {
+    macro_pop_finished(macro);
+    return macro->replay != NULL;
+}
+
+void macro_abort(struct Macro *macro) {
+    struct Replay *replay;
+    while ((replay = macro->replay)) {
+        macro->replay = replay->next;
+        free(replay->keys);
+        free(replay);
+    }
+}
+
+void macro_free(struct Macro *macro) {
+    macro_abort(macro);
+    free(macro->keys);
+    macro->keys = NULL;
+}
@@ -0,0 +1,80 @@
+/*
+ *     Copyright (C) 2020 Kyle Kloberdanz
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef MACRO_H
+#define MACRO_H
+
+#include "text.h"
+
+/* keys being replayed, repeat more times, on top of the replay that ran it */
+struct Replay {
+    char *keys;
+    size_t len;
+    size_t pos;
+    size_t repeat;
+    struct Replay *next;
+};
+
+struct Macro {
+    int recording;
+    char *keys;
+    size_t len;
+    size_t capacity;
+    struct Replay *replay;
+    int playing;
+};
+
+/**
+ * starts recording typed keys for the register name
+ */
+void macro_record(struct Macro *macro, int name);
+
+/**
+ * remembers a key typed by the user while recording
+ */
+void macro_key(struct Macro *macro, int c);
+
+/**
+ * stops recording and returns the keys typed since macro_record, leaving
+ * out the q that ended the recording
+ */
+struct Text *macro_stop(struct Macro *macro);
+
+/**
+ * replays the keys held in text count times before any keys still waiting
+ * from an outer replay
+ */
+void macro_play(struct Macro *macro, struct Text *text, size_t count);
+
+/**
+ * the next key to replay, or -1 once the queue is empty
+ */
+int macro_next(struct Macro *macro);
+
+/**
+ * true while queued keys are waiting to be replayed
+ */
+int macro_pending(struct Macro *macro);
+
+/**
+ * drops every queued key, used when a replayed command fails
+ */
+void macro_abort(struct Macro *macro);
+
+void macro_free(struct Macro *macro);
+
+#endif /* MACRO_H */
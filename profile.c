@@ -0,0 +1,297 @@
+/*
+ *     Copyright (C) 2020 Kyle Kloberdanz
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/* for clock_gettime */
+#define _POSIX_C_SOURCE 199309L
+
+#include "profile.h"
+
+#ifdef PROFILE
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/* latencies are kept in buckets of powers of two microseconds */
+#define PROFILE_BUCKETS 32
+
+struct Latency {
+    unsigned long count;
+    double total;
+    double max;
+    unsigned long buckets[PROFILE_BUCKETS];
+};
+
+struct Throughput {
+    unsigned long count;
+    unsigned long bytes;
+    double seconds;
+};
+
+static const char *const phase_names[PHASE_COUNT] = {
+    "handle_input", "redraw_screen"
+};
+
+static const char *const counter_names[COUNT_COUNT] = {
+    "line_allocs", "line_frees", "slab_allocs", "payload_allocs",
+    "payload_grows", "payload_frees", "layout_allocs", "line_freezes",
+    "line_thaws"
+};
+
+static const char *const io_names[IO_COUNT] = {"load", "save"};
+
+/*
+ * everything recorded so far. files are loaded off the main thread and
+ * lines are allocated there while they are, so it is all under the lock
+ */
+static struct {
+    struct Latency phases[PHASE_COUNT];
+    double started[PHASE_COUNT];
+    unsigned long written[PHASE_COUNT];
+    unsigned long saved[PHASE_COUNT];
+    int open[PHASE_COUNT];
+    double wait_started;
+    unsigned long terminal_bytes;
+    unsigned long saved_bytes;
+    unsigned long counters[COUNT_COUNT];
+    struct Throughput io[IO_COUNT];
+} stats;
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+double profile_clock(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)now.tv_sec + (double)now.tv_nsec / 1e9;
+}
+
+/*
+ * the bytes this process has written so far, as the kernel counts them.
+ * curses has no hook to count what it sends to the terminal, so that is
+ * taken to be what was written during a phase, less any file saved in it
+ */
+static unsigned long bytes_written(void) {
+    char buf[512];
+    const char *wchar;
+    ssize_t n;
+    int fd = open("/proc/self/io", O_RDONLY);
+
+    if (fd < 0) {
+        return 0;
+    }
+    n = read(fd, buf, sizeof(buf) - 1);
+    close(fd);
+    if (n <= 0) {
+        return 0;
+    }
+    buf[n] = '\0';
+    wchar = strstr(buf, "wchar:");
+    return wchar ? strtoul(wchar + 6, NULL, 10) : 0;
+}
+
+void profile_begin(enum Phase phase) {
+    unsigned long written = bytes_written();
+
+    pthread_mutex_lock(&lock);
+    stats.written[phase] = written;
+    stats.saved[phase] = stats.saved_bytes;
+    stats.open[phase] = 1;
+    stats.started[phase] = profile_clock();
+    pthread_mutex_unlock(&lock);
+}
+
+void profile_end(enum Phase phase) {
+    double now = profile_clock();
+    struct Latency *latency = &stats.phases[phase];
+    unsigned long written;
+    unsigned long saved;
+    double usec;
+    size_t bucket;
+
+    pthread_mutex_lock(&lock);
+    usec = (now - stats.started[phase]) * 1e6;
+    latency->count++;
+    latency->total += usec;
+    if (usec > latency->max) {
+        latency->max = usec;
+    }
+    for (bucket = 0; bucket + 1 < PROFILE_BUCKETS &&
+        usec >= (double)(1UL << bucket); bucket++
+    ) {
+    }
+    latency->buckets[bucket]++;
+    stats.open[phase] = 0;
+    pthread_mutex_unlock(&lock);
+
+    written = bytes_written();
+    pthread_mutex_lock(&lock);
+    saved = stats.saved_bytes - stats.saved[phase];
+    if (written > stats.written[phase] + saved) {
+        stats.terminal_bytes += written - stats.written[phase] - saved;
+    }
+    pthread_mutex_unlock(&lock);
+}
+
+void profile_wait(int waiting) {
+    double now = profile_clock();
+    size_t i;
+
+    pthread_mutex_lock(&lock);
+    if (waiting) {
+        stats.wait_started = now;
+    } else {
+        for (i = 0; i < PHASE_COUNT; i++) {
+            if (stats.open[i]) {
+                stats.started[i] += now - stats.wait_started;
+            }
+        }
+    }
+    pthread_mutex_unlock(&lock);
+}
+
+void profile_count(enum Counter counter, size_t n) {
+    pthread_mutex_lock(&lock);
+    stats.counters[counter] += n;
+    pthread_mutex_unlock(&lock);
+}
+
+void profile_io(enum Io io, size_t bytes, double seconds) {
+    pthread_mutex_lock(&lock);
+    stats.io[io].count++;
+    stats.io[io].bytes += bytes;
+    stats.io[io].seconds += seconds;
+    if (io == IO_SAVE) {
+        stats.saved_bytes += bytes;
+    }
+    pthread_mutex_unlock(&lock);
+}
+
+/* the latency in microseconds that the given share of keys came in under */
+static double percentile(const struct Latency *latency, double share) {
+    unsigned long seen = 0;
+    size_t i;
+
+    for (i = 0; i < PROFILE_BUCKETS; i++) {
+        seen += latency->buckets[i];
+        if ((double)seen >= share * (double)latency->count) {
+            return (double)(1UL << i);
+        }
+    }
+    return latency->max;
+}
+
+static double mean(double total, unsigned long count) {
+    return count ? total / (double)count : 0.0;
+}
+
+/* megabytes a second */
+static double rate(const struct Throughput *io) {
+    return io->seconds > 0 ? (double)io->bytes / 1e6 / io->seconds : 0.0;
+}
+
+void profile_report(char *report, size_t size) {
+    char line[160];
+    const struct Latency *latency;
+    size_t len = 0;
+    size_t i;
+
+    report[0] = '\0';
+    pthread_mutex_lock(&lock);
+    for (i = 0; i < PHASE_COUNT; i++) {
+        latency = &stats.phases[i];
+        sprintf(line, "%-14s %8lu keys  mean %8.1fus  p50 <%7.0fus  "
+            "p99 <%7.0fus  max %8.1fus\n", phase_names[i], latency->count,
+            mean(latency->total, latency->count), percentile(latency, 0.5),
+            percentile(latency, 0.99), latency->max);
+        strncat(report + len, line, size - len - 1);
+        len += strlen(report + len);
+    }
+    sprintf(line, "%-14s %8lu bytes  %.1f per key\n", "terminal",
+        stats.terminal_bytes, mean((double)stats.terminal_bytes,
+        stats.phases[PHASE_INPUT].count));
+    strncat(report + len, line, size - len - 1);
+    len += strlen(report + len);
+    for (i = 0; i < COUNT_COUNT; i++) {
+        sprintf(line, "%-14s %8lu\n", counter_names[i], stats.counters[i]);
+        strncat(report + len, line, size - len - 1);
+        len += strlen(report + len);
+    }
+    for (i = 0; i < IO_COUNT; i++) {
+        sprintf(line, "%-14s %8lu files  %lu bytes  %.1f MB/s\n", io_names[i],
+            stats.io[i].count, stats.io[i].bytes, rate(&stats.io[i]));
+        strncat(report + len, line, size - len - 1);
+        len += strlen(report + len);
+    }
+    pthread_mutex_unlock(&lock);
+}
+
+int profile_write(const char *filename) {
+    FILE *fp = fopen(filename, "w");
+    const struct Latency *latency;
+    size_t i;
+    size_t j;
+
+    if (!fp) {
+        return -1;
+    }
+    pthread_mutex_lock(&lock);
+    fputs("{\n  \"phases\": {\n", fp);
+    for (i = 0; i < PHASE_COUNT; i++) {
+        latency = &stats.phases[i];
+        fprintf(fp, "    \"%s\": {\"count\": %lu, \"total_us\": %.1f, "
+            "\"max_us\": %.1f, \"buckets_us\": [", phase_names[i],
+            latency->count, latency->total, latency->max);
+        for (j = 0; j < PROFILE_BUCKETS; j++) {
+            fprintf(fp, "%s%lu", j ? ", " : "", latency->buckets[j]);
+        }
+        fprintf(fp, "]}%s\n", i + 1 < PHASE_COUNT ? "," : "");
+    }
+    fprintf(fp, "  },\n  \"terminal_bytes\": %lu,\n  \"allocations\": {\n",
+        stats.terminal_bytes);
+    for (i = 0; i < COUNT_COUNT; i++) {
+        fprintf(fp, "    \"%s\": %lu%s\n", counter_names[i], stats.counters[i],
+            i + 1 < COUNT_COUNT ? "," : "");
+    }
+    fputs("  },\n  \"io\": {\n", fp);
+    for (i = 0; i < IO_COUNT; i++) {
+        fprintf(fp, "    \"%s\": {\"count\": %lu, \"bytes\": %lu, "
+            "\"seconds\": %.6f}%s\n", io_names[i], stats.io[i].count,
+            stats.io[i].bytes, stats.io[i].seconds,
+            i + 1 < IO_COUNT ? "," : "");
+    }
+    fputs("  }\n}\n", fp);
+    pthread_mutex_unlock(&lock);
+    return fclose(fp) ? -1 : 0;
+}
+
+void profile_exit(void) {
+    const char *filename = getenv("VIN_PROFILE");
+    if (filename && filename[0]) {
+        profile_write(filename);
+    }
+}
+
+#else
+
+/* iso c wants every file to declare something */
+typedef int profile_unused;
+
+#endif /* PROFILE */
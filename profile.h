@@ -0,0 +1,127 @@
+/*
+ *     Copyright (C) 2020 Kyle Kloberdanz
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <stddef.h>
+
+/* the two halves of the time taken by a key */
+enum Phase {
+    PHASE_INPUT,
+    PHASE_REDRAW,
+    PHASE_COUNT
+};
+
+/* events counted as they happen */
+enum Counter {
+    COUNT_LINE_ALLOCS,
+    COUNT_LINE_FREES,
+    COUNT_SLAB_ALLOCS,
+    COUNT_PAYLOAD_ALLOCS,
+    COUNT_PAYLOAD_GROWS,
+    COUNT_PAYLOAD_FREES,
+    COUNT_LAYOUT_ALLOCS,
+    COUNT_FREEZES,
+    COUNT_THAWS,
+    COUNT_COUNT
+};
+
+/* files read and written whole */
+enum Io {
+    IO_LOAD,
+    IO_SAVE,
+    IO_COUNT
+};
+
+/*
+ * the profiling layer is only built in with -DPROFILE, as make profile
+ * does. otherwise every one of these is nothing at all
+ */
+#ifdef PROFILE
+
+#define PROFILE_BEGIN(PHASE) profile_begin(PHASE)
+#define PROFILE_END(PHASE) profile_end(PHASE)
+#define PROFILE_WAIT_BEGIN() profile_wait(1)
+#define PROFILE_WAIT_END() profile_wait(0)
+#define PROFILE_COUNT(COUNTER, N) profile_count((COUNTER), (N))
+#define PROFILE_CLOCK(NAME) double NAME = profile_clock();
+#define PROFILE_IO(IO, BYTES, STARTED) \
+    profile_io((IO), (BYTES), profile_clock() - (STARTED))
+
+/* room for the whole of what profile_report writes */
+#define PROFILE_REPORT_SIZE 2048
+
+/**
+ * seconds since some fixed point in the past
+ */
+double profile_clock(void);
+
+/**
+ * starts timing a phase of the key being handled
+ */
+void profile_begin(enum Phase phase);
+
+/**
+ * stops timing a phase and adds it to the phase's latencies, along with
+ * the bytes written to the terminal meanwhile
+ */
+void profile_end(enum Phase phase);
+
+/**
+ * the time between waiting set and cleared is spent waiting on the user,
+ * and is left out of whatever phase is being timed
+ */
+void profile_wait(int waiting);
+
+void profile_count(enum Counter counter, size_t n);
+
+/**
+ * notes that a file of the given size was read or written in seconds
+ */
+void profile_io(enum Io io, size_t bytes, double seconds);
+
+/**
+ * writes a summary of everything recorded so far to report, one line per
+ * measure
+ */
+void profile_report(char *report, size_t size);
+
+/**
+ * writes everything recorded so far to filename as json. returns 0 on
+ * success
+ */
+int profile_write(const char *filename);
+
+/**
+ * writes the json to the file named by $VIN_PROFILE, if it is set
+ */
+void profile_exit(void);
+
+#else
+
+#define PROFILE_BEGIN(PHASE) ((void)0)
+#define PROFILE_END(PHASE) ((void)0)
+#define PROFILE_WAIT_BEGIN() ((void)0)
+#define PROFILE_WAIT_END() ((void)0)
+#define PROFILE_COUNT(COUNTER, N) ((void)0)
+#define PROFILE_CLOCK(NAME)
+#define PROFILE_IO(IO, BYTES, STARTED) ((void)0)
+
+#endif /* PROFILE */
+
+#endif /* PROFILE_H */
@@ -0,0 +1,161 @@
+/*
+ *     Copyright (C) 2020 Kyle Kloberdanz
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <ctype.h>
+#include <string.h>
+
+#include "register.h"
+
+#define SMALL_DELETE 36
+
+static int register_index(int name) {
+    if (name >= '0' && name <= '9') {
+        return name - '0';
+    } else if (name >= 'a' && name <= 'z') {
+        return 10 + (name - 'a');
+    } else if (name >= 'A' && name <= 'Z') {
+        return 10 + (name - 'A');
+    } else if (name == '-') {
+        return SMALL_DELETE;
+    }
+    return -1;
+}
+
+int register_valid(int name) {
+    return (name == '"') || (register_index(name) >= 0);
+}
+
+/* "A through "Z add to the end of "a through "z */
+static void register_append(struct Register *reg, struct Text *text, int chars) {
+    struct Text *tail = reg->text;
+
+    if (!reg->text) {
+        reg->text = text;
+        reg->charwise = chars;
+    } else if (reg->charwise && chars) {
+        while (tail->next) {
+            tail = tail->next;
+        }
+        text_thaw(text);
+        text_insert_chars(tail, TEXT_ALL_LINES, text->data, text->len);
+        if (text->next) {
+            text_splice_lines(tail, text->next);
+            text->next = NULL;
+        }
+        text_free_lines(text);
+    } else {
+        /* mixing kinds turns the register into whole lines */
+        while (tail->next) {
+            tail = tail->next;
+        }
+        if (reg->charwise) {
+            text_push_char(tail, '\n');
+        }
+        text_splice_lines(tail, text);
+        if (chars) {
+            while (tail->next) {
+                tail = tail->next;
+            }
+            text_push_char(tail, '\n');
+        }
+        reg->charwise = 0;
+    }
+}
+
+void register_set(
+    struct Registers *regs,
+    int name,
+    struct Text *text,
+    int charwise
+) {
+    struct Register *reg = &regs->reg[register_index(name)];
+
+    if (isupper(name)) {
+        register_append(reg, text, charwise);
+    } else {
+        text_free_lines(reg->text);
+        reg->text = text;
+        reg->charwise = charwise;
+    }
+}
+
+static void register_store(
+    struct Registers *regs,
+    int name,
+    struct Text *text,
+    int charwise
+) {
+    register_set(regs, name, text, charwise);
+    regs->unnamed = register_index(name);
+}
+
+void register_yank(
+    struct Registers *regs,
+    int name,
+    struct Text *text,
+    int charwise
+) {
+    if (!name || name == '"') {
+        name = '0';
+    }
+    register_store(regs, name, text, charwise);
+}
+
+void register_delete(
+    struct Registers *regs,
+    int name,
+    struct Text *text,
+    int charwise
+) {
+    int i;
+
+    if (name && name != '"') {
+        register_store(regs, name, text, charwise);
+    } else if (charwise) {
+        register_store(regs, '-', text, charwise);
+    } else {
+        text_free_lines(regs->reg[9].text);
+        for (i = 9; i > 1; i--) {
+            regs->reg[i] = regs->reg[i - 1];
+        }
+        regs->reg[1].text = text;
+        regs->reg[1].charwise = charwise;
+        regs->unnamed = 1;
+    }
+}
+
+struct Register *register_get(struct Registers *regs, int name) {
+    if (!name || name == '"') {
+        return &regs->reg[regs->unnamed];
+    }
+    return &regs->reg[register_index(name)];
+}
+
+void register_measure(struct Registers *regs, struct TextMemory *mem) {
+    int i;
+    for (i = 0; i < REGISTER_COUNT; i++) {
+        text_measure(regs->reg[i].text, mem);
+    }
+}
+
+void register_free(struct Registers *regs) {
+    int i;
+    for (i = 0; i < REGISTER_COUNT; i++) {
+        text_free_lines(regs->reg[i].text);
+        regs->reg[i].text = NULL;
+    }
+}
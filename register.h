@@ -0,0 +1,89 @@
+/*
+ *     Copyright (C) 2020 Kyle Kloberdanz
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef REGISTER_H
+#define REGISTER_H
+
+#include "text.h"
+
+/* "0 to "9, "a to "z and the small delete register "- */
+#define REGISTER_COUNT 37
+
+struct Register {
+    struct Text *text;
+    int charwise;
+};
+
+struct Registers {
+    struct Register reg[REGISTER_COUNT];
+    int unnamed;
+};
+
+/**
+ * true if name can follow " to select a register
+ */
+int register_valid(int name);
+
+/**
+ * replaces the contents of the named register, or appends to it if name is
+ * upper case, without changing which register "" refers to
+ */
+void register_set(
+    struct Registers *regs,
+    int name,
+    struct Text *text,
+    int charwise
+);
+
+/**
+ * stores yanked text in the named register, or "0 if name is 0. the
+ * registers take ownership of text
+ */
+void register_yank(
+    struct Registers *regs,
+    int name,
+    struct Text *text,
+    int charwise
+);
+
+/**
+ * stores deleted text in the named register. without a name, deleted lines
+ * shift "1 through "9 down and deletes within a line go to "-
+ */
+void register_delete(
+    struct Registers *regs,
+    int name,
+    struct Text *text,
+    int charwise
+);
+
+/**
+ * the named register, or the one "" refers to if name is 0
+ */
+struct Register *register_get(struct Registers *regs, int name);
+
+/**
+ * adds the lines held in every register to mem
+ */
+void register_measure(struct Registers *regs, struct TextMemory *mem);
+
+/**
+ * frees the contents of every register
+ */
+void register_free(struct Registers *regs);
+
+#endif /* REGISTER_H */
@@ -0,0 +1,340 @@
+/*
+ *     Copyright (C) 2020 Kyle Kloberdanz
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <ctype.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "sort.h"
+
+/* ranges shorter than this are not worth starting threads for */
+#define SORT_PARALLEL_MIN 65536
+
+#define SORT_MAX_THREADS 16
+
+/* runs this short are put in order by insertion */
+#define SORT_RUN 16
+
+struct SortJob {
+    struct Text **lines;
+    struct Text **tmp;
+    size_t mid;
+    size_t n;
+    int flags;
+};
+
+/* the first number in a line, as :sort n orders by. 0 if there is none */
+static int number_in(const char *start, long *num) {
+    const char *s = start;
+    int negative;
+    for (; *s && !isdigit((unsigned char)*s); s++) {
+    }
+    if (!*s) {
+        return 0;
+    }
+    negative = (s > start && s[-1] == '-');
+    for (*num = 0; isdigit((unsigned char)*s); s++) {
+        if (*num <= (LONG_MAX - 9) / 10) {
+            *num = (*num * 10) + (*s - '0');
+        }
+    }
+    if (negative) {
+        *num = -*num;
+    }
+    return 1;
+}
+
+static int compare(const struct Text *a, const struct Text *b, int flags) {
+    int order;
+
+    if (flags & SORT_NUMERIC) {
+        long x = 0;
+        long y = 0;
+        int has_x = number_in(a->data, &x);
+        int has_y = number_in(b->data, &y);
+        /* lines without a number come first, in the order they were in */
+        if (has_x != has_y) {
+            order = has_x - has_y;
+        } else {
+            order = (x > y) - (x < y);
+        }
+    } else {
+        order = strcmp(a->data, b->data);
+    }
+    return (flags & SORT_REVERSE) ? -order : order;
+}
+
+/*
+ * merges the sorted runs lines[0, mid) and lines[mid, n). only the first
+ * run is copied out to tmp, the merge fills lines from the front
+ */
+static void merge(
+    struct Text **lines,
+    struct Text **tmp,
+    size_t mid,
+    size_t n,
+    int flags
+) {
+    size_t i = 0;
+    size_t j = mid;
+    size_t k = 0;
+
+    if ((mid == 0) || (mid == n) ||
+        (compare(lines[mid - 1], lines[mid], flags) <= 0)
+    ) {
+        return;
+    }
+    memcpy(tmp, lines, mid * sizeof(struct Text *));
+    while (i < mid && j < n) {
+        if (compare(lines[j], tmp[i], flags) < 0) {
+            lines[k++] = lines[j++];
+        } else {
+            lines[k++] = tmp[i++];
+        }
+    }
+    while (i < mid) {
+        lines[k++] = tmp[i++];
+    }
+}
+
+static void merge_sort(
+    struct Text **lines,
+    struct Text **tmp,
+    size_t n,
+    int flags
+) {
+    size_t mid = n / 2;
+    size_t i;
+    size_t j;
+    struct Text *line;
+
+    if (n <= SORT_RUN) {
+        for (i = 1; i < n; i++) {
+            line = lines[i];
+            for (j = i; j > 0 && compare(line, lines[j - 1], flags) < 0; j--) {
+                lines[j] = lines[j - 1];
+            }
+            lines[j] = line;
+        }
+        return;
+    }
+    merge_sort(lines, tmp, mid, flags);
+    merge_sort(lines + mid, tmp + mid, n - mid, flags);
+    merge(lines, tmp, mid, n, flags);
+}
+
+static void *sort_job(void *arg) {
+    struct SortJob *job = arg;
+    merge_sort(job->lines, job->tmp, job->n, job->flags);
+    return NULL;
+}
+
+static void *merge_job(void *arg) {
+    struct SortJob *job = arg;
+    merge(job->lines, job->tmp, job->mid, job->n, job->flags);
+    return NULL;
+}
+
+/* runs fn on every job, one thread each, falling back to this thread */
+static void run_jobs(
+    void *(*fn)(void *),
+    struct SortJob *jobs,
+    size_t njobs
+) {
+    pthread_t threads[SORT_MAX_THREADS];
+    int started[SORT_MAX_THREADS];
+    size_t i;
+
+    for (i = 1; i < njobs; i++) {
+        started[i] = !pthread_create(&threads[i], NULL, fn, &jobs[i]);
+        if (!started[i]) {
+            fn(&jobs[i]);
+        }
+    }
+    fn(&jobs[0]);
+    for (i = 1; i < njobs; i++) {
+        if (started[i]) {
+            pthread_join(threads[i], NULL);
+        }
+    }
+}
+
+static size_t thread_count(size_t n) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    size_t threads = 1;
+
+    if ((n < SORT_PARALLEL_MIN) || (cpus < 2)) {
+        return 1;
+    }
+    while ((threads * 2 <= (size_t)cpus) && (threads * 2 <= SORT_MAX_THREADS)) {
+        threads *= 2;
+    }
+    return threads;
+}
+
+/*
+ * each thread sorts one slice, then neighbouring slices are merged in
+ * pairs, halving the number of threads each round
+ */
+static void parallel_sort(struct Text **lines, size_t n, int flags) {
+    struct Text **tmp = malloc(n * sizeof(struct Text *));
+    struct SortJob jobs[SORT_MAX_THREADS];
+    size_t bounds[SORT_MAX_THREADS + 1];
+    size_t threads = thread_count(n);
+    size_t width;
+    size_t njobs;
+    size_t i;
+
+    for (i = 0; i <= threads; i++) {
+        bounds[i] = (n / threads) * i;
+    }
+    bounds[threads] = n;
+
+    for (i = 0; i < threads; i++) {
+        jobs[i].lines = lines + bounds[i];
+        jobs[i].tmp = tmp + bounds[i];
+        jobs[i].n = bounds[i + 1] - bounds[i];
+        jobs[i].flags = flags;
+    }
+    run_jobs(sort_job, jobs, threads);
+
+    for (width = 1; width < threads; width *= 2) {
+        for (njobs = 0, i = 0; i + width < threads; i += 2 * width, njobs++) {
+            size_t end = bounds[(i + 2 * width < threads) ? i + 2 * width : threads];
+            jobs[njobs].lines = lines + bounds[i];
+            jobs[njobs].tmp = tmp + bounds[i];
+            jobs[njobs].mid = bounds[i + width] - bounds[i];
+            jobs[njobs].n = end - bounds[i];
+            jobs[njobs].flags = flags;
+        }
+        run_jobs(merge_job, jobs, njobs);
+    }
+    free(tmp);
+}
+
+/* links lines[0, n) together between prev and next */
+static void relink(
+    struct Text *prev,
+    struct Text **lines,
+    size_t n,
+    struct Text *next
+) {
+    size_t i;
+    for (i = 0; i < n; i++) {
+        lines[i]->prev = i ? lines[i - 1] : prev;
+        lines[i]->next = (i + 1 < n) ? lines[i + 1] : next;
+    }
+    if (prev) {
+        prev->next = lines[0];
+    }
+    if (next) {
+        next->prev = lines[n - 1];
+    }
+}
+
+static void drop(struct Text *line, struct Text **dropped) {
+    line->prev = NULL;
+    line->next = *dropped;
+    if (*dropped) {
+        (*dropped)->prev = line;
+    }
+    *dropped = line;
+}
+
+struct Text *sort_lines(
+    struct Text *first,
+    size_t *n,
+    int flags,
+    struct Text **dropped
+) {
+    struct Text **lines;
+    struct Text *prev = first->prev;
+    struct Text *next;
+    struct Text *line;
+    size_t kept;
+    size_t len;
+    size_t i;
+    int newline = 1;
+
+    if (*n < 2) {
+        return first;
+    }
+    lines = malloc(*n * sizeof(struct Text *));
+    for (i = 0, line = first; i < *n; i++, line = line->next) {
+        text_thaw(line);
+        lines[i] = line;
+    }
+    next = lines[*n - 1]->next;
+
+    /* a last line without a newline would be glued to whatever follows it */
+    len = strlen(lines[*n - 1]->data);
+    if ((len == 0) || (lines[*n - 1]->data[len - 1] != '\n')) {
+        newline = 0;
+        lines[*n - 1]->len = len;
+        text_push_char(lines[*n - 1], '\n');
+    }
+
+    parallel_sort(lines, *n, flags);
+
+    kept = *n;
+    if (flags & SORT_UNIQUE) {
+        for (kept = 1, i = 1; i < *n; i++) {
+            if (compare(lines[kept - 1], lines[i], flags & ~SORT_REVERSE)) {
+                lines[kept++] = lines[i];
+            } else {
+                drop(lines[i], dropped);
+            }
+        }
+    }
+    relink(prev, lines, kept, next);
+
+    if (!newline) {
+        line = lines[kept - 1];
+        text_delete_chars(line, strlen(line->data) - 1, 1);
+    }
+    first = lines[0];
+    *n = kept;
+    free(lines);
+    return first;
+}
+
+void sort_uniq(struct Text *first, size_t *n, struct Text **dropped) {
+    struct Text *line = first;
+    struct Text *next;
+    size_t kept = 1;
+    size_t i;
+
+    text_thaw(line);
+    for (i = 1; i < *n && line->next; i++) {
+        next = line->next;
+        text_thaw(next);
+        if (strcmp(line->data, next->data)) {
+            line = next;
+            kept++;
+            continue;
+        }
+        line->next = next->next;
+        if (next->next) {
+            next->next->prev = line;
+        }
+        drop(next, dropped);
+    }
+    *n = kept;
+}
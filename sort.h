@@ -0,0 +1,48 @@
+/*
+ *     Copyright (C) 2020 Kyle Kloberdanz
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef SORT_H
+#define SORT_H
+
+#include "text.h"
+
+/* flags for sort_lines */
+#define SORT_NUMERIC 1
+#define SORT_REVERSE 2
+#define SORT_UNIQUE 4
+
+/**
+ * sorts the n lines starting at first. pointers to the lines are sorted
+ * across worker threads and the list is linked back together in the new
+ * order, so no line is copied. with SORT_UNIQUE, a line equal to the one
+ * before it is unlinked and added to *dropped. returns the first line of
+ * the sorted range and sets *n to the number of lines left in it
+ */
+struct Text *sort_lines(
+    struct Text *first,
+    size_t *n,
+    int flags,
+    struct Text **dropped
+);
+
+/**
+ * unlinks each of the n lines from first that repeats the line before it,
+ * as uniq(1) does, adding them to *dropped. sets *n to the lines left
+ */
+void sort_uniq(struct Text *first, size_t *n, struct Text **dropped);
+
+#endif /* SORT_H */
@@ -0,0 +1,164 @@
+/*
+ *     Copyright (C) 2020 Kyle Kloberdanz
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+
+#include "split.h"
+
+/* a window needs a row of text and its status line */
+#define SPLIT_MIN_LINES 2
+
+#define SPLIT_MIN_COLS 1
+
+struct Split *split_new(struct Window *win, size_t lines, size_t cols) {
+    struct Split *leaf = calloc(1, sizeof(struct Split));
+    leaf->lines = lines;
+    leaf->cols = cols;
+    leaf->win = win;
+    return leaf;
+}
+
+struct Split *split_add(struct Split *leaf, struct Window *win, int vertical) {
+    struct Split *node;
+    struct Split *added;
+
+    if ((!vertical && (leaf->lines < 2 * SPLIT_MIN_LINES)) ||
+        (vertical && (leaf->cols < 2 * SPLIT_MIN_COLS + 1))
+    ) {
+        return NULL;
+    }
+
+    /* a new node takes the place of leaf, with leaf and win below it */
+    node = split_new(NULL, leaf->lines, leaf->cols);
+    node->vertical = vertical;
+    node->top = leaf->top;
+    node->left = leaf->left;
+    node->parent = leaf->parent;
+    if (leaf->parent && (leaf->parent->first == leaf)) {
+        leaf->parent->first = node;
+    } else if (leaf->parent) {
+        leaf->parent->second = node;
+    }
+
+    added = split_new(win, 0, 0);
+    node->first = leaf;
+    node->second = added;
+    leaf->parent = node;
+    added->parent = node;
+    split_layout(node);
+    return added;
+}
+
+struct Split *split_remove(struct Split *leaf) {
+    struct Split *node = leaf->parent;
+    struct Split *other;
+
+    if (!node) {
+        return NULL;
+    }
+    other = (node->first == leaf) ? node->second : node->first;
+
+    /* the other half moves up into the place of the node */
+    other->parent = node->parent;
+    other->top = node->top;
+    other->left = node->left;
+    other->lines = node->lines;
+    other->cols = node->cols;
+    if (node->parent && (node->parent->first == node)) {
+        node->parent->first = other;
+    } else if (node->parent) {
+        node->parent->second = other;
+    }
+    free(node);
+    free(leaf);
+    split_layout(other);
+    return split_first(other);
+}
+
+void split_layout(struct Split *node) {
+    struct Split *first = node->first;
+    struct Split *second = node->second;
+
+    if (!first) {
+        return;
+    }
+    first->top = node->top;
+    first->left = node->left;
+    if (node->vertical) {
+        first->lines = node->lines;
+        first->cols = (node->cols - 1) / 2;
+        second->top = node->top;
+        second->left = node->left + first->cols + 1;
+        second->lines = node->lines;
+        second->cols = node->cols - first->cols - 1;
+    } else {
+        first->lines = node->lines / 2;
+        first->cols = node->cols;
+        second->top = node->top + first->lines;
+        second->left = node->left;
+        second->lines = node->lines - first->lines;
+        second->cols = node->cols;
+    }
+    split_layout(first);
+    split_layout(second);
+}
+
+struct Split *split_root(struct Split *node) {
+    while (node->parent) {
+        node = node->parent;
+    }
+    return node;
+}
+
+struct Split *split_first(struct Split *node) {
+    while (node->first) {
+        node = node->first;
+    }
+    return node;
+}
+
+struct Split *split_next(struct Split *leaf) {
+    for (; leaf->parent; leaf = leaf->parent) {
+        if (leaf->parent->first == leaf) {
+            return split_first(leaf->parent->second);
+        }
+    }
+    return NULL;
+}
+
+struct Split *split_at(struct Split *node, size_t y, size_t x) {
+    struct Split *found;
+
+    if ((y < node->top) || (y >= node->top + node->lines) ||
+        (x < node->left) || (x >= node->left + node->cols)
+    ) {
+        return NULL;
+    }
+    if (!node->first) {
+        return node;
+    }
+    found = split_at(node->first, y, x);
+    return found ? found : split_at(node->second, y, x);
+}
+
+void split_free(struct Split *node) {
+    if (node) {
+        split_free(node->first);
+        split_free(node->second);
+        free(node);
+    }
+}
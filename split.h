@@ -0,0 +1,89 @@
+/*
+ *     Copyright (C) 2020 Kyle Kloberdanz
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef SPLIT_H
+#define SPLIT_H
+
+#include <stddef.h>
+
+struct Window;
+
+/*
+ * how the screen is divided between windows. a leaf is the part of the
+ * screen one window has, and every other node is cut in two, stacked or
+ * side by side with a one column bar between them
+ */
+struct Split {
+    int vertical;
+    size_t top;
+    size_t left;
+    size_t lines;
+    size_t cols;
+    struct Split *parent;
+    struct Split *first;
+    struct Split *second;
+    struct Window *win;
+};
+
+/**
+ * a layout where win has the whole screen
+ */
+struct Split *split_new(struct Window *win, size_t lines, size_t cols);
+
+/**
+ * cuts the part of the screen at leaf in two, leaving the top or left half
+ * to the window already there and giving the other half to win. returns
+ * the leaf for win, or NULL if there is no room
+ */
+struct Split *split_add(struct Split *leaf, struct Window *win, int vertical);
+
+/**
+ * takes leaf out of the layout and gives its part of the screen to the
+ * windows next to it. returns the leaf of the window to move to, or NULL if
+ * leaf had the whole screen
+ */
+struct Split *split_remove(struct Split *leaf);
+
+/**
+ * works out where everything below node goes in the part of the screen
+ * node has
+ */
+void split_layout(struct Split *node);
+
+struct Split *split_root(struct Split *node);
+
+/**
+ * the top left leaf under node
+ */
+struct Split *split_first(struct Split *node);
+
+/**
+ * the leaf after leaf, going from top left to bottom right, or NULL
+ */
+struct Split *split_next(struct Split *leaf);
+
+/**
+ * the leaf under node that has the screen cell at y, x, or NULL
+ */
+struct Split *split_at(struct Split *node, size_t y, size_t x);
+
+/**
+ * frees node and everything below it, but not the windows
+ */
+void split_free(struct Split *node);
+
+#endif /* SPLIT_H */
@@ -0,0 +1,570 @@
+/*
+ *     Copyright (C) 2020 Kyle Kloberdanz
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "syntax.h"
+
+/* lexer states carried from the end of one line to the start of the next */
+#define STATE_NORMAL 0
+#define STATE_COMMENT 1
+#define STATE_SINGLE_QUOTE 2
+#define STATE_DOUBLE_QUOTE 3
+
+/* lines this far above the first one shown are lexed to find its state */
+#define SYNTAX_SYNC 200
+
+/* a line being lexed, and the tokens found in it so far */
+struct Lexer {
+    const unsigned char *data;
+    size_t len;
+    struct Token *tokens;
+    size_t n;
+    size_t capacity;
+};
+
+static const char *const c_keywords[] = {
+    "break", "case", "continue", "default", "do", "else", "enum", "extern",
+    "for", "goto", "if", "inline", "register", "restrict", "return",
+    "sizeof", "static", "struct", "switch", "typedef", "union", "volatile",
+    "while", "const", "NULL", NULL
+};
+
+static const char *const c_types[] = {
+    "auto", "char", "double", "float", "int", "long", "short", "signed",
+    "unsigned", "void", "size_t", "ssize_t", "FILE", NULL
+};
+
+static const char *const shell_keywords[] = {
+    "case", "do", "done", "elif", "else", "esac", "export", "fi", "for",
+    "function", "if", "in", "local", "readonly", "return", "select", "then",
+    "until", "while", NULL
+};
+
+static const char *const literals[] = {
+    "true", "false", "null", "yes", "no", "on", "off", "True", "False",
+    "TRUE", "FALSE", "Null", "NULL", "~", NULL
+};
+
+/* the tokens of every line are gathered here before they are copied */
+static struct Token *scratch = NULL;
+static size_t scratch_capacity = 0;
+
+static void emit(struct Lexer *lex, size_t start, size_t end, int kind) {
+    if (start >= end || kind == KIND_PLAIN) {
+        return;
+    }
+    if (lex->n == lex->capacity) {
+        lex->capacity = lex->capacity ? lex->capacity * 2 : 64;
+        lex->tokens = realloc(lex->tokens, lex->capacity * sizeof(struct Token));
+    }
+    lex->tokens[lex->n].start = (unsigned int)start;
+    lex->tokens[lex->n].end = (unsigned int)end;
+    lex->tokens[lex->n].kind = (unsigned char)kind;
+    lex->n++;
+}
+
+static int is_word(int c) {
+    return isalnum(c) || c == '_';
+}
+
+/* one past the end of the word at i */
+static size_t word_end(struct Lexer *lex, size_t i) {
+    while (i < lex->len && is_word(lex->data[i])) {
+        i++;
+    }
+    return i;
+}
+
+static int in_list(const char *const *list, const unsigned char *word, size_t n) {
+    for (; *list; list++) {
+        if (!strncmp(*list, (const char *)word, n) && !(*list)[n]) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * one past the quote that closes the string opened by the quote at i, or
+ * the end of the line if it is not closed there. a backslash escapes the
+ * byte after it when escapes is set
+ */
+static size_t string_end(struct Lexer *lex, size_t i, int escapes) {
+    unsigned char quote = lex->data[i++];
+
+    for (; i < lex->len; i++) {
+        if (escapes && lex->data[i] == '\\') {
+            i++;
+        } else if (lex->data[i] == quote) {
+            return i + 1;
+        }
+    }
+    return lex->len;
+}
+
+/* one past the end of the number at i, taking in suffixes and exponents */
+static size_t number_end(struct Lexer *lex, size_t i) {
+    for (; i < lex->len; i++) {
+        if ((lex->data[i] == '+' || lex->data[i] == '-') &&
+            (lex->data[i - 1] == 'e' || lex->data[i - 1] == 'E')
+        ) {
+            continue;
+        }
+        if (!is_word(lex->data[i]) && lex->data[i] != '.') {
+            break;
+        }
+    }
+    return i;
+}
+
+/* the byte at i starts a number rather than being part of a word */
+static int starts_number(struct Lexer *lex, size_t i) {
+    return isdigit(lex->data[i]) && (i == 0 || !is_word(lex->data[i - 1]));
+}
+
+/* where the comment that closes at the first star-slash from i ends */
+static const unsigned char *comment_close(struct Lexer *lex, size_t i) {
+    const unsigned char *p = lex->data + i;
+    const unsigned char *end = lex->data + lex->len;
+
+    while (p + 1 < end && (p = memchr(p, '*', end - p - 1))) {
+        if (p[1] == '/') {
+            return p + 2;
+        }
+        p++;
+    }
+    return NULL;
+}
+
+static unsigned char lex_c(struct Lexer *lex, unsigned char state) {
+    const unsigned char *close;
+    size_t i = 0;
+    size_t end;
+
+    if (state == STATE_COMMENT) {
+        close = comment_close(lex, 0);
+        if (!close) {
+            emit(lex, 0, lex->len, KIND_COMMENT);
+            return STATE_COMMENT;
+        }
+        i = close - lex->data;
+        emit(lex, 0, i, KIND_COMMENT);
+    } else {
+        while (i < lex->len && (lex->data[i] == ' ' || lex->data[i] == '\t')) {
+            i++;
+        }
+        if (i < lex->len && lex->data[i] == '#') {
+            end = i + 1;
+            while (end < lex->len && lex->data[end] == ' ') {
+                end++;
+            }
+            end = word_end(lex, end);
+            emit(lex, i, end, KIND_PREPROC);
+            i = end;
+        }
+    }
+
+    while (i < lex->len) {
+        if (lex->data[i] == '/' && i + 1 < lex->len && lex->data[i + 1] == '/') {
+            emit(lex, i, lex->len, KIND_COMMENT);
+            break;
+        } else if (lex->data[i] == '/' && i + 1 < lex->len &&
+            lex->data[i + 1] == '*'
+        ) {
+            close = comment_close(lex, i + 2);
+            if (!close) {
+                emit(lex, i, lex->len, KIND_COMMENT);
+                return STATE_COMMENT;
+            }
+            end = close - lex->data;
+            emit(lex, i, end, KIND_COMMENT);
+            i = end;
+        } else if (lex->data[i] == '"' || lex->data[i] == '\'') {
+            end = string_end(lex, i, 1);
+            emit(lex, i, end, KIND_STRING);
+            i = end;
+        } else if (starts_number(lex, i)) {
+            end = number_end(lex, i);
+            emit(lex, i, end, KIND_NUMBER);
+            i = end;
+        } else if (is_word(lex->data[i])) {
+            end = word_end(lex, i);
+            if (in_list(c_keywords, lex->data + i, end - i)) {
+                emit(lex, i, end, KIND_KEYWORD);
+            } else if (in_list(c_types, lex->data + i, end - i)) {
+                emit(lex, i, end, KIND_TYPE);
+            }
+            i = end;
+        } else {
+            i++;
+        }
+    }
+    return STATE_NORMAL;
+}
+
+/* one past the end of the variable whose $ is at i */
+static size_t variable_end(struct Lexer *lex, size_t i) {
+    const unsigned char *close;
+
+    if (i + 1 >= lex->len) {
+        return i + 1;
+    }
+    if (lex->data[i + 1] == '{') {
+        close = memchr(lex->data + i, '}', lex->len - i);
+        return close ? (size_t)(close - lex->data) + 1 : lex->len;
+    }
+    if (is_word(lex->data[i + 1])) {
+        return isdigit(lex->data[i + 1]) ? i + 2 : word_end(lex, i + 1);
+    }
+    return strchr("?#@*$!-", lex->data[i + 1]) ? i + 2 : i + 1;
+}
+
+/*
+ * a double quoted string from start, scanned for its closing quote from *at
+ * on. it may go on to the next line, and the variables in it are picked out
+ */
+static unsigned char shell_string(struct Lexer *lex, size_t start, size_t *at) {
+    size_t i = *at;
+    size_t end;
+
+    for (; i < lex->len; i++) {
+        if (lex->data[i] == '\\') {
+            i++;
+        } else if (lex->data[i] == '$') {
+            emit(lex, start, i, KIND_STRING);
+            end = variable_end(lex, i);
+            emit(lex, i, end, KIND_VARIABLE);
+            start = end;
+            i = end - 1;
+        } else if (lex->data[i] == '"') {
+            emit(lex, start, i + 1, KIND_STRING);
+            *at = i + 1;
+            return STATE_NORMAL;
+        }
+    }
+    emit(lex, start, lex->len, KIND_STRING);
+    *at = lex->len;
+    return STATE_DOUBLE_QUOTE;
+}
+
+static unsigned char lex_shell(struct Lexer *lex, unsigned char state) {
+    const unsigned char *quote;
+    size_t i = 0;
+    size_t end;
+
+    if (state == STATE_SINGLE_QUOTE) {
+        quote = memchr(lex->data, '\'', lex->len);
+        if (!quote) {
+            emit(lex, 0, lex->len, KIND_STRING);
+            return STATE_SINGLE_QUOTE;
+        }
+        i = quote - lex->data + 1;
+        emit(lex, 0, i, KIND_STRING);
+    } else if (state == STATE_DOUBLE_QUOTE) {
+        if (shell_string(lex, 0, &i) == STATE_DOUBLE_QUOTE) {
+            return STATE_DOUBLE_QUOTE;
+        }
+    }
+
+    while (i < lex->len) {
+        if (lex->data[i] == '#' && (i == 0 || isspace(lex->data[i - 1]))) {
+            emit(lex, i, lex->len, KIND_COMMENT);
+            break;
+        } else if (lex->data[i] == '\\') {
+            i += 2;
+        } else if (lex->data[i] == '\'') {
+            quote = memchr(lex->data + i + 1, '\'', lex->len - i - 1);
+            if (!quote) {
+                emit(lex, i, lex->len, KIND_STRING);
+                return STATE_SINGLE_QUOTE;
+            }
+            end = quote - lex->data + 1;
+            emit(lex, i, end, KIND_STRING);
+            i = end;
+        } else if (lex->data[i] == '"') {
+            end = i + 1;
+            if (shell_string(lex, i, &end) == STATE_DOUBLE_QUOTE) {
+                return STATE_DOUBLE_QUOTE;
+            }
+            i = end;
+        } else if (lex->data[i] == '$') {
+            end = variable_end(lex, i);
+            emit(lex, i, end, KIND_VARIABLE);
+            i = end;
+        } else if (starts_number(lex, i)) {
+            end = word_end(lex, i);
+            emit(lex, i, end, KIND_NUMBER);
+            i = end;
+        } else if (is_word(lex->data[i])) {
+            end = word_end(lex, i);
+            /* not part of a name such as done-ish or ./if */
+            if ((i == 0 || !strchr("-./", lex->data[i - 1])) &&
+                (end == lex->len || !strchr("-./=", lex->data[end])) &&
+                in_list(shell_keywords, lex->data + i, end - i)
+            ) {
+                emit(lex, i, end, KIND_KEYWORD);
+            }
+            i = end;
+        } else {
+            i++;
+        }
+    }
+    return STATE_NORMAL;
+}
+
+/* the kind of a plain yaml or json value that runs from i to end */
+static int scalar_kind(struct Lexer *lex, size_t i, size_t end) {
+    size_t j = i;
+
+    if (j < end && (lex->data[j] == '-' || lex->data[j] == '+')) {
+        j++;
+    }
+    if (j < end && isdigit(lex->data[j]) && number_end(lex, j) >= end) {
+        return KIND_NUMBER;
+    }
+    if (in_list(literals, lex->data + i, end - i)) {
+        return KIND_KEYWORD;
+    }
+    return KIND_PLAIN;
+}
+
+/* one past the last byte of a yaml value that runs up to end, less blanks */
+static size_t trim_end(struct Lexer *lex, size_t i, size_t end) {
+    while (end > i && isspace(lex->data[end - 1])) {
+        end--;
+    }
+    return end;
+}
+
+static unsigned char lex_yaml(struct Lexer *lex, unsigned char state) {
+    size_t i = 0;
+    size_t end;
+    size_t j;
+
+    (void)state;
+    while (i < lex->len && lex->data[i] == ' ') {
+        i++;
+    }
+    if (lex->len - i >= 3 && (!memcmp(lex->data + i, "---", 3) ||
+        !memcmp(lex->data + i, "...", 3))
+    ) {
+        emit(lex, i, i + 3, KIND_KEYWORD);
+        i += 3;
+    }
+    while (i + 1 < lex->len && lex->data[i] == '-' && lex->data[i + 1] == ' ') {
+        for (i += 2; i < lex->len && lex->data[i] == ' '; i++) {
+        }
+    }
+
+    /* a key runs up to a colon followed by a blank or the end of the line */
+    for (j = i; j < lex->len && lex->data[j] != '#'; j++) {
+        if (lex->data[j] == '"' || lex->data[j] == '\'') {
+            j = string_end(lex, j, lex->data[j] == '"') - 1;
+        } else if (lex->data[j] == ':' &&
+            (j + 1 == lex->len || lex->data[j + 1] == ' ')
+        ) {
+            emit(lex, i, j, KIND_KEY);
+            i = j + 1;
+            break;
+        } else if (lex->data[j] == ' ' && j + 1 < lex->len &&
+            lex->data[j + 1] == '#'
+        ) {
+            break;
+        }
+    }
+
+    while (i < lex->len) {
+        if (lex->data[i] == '#' && (i == 0 || isspace(lex->data[i - 1]))) {
+            emit(lex, i, lex->len, KIND_COMMENT);
+            break;
+        } else if (lex->data[i] == '"' || lex->data[i] == '\'') {
+            end = string_end(lex, i, lex->data[i] == '"');
+            emit(lex, i, end, KIND_STRING);
+            i = end;
+        } else if ((lex->data[i] == '&' || lex->data[i] == '*') &&
+            (i == 0 || isspace(lex->data[i - 1]))
+        ) {
+            for (end = i + 1; end < lex->len && !isspace(lex->data[end]); end++) {
+            }
+            emit(lex, i, end, KIND_VARIABLE);
+            i = end;
+        } else if (!isspace(lex->data[i]) && strchr("[]{},", lex->data[i]) == NULL) {
+            /* a plain value goes up to a comment or the end of the line */
+            for (end = i; end < lex->len; end++) {
+                if (lex->data[end] == '#' && isspace(lex->data[end - 1])) {
+                    break;
+                }
+                if (strchr(",]}", lex->data[end])) {
+                    break;
+                }
+            }
+            end = trim_end(lex, i, end);
+            emit(lex, i, end, scalar_kind(lex, i, end));
+            i = end;
+        } else {
+            i++;
+        }
+    }
+    return STATE_NORMAL;
+}
+
+static unsigned char lex_json(struct Lexer *lex, unsigned char state) {
+    size_t i = 0;
+    size_t end;
+    size_t j;
+
+    (void)state;
+    while (i < lex->len) {
+        if (lex->data[i] == '"') {
+            end = string_end(lex, i, 1);
+            for (j = end; j < lex->len && isspace(lex->data[j]); j++) {
+            }
+            emit(lex, i, end,
+                (j < lex->len && lex->data[j] == ':') ? KIND_KEY : KIND_STRING);
+            i = end;
+        } else if (isdigit(lex->data[i]) || (lex->data[i] == '-' &&
+            i + 1 < lex->len && isdigit(lex->data[i + 1]))
+        ) {
+            end = number_end(lex, i + 1);
+            emit(lex, i, end, KIND_NUMBER);
+            i = end;
+        } else if (isalpha(lex->data[i])) {
+            end = word_end(lex, i);
+            emit(lex, i, end, scalar_kind(lex, i, end));
+            i = end;
+        } else {
+            i++;
+        }
+    }
+    return STATE_NORMAL;
+}
+
+/* lexes a line that starts in state, replacing what was made of it before */
+static void lex_line(enum Language lang, struct Text *line, unsigned char state) {
+    struct Lexer lex;
+    struct Highlight *highlight;
+    unsigned char end = STATE_NORMAL;
+
+    lex.data = (const unsigned char *)text_peek(line);
+    lex.len = line->len;
+    if (lex.len > 0 && lex.data[lex.len - 1] == '\n') {
+        lex.len--;
+    }
+    lex.tokens = scratch;
+    lex.n = 0;
+    lex.capacity = scratch_capacity;
+
+    switch (lang) {
+        case LANG_C:
+            end = lex_c(&lex, state);
+            break;
+        case LANG_SHELL:
+            end = lex_shell(&lex, state);
+            break;
+        case LANG_YAML:
+            end = lex_yaml(&lex, state);
+            break;
+        case LANG_JSON:
+            end = lex_json(&lex, state);
+            break;
+        case LANG_NONE:
+        default:
+            break;
+    }
+    scratch = lex.tokens;
+    scratch_capacity = lex.capacity;
+
+    free(line->highlight);
+    highlight = malloc(sizeof(struct Highlight) + lex.n * sizeof(struct Token));
+    highlight->start = state;
+    highlight->end = end;
+    highlight->n = lex.n;
+    highlight->tokens = (struct Token *)(void *)(highlight + 1);
+    memcpy(highlight->tokens, lex.tokens, lex.n * sizeof(struct Token));
+    line->highlight = highlight;
+}
+
+void syntax_init(struct Syntax *syntax, const char *filename) {
+    static const struct {
+        const char *ext;
+        enum Language lang;
+    } languages[] = {
+        {".c", LANG_C}, {".h", LANG_C},
+        {".sh", LANG_SHELL}, {".bash", LANG_SHELL},
+        {".yml", LANG_YAML}, {".yaml", LANG_YAML},
+        {".json", LANG_JSON}
+    };
+    const char *ext = filename ? strrchr(filename, '.') : NULL;
+    size_t i;
+
+    syntax->lang = LANG_NONE;
+    syntax->dirty = 1;
+    for (i = 0; ext && i < sizeof(languages) / sizeof(languages[0]); i++) {
+        if (!strcmp(ext, languages[i].ext)) {
+            syntax->lang = languages[i].lang;
+        }
+    }
+}
+
+void syntax_changed(struct Syntax *syntax, size_t line_no) {
+    if (line_no < syntax->dirty) {
+        syntax->dirty = line_no;
+    }
+}
+
+void syntax_update(
+    struct Syntax *syntax,
+    struct Text *top,
+    size_t top_no,
+    size_t n
+) {
+    struct Text *line = top;
+    size_t first = syntax->dirty;
+    size_t line_no = top_no;
+    unsigned char state;
+
+    if (syntax->lang == LANG_NONE || syntax->dirty >= top_no + n) {
+        return;
+    }
+    /* far below the last change, guess at the state a little way back */
+    if (first + SYNTAX_SYNC < top_no) {
+        first = top_no - SYNTAX_SYNC;
+    }
+    for (; line_no > first && line->prev; line_no--) {
+        line = line->prev;
+    }
+    for (; line_no < first && line; line_no++) {
+        line = line->next;
+    }
+
+    state = STATE_NORMAL;
+    if (line && line->prev && line->prev->highlight) {
+        state = line->prev->highlight->end;
+    }
+    for (; line && line_no < top_no + n; line = line->next, line_no++) {
+        if (!line->highlight || line->highlight->start != state) {
+            lex_line(syntax->lang, line, state);
+        }
+        state = line->highlight->end;
+    }
+    if (first == syntax->dirty) {
+        syntax->dirty = line_no;
+    }
+}
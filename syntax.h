@@ -0,0 +1,97 @@
+/*
+ *     Copyright (C) 2020 Kyle Kloberdanz
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef SYNTAX_H
+#define SYNTAX_H
+
+#include "text.h"
+
+enum Language {
+    LANG_NONE,
+    LANG_C,
+    LANG_SHELL,
+    LANG_YAML,
+    LANG_JSON
+};
+
+/* what a token is, which decides how it is drawn */
+enum Kind {
+    KIND_PLAIN,
+    KIND_COMMENT,
+    KIND_STRING,
+    KIND_NUMBER,
+    KIND_KEYWORD,
+    KIND_TYPE,
+    KIND_PREPROC,
+    KIND_KEY,
+    KIND_VARIABLE,
+    KIND_COUNT
+};
+
+/* the bytes start up to end of a line are of one kind */
+struct Token {
+    unsigned int start;
+    unsigned int end;
+    unsigned char kind;
+};
+
+/*
+ * a lexed line: the state the lexer was in at its start and at its end, such
+ * as being inside a comment, and the tokens that are not plain text, in order
+ */
+struct Highlight {
+    unsigned char start;
+    unsigned char end;
+    size_t n;
+    struct Token *tokens;
+};
+
+/*
+ * the highlighting of a buffer. every line numbered below dirty has been
+ * lexed starting in the state the line before it ended in. lines further
+ * on are lexed as they are shown, starting a little way above the first
+ * line shown when the last change is far off
+ */
+struct Syntax {
+    enum Language lang;
+    size_t dirty;
+};
+
+/**
+ * sets up highlighting for a file, going by the end of its name
+ */
+void syntax_init(struct Syntax *syntax, const char *filename);
+
+/**
+ * notes that the text changed from the line numbered line_no on
+ */
+void syntax_changed(struct Syntax *syntax, size_t line_no);
+
+/**
+ * makes sure the n lines from top, which is numbered top_no, are lexed.
+ * only lines that changed, or whose line before ended in a different
+ * state, are lexed again, and the lines after the first n are left until
+ * they are shown
+ */
+void syntax_update(
+    struct Syntax *syntax,
+    struct Text *top,
+    size_t top_no,
+    size_t n
+);
+
+#endif /* SYNTAX_H */
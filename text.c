@@ -17,63 +17,229 @@
 
 #include <stdlib.h>
 #include <string.h>
-#include <sys/types.h>
 
 #include "text.h"
 #include "vin.h"
+#include "profile.h"
+#include "syntax.h"
+#include "lz.h"
+#include "words.h"
 
-ssize_t getline(char **lineptr, size_t *n, FILE *stream);
+/*
+ * where the bytes of a line go on the screen: the column of every byte, and
+ * the columns its rows start at when it is wrapped at width columns, which
+ * are only worked out once a wrapped line is drawn
+ */
+struct Layout {
+    unsigned int *columns;
+    unsigned int *breaks;
+    size_t rows;
+    size_t width;
+};
+
+/*
+ * line payloads carry a reference count in front of the bytes, so copies of a
+ * line (yanks, puts, undo snapshots) share them until one side writes. the
+ * layout of the bytes is worked out the first time it is asked for and kept
+ * with them until they are next written to
+ */
+struct Payload {
+    size_t refs;
+    struct Layout *layout;
+};
 
-char *strdup(const char *s);
+#define PAYLOAD(DATA) (((struct Payload *)(void *)(DATA)) - 1)
 
-static struct Text *text_new_line(struct Text *prev, struct Text *next) {
-    struct Text *line = calloc(1, sizeof(struct Text));
-    line->prev = prev;
-    line->next = next;
+/*
+ * the bytes of lines frozen together by text_freeze, compressed, each line
+ * ending in a NUL. a frozen line has no data, and keeps in capacity where
+ * its bytes start once the block is expanded. the block goes once the last
+ * line in it is thawed or freed
+ */
+struct Cold {
+    size_t refs;
+    size_t raw;
+    size_t size;
+};
 
-    if (prev) {
-        prev->next = line;
+#define COLD_BYTES(BLOCK) ((unsigned char *)((BLOCK) + 1))
+
+/* the block expanded last, kept since lines near each other thaw together */
+static struct Cold *expanded_block = NULL;
+static char *expanded = NULL;
+static size_t expanded_capacity = 0;
+
+/*
+ * stands in for the layout of a line of printable ascii, where every byte
+ * is one column wide and the column of a byte is its index
+ */
+static struct Layout plain_layout;
+
+/* bytes of an unsigned long each set to 0x01, and to 0x80 */
+#define ONES ((unsigned long)-1 / 0xff)
+#define HIGHS (ONES * 0x80)
+
+/* true if any byte of the word is zero */
+#define HAS_ZERO(WORD) ((((WORD) - ONES) & ~(WORD) & HIGHS) != 0)
+
+/*
+ * true if any byte of the word is below N, for words whose bytes are all
+ * below 0x80
+ */
+#define HAS_LESS(WORD, N) ((((WORD) - ONES * (N)) & ~(WORD) & HIGHS) != 0)
+
+#define TAB_WIDTH 8
+
+#define MIN(A, B) ((A) < (B) ? (A) : (B))
+
+#ifndef DEBUG
+/* lines are carved out of slabs of this many nodes */
+#define TEXT_SLAB_LINES 512
+
+static struct Text *free_lines = NULL;
+#endif
+
+static char *payload_new(const char *bytes, size_t n, size_t capacity) {
+    struct Payload *payload = malloc(sizeof(struct Payload) + capacity + 1);
+    char *data = (char *)(payload + 1);
+    PROFILE_COUNT(COUNT_PAYLOAD_ALLOCS, 1);
+    payload->refs = 1;
+    payload->layout = NULL;
+    memcpy(data, bytes, n);
+    data[n] = '\0';
+    return data;
+}
+
+static char *payload_share(char *data) {
+    PAYLOAD(data)->refs++;
+    return data;
+}
+
+/* forgets the layout of the bytes, which are about to change */
+static void payload_forget_layout(struct Payload *payload) {
+    if (payload->layout && payload->layout != &plain_layout) {
+        free(payload->layout->breaks);
+        free(payload->layout);
     }
+    payload->layout = NULL;
+}
 
-    if (next) {
-        next->prev = line;
+static void payload_release(char *data) {
+    if (data && (--PAYLOAD(data)->refs == 0)) {
+        PROFILE_COUNT(COUNT_PAYLOAD_FREES, 1);
+        payload_forget_layout(PAYLOAD(data));
+        free(PAYLOAD(data));
+    }
+}
+
+static char *payload_grow(char *data, size_t capacity) {
+    struct Payload *payload = realloc(
+        PAYLOAD(data),
+        sizeof(struct Payload) + capacity + 1
+    );
+    PROFILE_COUNT(COUNT_PAYLOAD_GROWS, 1);
+    return (char *)(payload + 1);
+}
+
+static void cold_release(struct Cold *block) {
+    if (--block->refs == 0) {
+        if (block == expanded_block) {
+            expanded_block = NULL;
+        }
+        free(block);
     }
+}
 
-    line->data = NULL;
-    line->len = 0;
-    line->capacity = 0;
+static struct Text *text_alloc(void) {
+    struct Text *line;
+    PROFILE_COUNT(COUNT_LINE_ALLOCS, 1);
+#ifdef DEBUG
+    /* keep every line its own allocation so the sanitizers can see it */
+    line = calloc(1, sizeof(struct Text));
+#else
+    if (!free_lines) {
+        size_t i;
+        struct Text *slab = malloc(TEXT_SLAB_LINES * sizeof(struct Text));
+        PROFILE_COUNT(COUNT_SLAB_ALLOCS, 1);
+        for (i = 0; i < TEXT_SLAB_LINES; i++) {
+            slab[i].next = free_lines;
+            free_lines = &slab[i];
+        }
+    }
+    line = free_lines;
+    free_lines = line->next;
+    memset(line, 0, sizeof(struct Text));
+#endif
     return line;
 }
 
+static void text_free_line(struct Text *line) {
+    PROFILE_COUNT(COUNT_LINE_FREES, 1);
+    words_forget(line);
+    if (line->cold) {
+        cold_release(line->cold);
+    }
+    payload_release(line->data);
+    free(line->highlight);
+#ifdef DEBUG
+    free(line);
+#else
+    line->next = free_lines;
+    free_lines = line;
+#endif
+}
+
 struct Text *text_make_line(void) {
-    struct Text *line = calloc(1, sizeof(struct Text));
+    struct Text *line = text_alloc();
     line->next = NULL;
     line->prev = NULL;
 
-    line->data = calloc(2, sizeof(char));
-    line->data[0] = '\n';
-    line->data[1] = '\0';
-    line->len = 0;
+    line->data = payload_new("\n", 1, 1);
+    line->len = 1;
     line->capacity = 1;
     return line;
 }
 
+void text_unshare(struct Text *line) {
+    size_t len;
+    char *data;
+    words_forget(line);
+    text_thaw(line);
+    free(line->highlight);
+    line->highlight = NULL;
+    line->brackets = 0;
+    if (PAYLOAD(line->data)->refs == 1) {
+        payload_forget_layout(PAYLOAD(line->data));
+        return;
+    }
+    len = strlen(line->data);
+    data = payload_new(line->data, len, len + 1);
+    payload_release(line->data);
+    line->data = data;
+    line->capacity = len + 1;
+}
+
 void text_push_char(struct Text *line, char c) {
-    if (!line || !line->data) {
+    if (!line || (!line->data && !line->cold)) {
         fprintf(stderr, "%s\n", "pushing to null string");
         exit(43);
     }
-    if (line->len >= line->capacity - 1) {
+    text_unshare(line);
+    if (line->len + 1 >= line->capacity) {
         line->capacity = 1 + (line->capacity * 2);
-        line->data = realloc(line->data, line->capacity + 1);
+        line->data = payload_grow(line->data, line->capacity);
     }
 
     line->data[line->len++] = c;
-    line->data[line->len+1] = '\0';
+    line->data[line->len] = '\0';
 }
 
-void text_write(struct Text *line, char *filename) {
+void text_write(struct Text *line, char *filename, int crlf) {
     FILE *fp = NULL;
+    const char *data;
+    size_t written = 0;
+    size_t len;
+    PROFILE_CLOCK(started)
     if (!filename) {
         return;
     }
@@ -83,81 +249,172 @@ void text_write(struct Text *line, char *filename) {
         exit(EXIT_FAILURE);
     }
     for (; line; line = line->next) {
-        fprintf(fp, "%s", line->data);
+        data = text_peek(line);
+        len = strlen(data);
+        if (crlf && len > 0 && data[len - 1] == '\n') {
+            fwrite(data, 1, len - 1, fp);
+            fputs("\r\n", fp);
+            written++;
+        } else {
+            fputs(data, fp);
+        }
+        written += len;
     }
     fflush(fp);
     fclose(fp);
+    PROFILE_IO(IO_SAVE, written, started);
 }
 
 void text_backspace(struct Text *line, size_t index) {
-    size_t i;
-    for (i = index; line->data[i] != '\0'; i++) {
-        line->data[i] = line->data[i + 1];
-    }
+    text_delete_chars(line, index, 1);
 }
 
 void text_insert_char(struct Text *line, size_t index, char c) {
-    size_t i;
-    line->len++;
+    text_insert_chars(line, index, &c, 1);
+}
 
-    if (line->len >= line->capacity) {
-        line->capacity *= 2;
-        line->data = realloc(line->data, line->capacity + 1);
-    }
-    for (i = line->len - 1; i > index; i--) {
-        line->data[i] = line->data[i - 1];
+void text_shift_left(struct Text *line, size_t index) {
+    text_delete_chars(line, index, 1);
+}
+
+/* reads the whole of fp into one buffer, setting *n to its size */
+static char *read_all(FILE *fp, size_t *n) {
+    size_t capacity = 4096;
+    size_t got;
+    char *chars = malloc(capacity);
+
+    *n = 0;
+    while ((got = fread(chars + *n, 1, capacity - *n, fp)) > 0) {
+        *n += got;
+        if (*n == capacity) {
+            capacity *= 2;
+            chars = realloc(chars, capacity);
+        }
     }
-    line->data[line->capacity] = '\0';
-    line->data[index] = c;
-    line->data[line->len] = '\0';
+    return chars;
 }
 
-void text_shift_left(struct Text *line, size_t index) {
+struct Text *text_load(const char *filename, int *crlf) {
+    FILE *fp = fopen(filename, "r");
+    struct Text *head = NULL;
+    struct Text *tail = NULL;
+    struct Text *line;
+#ifndef DEBUG
+    struct Text *slab;
+#endif
+    char *chars = NULL;
+    const char *p;
+    const char *end;
+    const char *newline;
+    size_t size = 0;
+    size_t count = 0;
+    size_t newlines = 0;
+    size_t returns = 0;
+    size_t len;
     size_t i;
-    line->data[line->len] = '\0';
-    line->len--;
+    PROFILE_CLOCK(started)
 
-    for (i = index; line->data[i] != '\0'; i++) {
-        line->data[i] = line->data[i + 1];
+    if (fp) {
+        chars = read_all(fp, &size);
+        fclose(fp);
+    }
+    for (p = chars, end = chars + size; p < end; count++) {
+        newline = memchr(p, '\n', end - p);
+        if (newline) {
+            newlines++;
+            returns += (newline > p && newline[-1] == '\r');
+        }
+        p = newline ? newline + 1 : end;
+    }
+    /* a file with some lines ending in \r\n and others not keeps its \r */
+    *crlf = (newlines > 0 && returns == newlines);
+    if (count == 0) {
+        /* an empty or missing file still has one empty line */
+        free(chars);
+        chars = malloc(1);
+        chars[0] = '\n';
+        end = chars + 1;
+        count = 1;
     }
-}
 
-void text_read_from_file(struct Text *line, FILE *fp) {
-    char *line_of_input = NULL;
-    size_t n = 0;
-    long tell = ftell(fp);
-    while ((getline(&line_of_input, &n, fp) != -1)) {
-        text_new_line(line, NULL);
-        free(line->data);
-        line->data = strdup(line_of_input);
-        line->len = strlen(line->data);
-        line->capacity = line->len;
-        line = line->next;
-    }
-    free(line_of_input);
-    line = line->prev;
-    free(line->next);
-    line->next = NULL;
-    fseek(fp, tell, SEEK_SET);
+    /*
+     * the nodes come out of one slab of exactly this many lines rather than
+     * the free list, so that files can be loaded off the main thread. once
+     * freed they are handed out to any buffer like every other line
+     */
+#ifndef DEBUG
+    slab = malloc(count * sizeof(struct Text));
+    PROFILE_COUNT(COUNT_SLAB_ALLOCS, 1);
+#endif
+    PROFILE_COUNT(COUNT_LINE_ALLOCS, count);
+    for (i = 0, p = chars; i < count; i++, p += len) {
+#ifdef DEBUG
+        line = calloc(1, sizeof(struct Text));
+#else
+        line = &slab[i];
+#endif
+        newline = memchr(p, '\n', end - p);
+        len = newline ? (size_t)(newline - p) + 1 : (size_t)(end - p);
+        if (*crlf && newline) {
+            line->data = payload_new(p, len - 1, len - 1);
+            line->data[len - 2] = '\n';
+            line->len = len - 1;
+            line->capacity = len - 1;
+        } else {
+            line->data = payload_new(p, len, len);
+            line->len = len;
+            line->capacity = len;
+        }
+        line->prev = tail;
+        line->next = NULL;
+        line->highlight = NULL;
+        line->cold = NULL;
+        line->brackets = 0;
+        line->words = 0;
+        if (tail) {
+            tail->next = line;
+        } else {
+            head = line;
+        }
+        tail = line;
+    }
+    free(chars);
+    PROFILE_IO(IO_LOAD, size, started);
+    return head;
 }
 
 struct Text *text_split_line(struct Text *line, size_t index) {
-    struct Text *new_line = text_make_line();
+    struct Text *new_line = text_alloc();
+    size_t len;
+    text_thaw(line);
+    len = strlen(line->data + index);
     text_insert_line(line, new_line, line->next);
-    new_line->data = strdup(line->data + index);
-    new_line->len = strlen(new_line->data);
-    new_line->capacity = new_line->len;
+    new_line->data = payload_new(line->data + index, len, len);
+    new_line->len = len;
+    new_line->capacity = len;
+    text_unshare(line);
+    if (line->capacity < index + 1) {
+        line->capacity = index + 1;
+        line->data = payload_grow(line->data, line->capacity);
+    }
     line->data[index] = '\n';
     line->data[index + 1] = '\0';
-    line->len = index;
+    line->len = index + 1;
     return new_line;
 }
 
 struct Text *text_copy_line(struct Text *line) {
-    struct Text *new_line = calloc(1, sizeof(struct Text));
-    new_line->data = strdup(line->data);
-    new_line->len = strlen(line->data);
-    new_line->capacity = new_line->len;
+    struct Text *new_line = text_alloc();
+    if (line->cold) {
+        /* a copy of a frozen line stays frozen in the same block */
+        new_line->cold = line->cold;
+        new_line->cold->refs++;
+    } else {
+        new_line->data = payload_share(line->data);
+    }
+    new_line->len = line->len;
+    new_line->capacity = line->capacity;
+    new_line->brackets = line->brackets;
     new_line->next = NULL;
     new_line->prev = NULL;
     return new_line;
@@ -188,3 +445,674 @@ size_t text_total_lines(struct Text *top_line) {
     }
     return i;
 }
+
+void text_delete_chars(struct Text *line, size_t index, size_t n) {
+    size_t len;
+    text_thaw(line);
+    len = strlen(line->data);
+    if (index >= len) {
+        return;
+    }
+    if (n > len - index) {
+        n = len - index;
+    }
+    text_unshare(line);
+    memmove(line->data + index, line->data + index + n, len - index - n + 1);
+    line->len = len - n;
+}
+
+struct Text *text_copy_chars(struct Text *line, size_t index, size_t n) {
+    struct Text *copy = text_alloc();
+    size_t len;
+
+    text_thaw(line);
+    len = strlen(line->data);
+    index = index < len ? index : len;
+    if (n > len - index) {
+        n = len - index;
+    }
+    copy->data = payload_new(line->data + index, n, n);
+    copy->len = n;
+    copy->capacity = n;
+    return copy;
+}
+
+struct Text *text_cut_chars(struct Text *line, size_t index, size_t n) {
+    struct Text *cut = text_copy_chars(line, index, n);
+    text_delete_chars(line, index, cut->len);
+    return cut;
+}
+
+void text_insert_chars(
+    struct Text *line,
+    size_t index,
+    const char *chars,
+    size_t n
+) {
+    size_t len;
+
+    text_thaw(line);
+    len = strlen(line->data);
+    if (index > len) {
+        index = len;
+    }
+    text_unshare(line);
+    if (len + n > line->capacity) {
+        line->capacity = 1 + (line->capacity * 2);
+        if (line->capacity < len + n) {
+            line->capacity = len + n;
+        }
+        line->data = payload_grow(line->data, line->capacity);
+    }
+    memmove(line->data + index + n, line->data + index, len - index + 1);
+    memcpy(line->data + index, chars, n);
+    line->len = len + n;
+}
+
+struct Text *text_cut_lines(struct Text *first, size_t n) {
+    struct Text *last = first;
+    struct Text *prev = first->prev;
+    struct Text *next;
+
+    /* lines cut out are counted again if they are put back */
+    words_forget(first);
+    for (; n > 1 && last->next; n--) {
+        last = last->next;
+        words_forget(last);
+    }
+    next = last->next;
+
+    if (prev) {
+        prev->next = next;
+    }
+    if (next) {
+        next->prev = prev;
+    }
+    first->prev = NULL;
+    last->next = NULL;
+    return next;
+}
+
+struct Text *text_copy_lines(struct Text *first, size_t n) {
+    struct Text *head = NULL;
+    struct Text *tail = NULL;
+    struct Text *line;
+
+    for (; first && n; first = first->next, n--) {
+        line = text_copy_line(first);
+        if (tail) {
+            text_insert_line(tail, line, NULL);
+        } else {
+            head = line;
+        }
+        tail = line;
+    }
+    return head;
+}
+
+struct Text *text_splice_lines(struct Text *prev, struct Text *list) {
+    struct Text *last = list;
+    struct Text *next = prev->next;
+
+    while (last->next) {
+        last = last->next;
+    }
+
+    prev->next = list;
+    list->prev = prev;
+    last->next = next;
+    if (next) {
+        next->prev = last;
+    }
+    return last;
+}
+
+void text_free_lines(struct Text *list) {
+    struct Text *next;
+    while (list) {
+        next = list->next;
+        text_free_line(list);
+        list = next;
+    }
+}
+
+struct Text *text_copy_span(
+    struct Text *first,
+    size_t start,
+    struct Text *last,
+    size_t end
+) {
+    struct Text *head;
+    struct Text *tail;
+
+    if (first == last) {
+        return text_copy_chars(first, start, end - start);
+    }
+    head = text_copy_chars(first, start, TEXT_ALL_LINES);
+    tail = head;
+    if (first->next != last) {
+        struct Text *line;
+        size_t n = 0;
+        for (line = first->next; line != last; line = line->next) {
+            n++;
+        }
+        tail = text_splice_lines(head, text_copy_lines(first->next, n));
+    }
+    text_insert_line(tail, text_copy_chars(last, 0, end), NULL);
+    return head;
+}
+
+struct Text *text_cut_span(
+    struct Text *first,
+    size_t start,
+    struct Text *last,
+    size_t end
+) {
+    struct Text *cut;
+    struct Text *line;
+    size_t n = 0;
+
+    if (first == last) {
+        return text_cut_chars(first, start, end - start);
+    }
+    cut = text_copy_span(first, start, last, end);
+    for (line = first->next; line != last; line = line->next) {
+        n++;
+    }
+
+    /* what is left of the last line moves up onto the first */
+    text_delete_chars(first, start, TEXT_ALL_LINES);
+    text_thaw(last);
+    text_insert_chars(
+        first,
+        start,
+        last->data + end,
+        strlen(last->data + end)
+    );
+    line = first->next;
+    text_cut_lines(line, n + 1);
+    text_free_lines(line);
+    return cut;
+}
+
+struct Text *text_from_chars(const char *chars, size_t n) {
+    struct Text *head = NULL;
+    struct Text *tail = NULL;
+    struct Text *line;
+    const char *end = chars + n;
+    const char *newline;
+
+    do {
+        newline = memchr(chars, '\n', end - chars);
+        n = newline ? (size_t)(newline - chars) + 1 : (size_t)(end - chars);
+        line = text_alloc();
+        line->data = payload_new(chars, n, n);
+        line->len = n;
+        line->capacity = n;
+        if (tail) {
+            text_insert_line(tail, line, NULL);
+        } else {
+            head = line;
+        }
+        tail = line;
+        chars += n;
+    } while (chars < end);
+    return head;
+}
+
+/*
+ * true if every byte of the n is printable ascii, so that its index is its
+ * column. looks at a word of bytes at a time
+ */
+static int is_plain(const char *data, size_t n) {
+    unsigned long word;
+
+    for (; n >= sizeof(word); data += sizeof(word), n -= sizeof(word)) {
+        memcpy(&word, data, sizeof(word));
+        if ((word & HIGHS) || HAS_LESS(word, 0x20) ||
+            HAS_ZERO(word ^ (ONES * 0x7f))
+        ) {
+            return 0;
+        }
+    }
+    for (; n; data++, n--) {
+        if ((unsigned char)*data < 0x20 || (unsigned char)*data >= 0x7f) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/*
+ * decodes the utf-8 character at the start of the n bytes into *c and
+ * returns its length. a byte that does not start a valid character is
+ * taken on its own
+ */
+static size_t utf8_decode(const unsigned char *s, size_t n, unsigned long *c) {
+    size_t len;
+    size_t i;
+
+    if (s[0] < 0xc2 || s[0] > 0xf4) {
+        *c = s[0];
+        return 1;
+    }
+    len = (s[0] >= 0xf0) ? 4 : (s[0] >= 0xe0) ? 3 : 2;
+    if (len > n) {
+        *c = s[0];
+        return 1;
+    }
+    *c = s[0] & (0x7f >> len);
+    for (i = 1; i < len; i++) {
+        if ((s[i] & 0xc0) != 0x80) {
+            *c = s[0];
+            return 1;
+        }
+        *c = (*c << 6) | (s[i] & 0x3f);
+    }
+    return len;
+}
+
+/* how many columns the terminal gives the character c */
+static unsigned int char_width(unsigned long c) {
+    static const unsigned long wide[][2] = {
+        {0x1100, 0x115f}, {0x2e80, 0x303e}, {0x3041, 0x33ff},
+        {0x3400, 0x4dbf}, {0x4e00, 0x9fff}, {0xa000, 0xa4cf},
+        {0xac00, 0xd7a3}, {0xf900, 0xfaff}, {0xfe30, 0xfe4f},
+        {0xff00, 0xff60}, {0xffe0, 0xffe6}, {0x1f300, 0x1f64f},
+        {0x1f900, 0x1f9ff}, {0x20000, 0x3fffd}
+    };
+    static const unsigned long zero[][2] = {
+        {0x0300, 0x036f}, {0x1ab0, 0x1aff}, {0x1dc0, 0x1dff},
+        {0x200b, 0x200f}, {0x20d0, 0x20ff}, {0xfe00, 0xfe0f},
+        {0xfe20, 0xfe2f}
+    };
+    size_t i;
+
+    if (c < 0x20 || c == 0x7f) {
+        /* shown as ^X */
+        return 2;
+    }
+    if (c < 0x300) {
+        return 1;
+    }
+    for (i = 0; i < sizeof(zero) / sizeof(zero[0]); i++) {
+        if (c >= zero[i][0] && c <= zero[i][1]) {
+            return 0;
+        }
+    }
+    for (i = 0; i < sizeof(wide) / sizeof(wide[0]); i++) {
+        if (c >= wide[i][0] && c <= wide[i][1]) {
+            return 2;
+        }
+    }
+    return 1;
+}
+
+/*
+ * works out the column of every byte of the line. all the bytes of a
+ * character share its column, and a character that takes no room (such as
+ * a combining accent) shares the column of the one before it, so that the
+ * cursor never stops on it. columns[len] is the width of the whole line
+ */
+static struct Layout *layout_build(const char *data, size_t len) {
+    struct Layout *layout = malloc(
+        sizeof(struct Layout) + (len + 1) * sizeof(unsigned int)
+    );
+    unsigned int *columns = (unsigned int *)(void *)(layout + 1);
+    unsigned int column = 0;
+    unsigned int start = 0;
+    unsigned int width;
+    unsigned long c;
+    size_t i = 0;
+    size_t n;
+
+    PROFILE_COUNT(COUNT_LAYOUT_ALLOCS, 1);
+    while (i < len) {
+        if (data[i] == '\t') {
+            n = 1;
+            width = TAB_WIDTH - (column % TAB_WIDTH);
+        } else if (data[i] == '\n') {
+            n = 1;
+            width = 0;
+            start = column;
+        } else {
+            n = utf8_decode((const unsigned char *)data + i, len - i, &c);
+            width = char_width(c);
+        }
+        if (width > 0) {
+            start = column;
+        }
+        for (; n; n--) {
+            columns[i++] = start;
+        }
+        column += width;
+    }
+    columns[len] = column;
+
+    layout->columns = columns;
+    layout->breaks = NULL;
+    layout->rows = 0;
+    layout->width = 0;
+    return layout;
+}
+
+/* the layout of the line, worked out now if it has not been already */
+static struct Layout *line_layout(struct Text *line) {
+    struct Payload *payload;
+    size_t end = line->len;
+
+    text_thaw(line);
+    payload = PAYLOAD(line->data);
+    if (!payload->layout) {
+        if (end > 0 && line->data[end - 1] == '\n') {
+            end--;
+        }
+        if (is_plain(line->data, end)) {
+            payload->layout = &plain_layout;
+        } else {
+            payload->layout = layout_build(line->data, line->len);
+        }
+    }
+    return payload->layout;
+}
+
+size_t text_column(struct Text *line, size_t index) {
+    struct Layout *layout = line_layout(line);
+
+    index = (index < line->len) ? index : line->len;
+    return (layout == &plain_layout) ? index : layout->columns[index];
+}
+
+size_t text_column_index(struct Text *line, size_t column) {
+    struct Layout *layout = line_layout(line);
+    const unsigned int *columns = layout->columns;
+    size_t low = 0;
+    size_t high = line->len;
+    size_t mid;
+
+    if (layout == &plain_layout) {
+        return (column < line->len) ? column : line->len;
+    }
+    /* the last byte that starts at or before the column */
+    while (low < high) {
+        mid = low + (high - low + 1) / 2;
+        if (columns[mid] <= column) {
+            low = mid;
+        } else {
+            high = mid - 1;
+        }
+    }
+    /* and then the first byte of its character */
+    column = columns[low];
+    high = low;
+    low = 0;
+    while (low < high) {
+        mid = low + (high - low) / 2;
+        if (columns[mid] < column) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    return low;
+}
+
+size_t text_next_char(struct Text *line, size_t index) {
+    struct Layout *layout = line_layout(line);
+    size_t next = index + 1;
+
+    if (index >= line->len) {
+        return line->len;
+    }
+    if (layout != &plain_layout) {
+        while (next < line->len &&
+            layout->columns[next] == layout->columns[index]
+        ) {
+            next++;
+        }
+    }
+    return next;
+}
+
+size_t text_prev_char(struct Text *line, size_t index) {
+    struct Layout *layout = line_layout(line);
+
+    if (index == 0) {
+        return 0;
+    }
+    if (index > line->len) {
+        index = line->len;
+    }
+    index--;
+    if (layout != &plain_layout) {
+        while (index > 0 &&
+            layout->columns[index - 1] == layout->columns[index]
+        ) {
+            index--;
+        }
+    }
+    return index;
+}
+
+/*
+ * works out the columns the rows of a line wrapped at width start at. each
+ * row starts width columns on from the last, except that a wide character
+ * that would be cut in two starts the next row instead. tabs may be cut
+ */
+static void layout_wrap(struct Text *line, struct Layout *layout, size_t width) {
+    size_t total = layout->columns[line->len];
+    size_t capacity = total / width + 2;
+    size_t start = 0;
+    size_t next;
+    size_t i;
+
+    free(layout->breaks);
+    layout->breaks = malloc(capacity * sizeof(unsigned int));
+    layout->breaks[0] = 0;
+    layout->rows = 1;
+    layout->width = width;
+    while (total - start > width) {
+        next = start + width;
+        i = text_column_index(line, next);
+        if (layout->columns[i] < next && layout->columns[i] > start &&
+            line->data[i] != '\t'
+        ) {
+            next = layout->columns[i];
+        }
+        if (layout->rows == capacity) {
+            capacity *= 2;
+            layout->breaks = realloc(
+                layout->breaks,
+                capacity * sizeof(unsigned int)
+            );
+        }
+        layout->breaks[layout->rows++] = (unsigned int)next;
+        start = next;
+    }
+}
+
+/* the layout of the line, with its rows worked out for width */
+static struct Layout *line_wrapped(struct Text *line, size_t width) {
+    struct Layout *layout = line_layout(line);
+
+    if (layout != &plain_layout && layout->width != width) {
+        layout_wrap(line, layout, width);
+    }
+    return layout;
+}
+
+size_t text_rows(struct Text *line, size_t width) {
+    struct Layout *layout = line_wrapped(line, width);
+    size_t total;
+
+    if (layout == &plain_layout) {
+        total = text_column(line, line->len);
+        return (total > width) ? (total + width - 1) / width : 1;
+    }
+    return layout->rows;
+}
+
+size_t text_row_column(struct Text *line, size_t width, size_t row) {
+    struct Layout *layout = line_wrapped(line, width);
+    size_t total = text_column(line, line->len);
+
+    if (layout == &plain_layout) {
+        return MIN(row * width, total);
+    }
+    return (row < layout->rows) ? layout->breaks[row] : total;
+}
+
+size_t text_column_row(struct Text *line, size_t width, size_t column) {
+    struct Layout *layout = line_wrapped(line, width);
+    size_t low = 0;
+    size_t high;
+    size_t mid;
+
+    if (layout == &plain_layout) {
+        return MIN(column / width, text_rows(line, width) - 1);
+    }
+    /* the last row that starts at or before the column */
+    high = layout->rows - 1;
+    while (low < high) {
+        mid = low + (high - low + 1) / 2;
+        if (layout->breaks[mid] <= column) {
+            low = mid;
+        } else {
+            high = mid - 1;
+        }
+    }
+    return low;
+}
+
+void text_measure(struct Text *list, struct TextMemory *mem) {
+    struct Text *line;
+    struct Payload *payload;
+    struct Layout *layout;
+    size_t refs;
+
+    for (line = list; line; line = line->next) {
+        mem->lines++;
+        mem->nodes += sizeof(struct Text);
+        if (line->cold) {
+            mem->frozen += line->cold->size * line->len / line->cold->raw;
+            continue;
+        }
+        payload = PAYLOAD(line->data);
+        refs = payload->refs;
+        mem->data += line->len / refs;
+        mem->headers += (sizeof(struct Payload) + 1) / refs;
+        if (line->capacity > line->len) {
+            mem->slack += (line->capacity - line->len) / refs;
+        }
+
+        layout = payload->layout;
+        if (layout && layout != &plain_layout) {
+            mem->caches += (sizeof(struct Layout) +
+                (line->len + 1 + layout->rows) * sizeof(unsigned int)) / refs;
+        }
+        if (line->highlight) {
+            mem->caches += sizeof(struct Highlight) +
+                line->highlight->n * sizeof(struct Token);
+        }
+    }
+}
+
+size_t text_spare(void) {
+    size_t n = 0;
+#ifndef DEBUG
+    struct Text *line;
+    for (line = free_lines; line; line = line->next) {
+        n++;
+    }
+#endif
+    return n * sizeof(struct Text);
+}
+
+size_t text_freeze(struct Text *first, size_t n) {
+    struct Text *line;
+    struct Cold *block;
+    unsigned char *raw;
+    unsigned char *packed;
+    size_t total = 0;
+    size_t size;
+    size_t frozen = 0;
+    size_t i;
+
+    /* lines whose bytes are shared would not give any memory back */
+    for (line = first, i = 0; line && i < n; line = line->next, i++) {
+        if (!line->cold && PAYLOAD(line->data)->refs == 1) {
+            total += line->len + 1;
+        }
+    }
+    if (total == 0) {
+        return 0;
+    }
+    raw = malloc(total);
+    for (line = first, i = 0, total = 0; line && i < n; line = line->next, i++) {
+        if (!line->cold && PAYLOAD(line->data)->refs == 1) {
+            memcpy(raw + total, line->data, line->len + 1);
+            total += line->len + 1;
+        }
+    }
+    packed = malloc(lz_bound(total));
+    size = lz_compress(raw, total, packed);
+    free(raw);
+    /* not worth the time it takes to expand it again */
+    if (size >= total - total / 4) {
+        free(packed);
+        return 0;
+    }
+
+    block = malloc(sizeof(struct Cold) + size);
+    block->refs = 0;
+    block->raw = total;
+    block->size = size;
+    memcpy(COLD_BYTES(block), packed, size);
+    free(packed);
+    for (line = first, i = 0, total = 0; line && i < n; line = line->next, i++) {
+        if (!line->cold && PAYLOAD(line->data)->refs == 1) {
+            payload_release(line->data);
+            free(line->highlight);
+            line->highlight = NULL;
+            line->data = NULL;
+            line->capacity = total;
+            line->cold = block;
+            block->refs++;
+            total += line->len + 1;
+            frozen++;
+        }
+    }
+    PROFILE_COUNT(COUNT_FREEZES, frozen);
+    return frozen;
+}
+
+const char *text_peek(struct Text *line) {
+    struct Cold *block = line->cold;
+
+    if (!block) {
+        return line->data;
+    }
+    if (block != expanded_block) {
+        if (expanded_capacity < block->raw) {
+            expanded_capacity = block->raw;
+            expanded = realloc(expanded, expanded_capacity);
+        }
+        lz_expand(COLD_BYTES(block), block->size,
+            (unsigned char *)expanded, block->raw);
+        expanded_block = block;
+    }
+    return expanded + line->capacity;
+}
+
+void text_thaw(struct Text *line) {
+    struct Cold *block = line->cold;
+
+    if (!block) {
+        return;
+    }
+    line->data = payload_new(text_peek(line), line->len, line->len);
+    line->capacity = line->len;
+    line->cold = NULL;
+    cold_release(block);
+    PROFILE_COUNT(COUNT_THAWS, 1);
+}
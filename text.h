@@ -20,12 +20,42 @@
 
 #include <stdio.h>
 
+struct Highlight;
+struct Cold;
+
+/*
+ * a line of text. highlight is what the syntax highlighter made of it,
+ * freed along with the line and dropped whenever its bytes are written to.
+ * brackets is what bracket_match made of its brackets, cleared the same way,
+ * and words is set while its words are counted in the word index.
+ * a line frozen by text_freeze has no data until text_thaw gives it back,
+ * and cold is the block its bytes are compressed in
+ */
 struct Text {
     char *data;
     size_t len;
     size_t capacity;
     struct Text *prev;
     struct Text *next;
+    struct Highlight *highlight;
+    struct Cold *cold;
+    unsigned int brackets;
+    unsigned int words;
+};
+
+/*
+ * the bytes held by some lines, as they were asked for from malloc. a
+ * payload shared by several lines is split evenly between them, so that
+ * adding up the text, the registers and the undo history counts it once
+ */
+struct TextMemory {
+    size_t lines;
+    size_t nodes;
+    size_t data;
+    size_t headers;
+    size_t slack;
+    size_t caches;
+    size_t frozen;
 };
 
 enum Todo {
@@ -39,15 +69,22 @@ enum Todo {
  */
 struct Text *text_make_line(void);
 
+/**
+ * gives the line its own copy of its bytes if they are shared with another
+ * line. must be called before writing to line->data directly
+ */
+void text_unshare(struct Text *line);
+
 /**
  * Inserts a single character to the end of the current line
  */
 void text_push_char(struct Text *line, char c);
 
 /**
- * writes text out to file
+ * writes text out to file, ending each line with \r\n instead of \n if
+ * crlf is set
  */
-void text_write(struct Text *line, char *filename);
+void text_write(struct Text *line, char *filename, int crlf);
 
 /**
  * backspaces text from the index
@@ -65,9 +102,11 @@ void text_insert_char(struct Text *line, size_t index, char c);
 void text_shift_left(struct Text *line, size_t index);
 
 /**
- * Load a file into a text struct
+ * loads a file into a new list of lines, or a single empty line if it is
+ * empty or cannot be read. if every line of the file ends in \r\n, *crlf is
+ * set and the lines are kept ending in just \n. safe to call from any thread
  */
-void text_read_from_file(struct Text *line, FILE *fp);
+struct Text *text_load(const char *filename, int *crlf);
 
 /**
  * split a line of text into 2 lines starting from index
@@ -75,7 +114,7 @@ void text_read_from_file(struct Text *line, FILE *fp);
 struct Text *text_split_line(struct Text *line, size_t index);
 
 /**
- * make a copy of a line of text
+ * make a copy of a line of text, sharing its bytes until either is written to
  */
 struct Text *text_copy_line(struct Text *line);
 
@@ -90,4 +129,161 @@ void text_insert_line(
 
 size_t text_total_lines(struct Text *top_line);
 
+/**
+ * passed as a line count to mean "until the end of the text"
+ */
+#define TEXT_ALL_LINES ((size_t)-1)
+
+/**
+ * deletes n characters starting from index with a single move of the tail
+ */
+void text_delete_chars(struct Text *line, size_t index, size_t n);
+
+/**
+ * copies up to n characters starting from index into a detached line that
+ * holds just those bytes
+ */
+struct Text *text_copy_chars(struct Text *line, size_t index, size_t n);
+
+/**
+ * like text_copy_chars, but also deletes the copied characters
+ */
+struct Text *text_cut_chars(struct Text *line, size_t index, size_t n);
+
+/**
+ * inserts n characters at index, moving the rest of the line once
+ */
+void text_insert_chars(
+    struct Text *line,
+    size_t index,
+    const char *chars,
+    size_t n
+);
+
+/**
+ * unlinks up to n lines starting at first, leaving first as the head of a
+ * detached list. returns the line that followed the removed range
+ */
+struct Text *text_cut_lines(struct Text *first, size_t n);
+
+/**
+ * copies up to n lines starting at first into a new detached list
+ */
+struct Text *text_copy_lines(struct Text *first, size_t n);
+
+/**
+ * links the detached list after prev, returns the last line of the list
+ */
+struct Text *text_splice_lines(struct Text *prev, struct Text *list);
+
+/**
+ * frees every line of a detached list
+ */
+void text_free_lines(struct Text *list);
+
+/**
+ * copies the characters from start on the line first up to, but not
+ * including, end on the line last. every line of the copy ends in a newline
+ * except the last one
+ */
+struct Text *text_copy_span(
+    struct Text *first,
+    size_t start,
+    struct Text *last,
+    size_t end
+);
+
+/**
+ * builds a detached list from n characters, starting a new line after every
+ * newline, in the same shape as text_copy_span
+ */
+struct Text *text_from_chars(const char *chars, size_t n);
+
+/**
+ * like text_copy_span, but also deletes the copied characters and joins what
+ * remains of first and last into one line
+ */
+struct Text *text_cut_span(
+    struct Text *first,
+    size_t start,
+    struct Text *last,
+    size_t end
+);
+
+/**
+ * the screen column the character at index starts at, counting tabs to the
+ * next multiple of 8, utf-8 characters by their width, and wide east asian
+ * characters as 2. an index of the length of the line gives its width. the
+ * columns are worked out once and kept until the line is next written to
+ */
+size_t text_column(struct Text *line, size_t index);
+
+/**
+ * the index of the character that covers the screen column, or the length
+ * of the line if it is not that wide
+ */
+size_t text_column_index(struct Text *line, size_t column);
+
+/**
+ * the index of the character after the one at index
+ */
+size_t text_next_char(struct Text *line, size_t index);
+
+/**
+ * the index of the character before the one at index
+ */
+size_t text_prev_char(struct Text *line, size_t index);
+
+/**
+ * how many screen rows the line takes when it is wrapped at width columns.
+ * where the rows start is worked out once and kept with the columns
+ */
+size_t text_rows(struct Text *line, size_t width);
+
+/**
+ * the column the row of the line wrapped at width starts at, or the width of
+ * the line for the row after its last
+ */
+size_t text_row_column(struct Text *line, size_t width, size_t row);
+
+/**
+ * the row of the line wrapped at width that the column is on
+ */
+size_t text_column_row(struct Text *line, size_t width, size_t column);
+
+/**
+ * adds the memory held by every line of list to mem: the nodes, the bytes of
+ * text and the headers in front of them, the capacity not yet used, the
+ * columns and highlighting worked out for them, and the compressed bytes of
+ * frozen lines
+ */
+void text_measure(struct Text *list, struct TextMemory *mem);
+
+/**
+ * the bytes of freed line nodes kept to be handed out again
+ */
+size_t text_spare(void);
+
+/**
+ * compresses the bytes of the n lines from first into one block and frees
+ * them, leaving out lines already frozen or sharing their bytes with a
+ * copy. returns how many were frozen, which is none if the bytes do not
+ * compress well. the functions here thaw a line before they look at its
+ * bytes, and so must anything else that reads data
+ */
+size_t text_freeze(struct Text *first, size_t n);
+
+/**
+ * gives a frozen line its bytes back. a line that is not frozen is left
+ * as it is
+ */
+void text_thaw(struct Text *line);
+
+/**
+ * the bytes of a line, frozen or not, for reading only. a frozen line is
+ * expanded without being thawed, and what is returned for it lasts until
+ * a line from another block is peeked at or thawed
+ */
+const char *text_peek(struct Text *line);
+
 #endif /* TEXT_H */
@@ -0,0 +1,666 @@
+/*
+ *     Copyright (C) 2020 Kyle Kloberdanz
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "undo.h"
+
+/*
+ * an undo file starts with a header of UNDO_HEADER bytes:
+ *
+ *      0   "vinundo" and a nul
+ *      8   UNDO_VERSION
+ *     12   checksum of the rest of the header and the index
+ *     16   checksum of the text the history belongs to
+ *     24   bytes in the text
+ *     32   lines in the text
+ *     40   steps to undo
+ *     48   steps to redo
+ *     56   the last group used
+ *
+ * then an index of UNDO_ENTRY bytes for each step, the steps to undo first,
+ * newest first, and the redo steps after them:
+ *
+ *      0   line_no
+ *      8   new_n
+ *     16   x
+ *     24   group
+ *     32   how many lines the step saved
+ *     40   bytes of those lines
+ *     48   checksum of those lines
+ *
+ * and then the saved lines of each step in the same order. numbers are
+ * little endian
+ */
+#define UNDO_MAGIC "vinundo"
+#define UNDO_VERSION 1
+#define UNDO_HEADER 64
+#define UNDO_ENTRY 56
+
+/* the checksum before any bytes are added */
+#define CHECK_START 2166136261UL
+
+/*
+ * notes that the n lines from line_no, as the lines are numbered after the
+ * changes so far, were replaced by new_n lines
+ */
+static void mark_changed(
+    struct History *history,
+    size_t line_no,
+    size_t n,
+    size_t new_n
+) {
+    long end = (long)(line_no + n) - history->shift;
+
+    if (!history->changed) {
+        history->changed = line_no;
+        history->changed_end = line_no + n;
+    } else {
+        if (line_no < history->changed) {
+            history->changed = line_no;
+        }
+        if (end > (long)history->changed_end) {
+            history->changed_end = (size_t)end;
+        }
+    }
+    history->shift += (long)new_n - (long)n;
+}
+
+/* adds n bytes to a 32 bit FNV-1a checksum */
+static unsigned long checksum(
+    unsigned long check,
+    const char *bytes,
+    size_t n
+) {
+    for (; n > 0; n--, bytes++) {
+        check = ((check ^ (unsigned char)*bytes) * 16777619UL) & 0xffffffffUL;
+    }
+    return check;
+}
+
+static void put_number(unsigned char *p, size_t n, size_t width) {
+    size_t i;
+    for (i = 0; i < width; i++, n >>= 8) {
+        p[i] = n & 0xff;
+    }
+}
+
+static size_t get_number(const unsigned char *p, size_t width) {
+    size_t n = 0;
+    for (; width > 0; width--) {
+        n = (n << 8) | p[width - 1];
+    }
+    return n;
+}
+
+/* the checksum, bytes and number of the lines in list */
+static unsigned long lines_check(
+    struct Text *list,
+    size_t *bytes,
+    size_t *lines
+) {
+    unsigned long check = CHECK_START;
+    const char *data;
+    size_t len;
+
+    *bytes = 0;
+    *lines = 0;
+    for (; list; list = list->next) {
+        data = text_peek(list);
+        len = strlen(data);
+        check = checksum(check, data, len);
+        *bytes += len;
+        (*lines)++;
+    }
+    return check;
+}
+
+/* .name.undo in the directory of filename */
+static char *undo_path(const char *filename) {
+    const char *base = strrchr(filename, '/');
+    char *path = malloc(strlen(filename) + sizeof("..undo"));
+
+    base = base ? base + 1 : filename;
+    sprintf(
+        path,
+        "%.*s.%s.undo",
+        (int)(base - filename),
+        filename,
+        base
+    );
+    return path;
+}
+
+static void undo_free_steps(struct UndoStep *step) {
+    struct UndoStep *next;
+    for (; step; step = next) {
+        next = step->next;
+        text_free_lines(step->saved);
+        free(step);
+    }
+}
+
+void undo_begin(
+    struct History *history,
+    struct Text *line,
+    size_t line_no,
+    size_t n,
+    size_t x
+) {
+    struct UndoStep *step = calloc(1, sizeof(struct UndoStep));
+
+    if (history->open) {
+        undo_end(history, history->open->new_n);
+    }
+    if (!history->grouping) {
+        history->group++;
+    }
+
+    mark_changed(history, line_no, n, n);
+    step->line_no = line_no;
+    step->new_n = n;
+    step->x = x;
+    step->saved = n ? text_copy_lines(line, n) : NULL;
+    step->group = history->group;
+    history->open = step;
+}
+
+void undo_end(struct History *history, size_t new_n) {
+    struct UndoStep *step = history->open;
+    if (!step) {
+        return;
+    }
+    mark_changed(history, step->line_no, step->new_n, new_n);
+    step->new_n = new_n;
+    step->next = history->undo;
+    history->undo = step;
+    history->open = NULL;
+
+    /* a new change makes the undone ones unreachable */
+    undo_free_steps(history->redo);
+    history->redo = NULL;
+}
+
+void undo_grow(struct History *history, size_t new_n) {
+    struct UndoStep *step = history->open;
+    if (step) {
+        mark_changed(history, step->line_no, step->new_n, new_n);
+        step->new_n = new_n;
+    }
+}
+
+void undo_group_begin(struct History *history) {
+    if (history->grouping++ == 0) {
+        history->group++;
+    }
+}
+
+void undo_group_end(struct History *history) {
+    if (history->grouping > 0) {
+        history->grouping--;
+    }
+}
+
+/* walks from a known line to the line numbered line_no */
+static struct Text *seek(struct Text *from, size_t from_no, size_t line_no) {
+    for (; from && from_no < line_no; from_no++) {
+        from = from->next;
+    }
+    for (; from && from_no > line_no; from_no--) {
+        from = from->prev;
+    }
+    return from;
+}
+
+/*
+ * reads the lines of a step read from an undo file out of it. returns 0 if
+ * they are not what was written
+ */
+static int step_expand(struct UndoStep *step) {
+    struct Text *line;
+    size_t n;
+
+    if (!step->bytes) {
+        return 1;
+    }
+    if (checksum(CHECK_START, step->bytes, step->size) != step->check) {
+        return 0;
+    }
+    if (step->saved_n) {
+        step->saved = text_from_chars(step->bytes, step->size);
+
+        /* an empty last line without a newline leaves no bytes behind */
+        for (line = step->saved, n = 1; line->next; line = line->next) {
+            n++;
+        }
+        for (; n < step->saved_n; n++) {
+            text_insert_line(line, text_from_chars("", 0), NULL);
+            line = line->next;
+        }
+    }
+    step->bytes = NULL;
+    return 1;
+}
+
+/*
+ * swaps the lines of a step back into the text, turning the step into the
+ * one that reverses it. from is left on a line that is still in the text
+ */
+static void undo_apply(
+    struct UndoStep *step,
+    struct Text **top_of_text,
+    struct Text **from,
+    size_t *from_no
+) {
+    struct Text *prev = NULL;
+    struct Text *first;
+    struct Text *last = NULL;
+    struct Text *removed = NULL;
+    struct Text *line;
+    size_t n = 0;
+
+    if (step->line_no > 1) {
+        prev = seek(*from, *from_no, step->line_no - 1);
+    }
+    first = prev ? prev->next : *top_of_text;
+
+    if (step->new_n && first) {
+        struct Text *next = text_cut_lines(first, step->new_n);
+        removed = first;
+        if (!prev) {
+            *top_of_text = next;
+        }
+    }
+
+    for (line = step->saved; line; line = line->next) {
+        last = line;
+        n++;
+    }
+    if (step->saved && prev) {
+        text_splice_lines(prev, step->saved);
+    } else if (step->saved) {
+        last->next = *top_of_text;
+        if (*top_of_text) {
+            (*top_of_text)->prev = last;
+        }
+        *top_of_text = step->saved;
+    }
+
+    step->saved = removed;
+    step->new_n = n;
+    *from = prev ? prev : *top_of_text;
+    *from_no = prev ? step->line_no - 1 : 1;
+}
+
+static struct Text *undo_move(
+    struct History *history,
+    struct UndoStep **src,
+    struct UndoStep **dst,
+    struct Text **top_of_text,
+    struct Text *from,
+    size_t from_no,
+    size_t *line_no,
+    size_t *x
+) {
+    struct UndoStep *step = *src;
+    unsigned long group;
+    size_t n;
+
+    if (!step) {
+        return NULL;
+    }
+
+    /* a damaged undo file loses the history from the damage on */
+    for (group = step->group; step && step->group == group; step = step->next) {
+        if (!step_expand(step)) {
+            undo_free_steps(*src);
+            *src = NULL;
+            return NULL;
+        }
+    }
+
+    for (step = *src; step && step->group == group; step = *src) {
+        *src = step->next;
+        n = step->new_n;
+        undo_apply(step, top_of_text, &from, &from_no);
+        mark_changed(history, step->line_no, n, step->new_n);
+        *line_no = step->line_no;
+        *x = step->x;
+        step->next = *dst;
+        *dst = step;
+    }
+    if (!from) {
+        return NULL;
+    }
+
+    /* the change may have started past what is now the last line */
+    for (; from->next && from_no < *line_no; from_no++) {
+        from = from->next;
+    }
+    *line_no = from_no;
+    return from;
+}
+
+struct Text *undo_undo(
+    struct History *history,
+    struct Text **top_of_text,
+    struct Text *from,
+    size_t from_no,
+    size_t *line_no,
+    size_t *x
+) {
+    return undo_move(
+        history,
+        &history->undo,
+        &history->redo,
+        top_of_text,
+        from,
+        from_no,
+        line_no,
+        x
+    );
+}
+
+struct Text *undo_redo(
+    struct History *history,
+    struct Text **top_of_text,
+    struct Text *from,
+    size_t from_no,
+    size_t *line_no,
+    size_t *x
+) {
+    return undo_move(
+        history,
+        &history->redo,
+        &history->undo,
+        top_of_text,
+        from,
+        from_no,
+        line_no,
+        x
+    );
+}
+
+size_t undo_changed(struct History *history, size_t *end, long *shift) {
+    size_t changed;
+
+    /* the lines of an open change can go on changing until it is ended */
+    if (history->open) {
+        mark_changed(history, history->open->line_no, history->open->new_n,
+            history->open->new_n);
+    }
+    changed = history->changed;
+    *end = history->changed_end;
+    *shift = history->shift;
+    history->changed = 0;
+    history->changed_end = 0;
+    history->shift = 0;
+    return changed;
+}
+
+static size_t measure_steps(struct UndoStep *step, struct TextMemory *mem) {
+    size_t bytes = 0;
+    for (; step; step = step->next) {
+        text_measure(step->saved, mem);
+        bytes += sizeof(struct UndoStep);
+    }
+    return bytes;
+}
+
+size_t undo_measure(struct History *history, struct TextMemory *mem) {
+    return measure_steps(history->undo, mem) +
+        measure_steps(history->redo, mem) +
+        measure_steps(history->open, mem);
+}
+
+void undo_free(struct History *history) {
+    if (history->open) {
+        undo_end(history, history->open->new_n);
+    }
+    undo_free_steps(history->undo);
+    undo_free_steps(history->redo);
+    history->undo = NULL;
+    history->redo = NULL;
+    if (history->map) {
+        munmap(history->map, history->map_size);
+        history->map = NULL;
+    }
+}
+
+/* fills in the index entry for a step */
+static void put_entry(unsigned char *entry, struct UndoStep *step) {
+    if (!step->bytes) {
+        step->check = lines_check(step->saved, &step->size, &step->saved_n);
+    }
+    put_number(entry, step->line_no, 8);
+    put_number(entry + 8, step->new_n, 8);
+    put_number(entry + 16, step->x, 8);
+    put_number(entry + 24, step->group, 8);
+    put_number(entry + 32, step->saved_n, 8);
+    put_number(entry + 40, step->size, 8);
+    put_number(entry + 48, step->check, 4);
+}
+
+static void write_lines(FILE *fp, struct UndoStep *step) {
+    struct Text *line;
+    const char *data;
+
+    if (step->bytes) {
+        fwrite(step->bytes, 1, step->size, fp);
+        return;
+    }
+    for (line = step->saved; line; line = line->next) {
+        data = text_peek(line);
+        fwrite(data, 1, strlen(data), fp);
+    }
+}
+
+const char *undo_save(
+    struct History *history,
+    struct Text *top_of_text,
+    const char *filename,
+    int create
+) {
+    struct UndoStep *lists[2];
+    struct UndoStep *step;
+    struct stat st;
+    unsigned char *head;
+    unsigned char *entry;
+    char *path = undo_path(filename);
+    char *tmp;
+    size_t counts[2] = {0, 0};
+    size_t bytes;
+    size_t lines;
+    size_t size;
+    size_t i;
+    FILE *fp;
+    int failed;
+
+    if (!create && stat(path, &st) != 0) {
+        free(path);
+        return NULL;
+    }
+
+    /* an open change is not finished, so it is left out */
+    lists[0] = history->undo;
+    lists[1] = history->redo;
+    for (i = 0; i < 2; i++) {
+        for (step = lists[i]; step; step = step->next) {
+            counts[i]++;
+        }
+    }
+
+    size = UNDO_HEADER + (counts[0] + counts[1]) * UNDO_ENTRY;
+    head = calloc(1, size);
+    memcpy(head, UNDO_MAGIC, sizeof(UNDO_MAGIC));
+    put_number(head + 8, UNDO_VERSION, 4);
+    put_number(head + 16, lines_check(top_of_text, &bytes, &lines), 4);
+    put_number(head + 24, bytes, 8);
+    put_number(head + 32, lines, 8);
+    put_number(head + 40, counts[0], 8);
+    put_number(head + 48, counts[1], 8);
+    put_number(head + 56, history->group, 8);
+    entry = head + UNDO_HEADER;
+    for (i = 0; i < 2; i++) {
+        for (step = lists[i]; step; step = step->next, entry += UNDO_ENTRY) {
+            put_entry(entry, step);
+        }
+    }
+    put_number(head + 12, checksum(CHECK_START, (char *)head + 16, size - 16), 4);
+
+    /*
+     * the old file may still be mapped by this or another vin, so the new
+     * one is written beside it and moved over it
+     */
+    tmp = malloc(strlen(path) + sizeof(".tmp"));
+    sprintf(tmp, "%s.tmp", path);
+    fp = fopen(tmp, "wb");
+    if (!fp) {
+        free(head);
+        free(tmp);
+        free(path);
+        return "failed to write undo file";
+    }
+    fwrite(head, 1, size, fp);
+    for (i = 0; i < 2; i++) {
+        for (step = lists[i]; step; step = step->next) {
+            write_lines(fp, step);
+        }
+    }
+    failed = ferror(fp);
+    failed |= (fclose(fp) != 0);
+    if (failed || rename(tmp, path) != 0) {
+        remove(tmp);
+        failed = 1;
+    }
+    free(head);
+    free(tmp);
+    free(path);
+    return failed ? "failed to write undo file" : NULL;
+}
+
+/*
+ * builds the steps of the undo file at map, which has been checked as far
+ * as the end of its index, or returns 0 if the lines run off its end
+ */
+static int read_steps(
+    struct History *history,
+    const unsigned char *map,
+    size_t size,
+    size_t counts[2]
+) {
+    struct UndoStep **tails[2];
+    struct UndoStep *step;
+    const unsigned char *entry = map + UNDO_HEADER;
+    size_t offset = UNDO_HEADER + (counts[0] + counts[1]) * UNDO_ENTRY;
+    size_t i;
+    size_t n;
+
+    tails[0] = &history->undo;
+    tails[1] = &history->redo;
+    for (i = 0; i < 2; i++) {
+        for (n = 0; n < counts[i]; n++, entry += UNDO_ENTRY) {
+            step = calloc(1, sizeof(struct UndoStep));
+            step->line_no = get_number(entry, 8);
+            step->new_n = get_number(entry + 8, 8);
+            step->x = get_number(entry + 16, 8);
+            step->group = get_number(entry + 24, 8);
+            step->saved_n = get_number(entry + 32, 8);
+            step->size = get_number(entry + 40, 8);
+            step->check = get_number(entry + 48, 4);
+            step->bytes = (const char *)map + offset;
+            *tails[i] = step;
+            tails[i] = &step->next;
+            if (step->size > size - offset) {
+                return 0;
+            }
+            offset += step->size;
+        }
+    }
+    return 1;
+}
+
+int undo_load(
+    struct History *history,
+    struct Text *top_of_text,
+    const char *filename
+) {
+    char *path = undo_path(filename);
+    const unsigned char *map;
+    struct stat st;
+    size_t counts[2];
+    size_t bytes;
+    size_t lines;
+    size_t size;
+    void *mapped;
+    int fd;
+
+    fd = open(path, O_RDONLY);
+    free(path);
+    if (fd < 0) {
+        return 0;
+    }
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < UNDO_HEADER) {
+        close(fd);
+        return 0;
+    }
+    size = st.st_size;
+    mapped = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapped == MAP_FAILED) {
+        return 0;
+    }
+
+    map = mapped;
+    counts[0] = get_number(map + 40, 8);
+    counts[1] = get_number(map + 48, 8);
+    if (memcmp(map, UNDO_MAGIC, sizeof(UNDO_MAGIC)) ||
+        get_number(map + 8, 4) != UNDO_VERSION ||
+        counts[0] > (size - UNDO_HEADER) / UNDO_ENTRY ||
+        counts[1] > (size - UNDO_HEADER) / UNDO_ENTRY - counts[0] ||
+        get_number(map + 12, 4) != checksum(
+            CHECK_START,
+            (const char *)map + 16,
+            (counts[0] + counts[1]) * UNDO_ENTRY + UNDO_HEADER - 16
+        ) ||
+        get_number(map + 16, 4) != lines_check(top_of_text, &bytes, &lines) ||
+        get_number(map + 24, 8) != bytes ||
+        get_number(map + 32, 8) != lines
+    ) {
+        munmap(mapped, size);
+        return 0;
+    }
+
+    if (!read_steps(history, map, size, counts)) {
+        undo_free_steps(history->undo);
+        undo_free_steps(history->redo);
+        history->undo = NULL;
+        history->redo = NULL;
+        munmap(mapped, size);
+        return 0;
+    }
+    history->group = get_number(map + 56, 8);
+    history->map = mapped;
+    history->map_size = size;
+    return 1;
+}
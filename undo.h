@@ -0,0 +1,161 @@
+/*
+ *     Copyright (C) 2020 Kyle Kloberdanz
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef UNDO_H
+#define UNDO_H
+
+#include "text.h"
+
+/*
+ * one change to the text: new_n lines starting at line_no took the place of
+ * the lines in saved. a step read back from an undo file keeps its saved_n
+ * lines as the size bytes at bytes in the file until it is first used
+ */
+struct UndoStep {
+    size_t line_no;
+    size_t new_n;
+    size_t x;
+    struct Text *saved;
+    unsigned long group;
+    const char *bytes;
+    size_t size;
+    size_t saved_n;
+    unsigned long check;
+    struct UndoStep *next;
+};
+
+/*
+ * changed is the first line number touched by a change, an undo or a redo
+ * since undo_changed was last asked, or 0 if there was none. changed_end is
+ * the number the first line below all they touched had before them, and
+ * shift how many lines they added less how many they took away. map is the
+ * undo file the history was read from, if any, which stays mapped until
+ * freed
+ */
+struct History {
+    struct UndoStep *undo;
+    struct UndoStep *redo;
+    struct UndoStep *open;
+    unsigned long group;
+    int grouping;
+    size_t changed;
+    size_t changed_end;
+    long shift;
+    void *map;
+    size_t map_size;
+};
+
+/**
+ * starts recording a change to the n lines from line, which is line number
+ * line_no. x is the cursor column to return to on undo. n may be 0 when the
+ * change only adds lines before line_no
+ */
+void undo_begin(
+    struct History *history,
+    struct Text *line,
+    size_t line_no,
+    size_t n,
+    size_t x
+);
+
+/**
+ * finishes the change started by undo_begin, new_n lines now stand where the
+ * recorded ones were
+ */
+void undo_end(struct History *history, size_t new_n);
+
+/**
+ * notes that the change started by undo_begin now covers new_n lines, for
+ * a change that goes on over several keys
+ */
+void undo_grow(struct History *history, size_t new_n);
+
+/**
+ * changes recorded until the matching undo_group_end are undone as one
+ */
+void undo_group_begin(struct History *history);
+
+void undo_group_end(struct History *history);
+
+/**
+ * undoes the last group of changes. from is any line still in the text and
+ * from_no its number. returns the line the change started at and sets
+ * *line_no and *x to where the cursor goes, or returns NULL if there is
+ * nothing to undo
+ */
+struct Text *undo_undo(
+    struct History *history,
+    struct Text **top_of_text,
+    struct Text *from,
+    size_t from_no,
+    size_t *line_no,
+    size_t *x
+);
+
+/**
+ * the reverse of undo_undo
+ */
+struct Text *undo_redo(
+    struct History *history,
+    struct Text **top_of_text,
+    struct Text *from,
+    size_t from_no,
+    size_t *line_no,
+    size_t *x
+);
+
+/**
+ * the first line number that may have changed since the last call, or 0 if
+ * nothing did. lines above it are the same lines they were before. *end is
+ * set to the line number, counted as it was before the changes, of the
+ * first line below them, which has moved down by *shift lines
+ */
+size_t undo_changed(struct History *history, size_t *end, long *shift);
+
+/**
+ * adds the lines kept to undo and redo changes to mem, and returns the bytes
+ * of the steps that hold them
+ */
+size_t undo_measure(struct History *history, struct TextMemory *mem);
+
+/**
+ * writes the history of the text from top_of_text, as written to filename,
+ * to an undo file beside it. nothing is written unless create is set or
+ * there is an undo file there already. returns an error or NULL
+ */
+const char *undo_save(
+    struct History *history,
+    struct Text *top_of_text,
+    const char *filename,
+    int create
+);
+
+/**
+ * reads the history back from the undo file beside filename if it was
+ * written for text just like top_of_text. the lines the steps saved are
+ * left in the file until they are undone or redone. returns 1 if the
+ * history was read
+ */
+int undo_load(
+    struct History *history,
+    struct Text *top_of_text,
+    const char *filename
+);
+
+void undo_free(struct History *history);
+
+#endif /* UNDO_H */
@@ -23,10 +23,21 @@
 #include <signal.h>
 #include <limits.h>
 #include <ctype.h>
+#include <locale.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include "vin.h"
 #include "text.h"
 #include "command.h"
+#include "ex.h"
+#include "filter.h"
+#include "sort.h"
+#include "syntax.h"
+#include "bracket.h"
+#include "words.h"
+#include "profile.h"
 
 #define UNUSED(A) (void)(A)
 
@@ -42,10 +53,45 @@
         wmove(win->curses_win, cur->y, cur->x); \
     } while (0)
 
+/* with :set compress, lines this far from every window are frozen */
+#define COLD_DISTANCE 1000
+
+/* frozen lines are compressed in blocks of about this many bytes */
+#define COLD_BLOCK 65536
+
+/* how many lines are looked at for freezing after each key */
+#define COLD_BATCH 4096
+
+/* how many lines have their words counted after each key */
+#define WORDS_BATCH 4096
+
+/*
+ * a resize waits until no other has come for this many milliseconds, but
+ * no more than RESIZE_WAITS times, so dragging a pane resizes once
+ */
+#define RESIZE_SETTLE 30
+#define RESIZE_WAITS 10
+
+/* the part a row is marked with when it shows a closed fold */
+#define FOLD_ROW ((size_t)-1)
+
 static const char *blank = "                                      ";
 
+/* how each kind of token is drawn */
+static attr_t kind_attrs[KIND_COUNT];
+
+/* set when the terminal changed size and the windows have not yet */
+static volatile sig_atomic_t resized = 0;
+
 char *strdup(const char *s);
 
+static void screen_resize(struct Window *win, struct Cursor *cur);
+
+static void sigwinch_handler(int sig) {
+    signal(sig, sigwinch_handler);
+    resized = 1;
+}
+
 static void sigint_handler(int sig) {
 #ifdef DEBUG
     UNUSED(sig);
@@ -58,9 +104,51 @@ static void sigint_handler(int sig) {
 #endif
 }
 
-static void set_clipboard(struct Cursor *cur) {
-    free(cur->before);
-    cur->before = strdup(cur->line->data);
+/*
+ * the next key to act on, replayed from a macro or typed by the user. a
+ * resize of the terminal while waiting, which stops the wait, lays out the
+ * windows again and comes back as KEY_RESIZE
+ */
+static int next_key(struct Window *win, struct Cursor *cur) {
+    int c = macro_next(&cur->macro);
+    if (c < 0) {
+        PROFILE_WAIT_BEGIN();
+        c = resized ? ERR : wgetch(win->curses_win);
+        PROFILE_WAIT_END();
+        if (c == ERR && resized) {
+            screen_resize(win, cur);
+            return KEY_RESIZE;
+        }
+        macro_key(&cur->macro, c);
+    }
+    return c;
+}
+
+/* waits for a key to dismiss a message, unless a macro is replaying */
+static void wait_key(struct Window *win, struct Cursor *cur) {
+    if (!cur->macro.playing) {
+        PROFILE_WAIT_BEGIN();
+        wgetch(win->curses_win);
+        PROFILE_WAIT_END();
+    }
+}
+
+/* how many of the n lines starting at line exist */
+static size_t lines_from(struct Text *line, size_t n) {
+    size_t i;
+    for (i = 0; line && i < n; i++) {
+        line = line->next;
+    }
+    return i;
+}
+
+/* records the n lines from the cursor before they are changed */
+static void change_begin(struct Cursor *cur, size_t n) {
+    undo_begin(&cur->history, cur->line, cur->line_no, n, cur->x);
+}
+
+static void change_end(struct Cursor *cur, size_t new_n) {
+    undo_end(&cur->history, new_n);
 }
 
 static enum Todo handle_input(
@@ -68,8 +156,7 @@ static enum Todo handle_input(
     struct Cursor *cur,
     enum Mode *mode,
     int c,
-    struct Command *cmd,
-    char *filename
+    struct Command *cmd
 );
 
 static void handle_search_mode(
@@ -78,6 +165,8 @@ static void handle_search_mode(
     enum Mode *mode
 );
 
+static struct Text *line_at(struct Cursor *cur, size_t line_no);
+
 static void cursor_advance(struct Cursor *cur) {
     cur->x++;
 }
@@ -87,237 +176,3509 @@ static void wputchar(struct Window *win, struct Cursor *cur, int c) {
     cursor_advance(cur);
 }
 
-static void redraw_screen(
-    struct Window *win,
+/* one past the last character before the newline */
+static size_t line_end(struct Text *line) {
+    size_t len = line->len;
+    text_thaw(line);
+    return (len > 0 && line->data[len - 1] == '\n') ? len - 1 : len;
+}
+
+/* index of the last character before the newline */
+static size_t last_col(struct Text *line) {
+    return text_prev_char(line, line_end(line));
+}
+
+/* the index count characters on from x, stopping at end */
+static size_t chars_after(struct Text *line, size_t x, size_t count, size_t end) {
+    for (; count && x < end; count--) {
+        x = text_next_char(line, x);
+    }
+    return MIN(x, end);
+}
+
+/*
+ * after moving from the line from, puts the cursor on the character at the
+ * same screen column, or the furthest one it has been at since it last
+ * moved sideways. old_x holds that column
+ */
+static void cursor_keep_column(struct Cursor *cur, struct Text *from) {
+    cur->old_x = MAX(text_column(from, cur->x), cur->old_x);
+    cur->x = MIN(text_column_index(cur->line, cur->old_x), last_col(cur->line));
+}
+
+/*
+ * the folds of the buffer in use, or NULL if none are closed. folds are
+ * only moved along with the text once the key being handled is done with,
+ * so while it has changes of its own waiting nothing is taken to be folded
+ */
+static struct Folds *folds_shown(struct Cursor *cur) {
+    struct Folds *folds = &cur->buffers.list[cur->buffers.current].folds;
+
+    if (cur->history.changed || !folds->nclosed) {
+        return NULL;
+    }
+    return folds;
+}
+
+/* the closed fold the line numbered line_no is hidden in, or NULL */
+static struct Fold *folded(struct Cursor *cur, size_t line_no) {
+    struct Folds *folds = folds_shown(cur);
+    return folds ? fold_at(folds, line_no) : NULL;
+}
+
+/*
+ * the line shown after line, which is numbered *line_no, passing the rest
+ * of a closed fold in one step. returns NULL at the end of the text,
+ * leaving *line_no as it was
+ */
+static struct Text *line_below(
     struct Cursor *cur,
-    enum Mode mode
+    struct Text *line,
+    size_t *line_no
 ) {
-    struct Text *line;
-    size_t i;
-    size_t screen_pos;
-    char msg[80] = {0};
-    char *str = NULL;
-    memset(msg, ' ', 79);
-    wclear(win->curses_win);
-    for (i = 0, line = cur->top_of_screen; line; line = line->next, i++) {
-        if (!line || !line->data) {
-            break;
-        }
+    struct Fold *fold = folded(cur, *line_no);
+    size_t no = *line_no;
 
-        wmove(win->curses_win, i, 0);
-        str = line->data;
-        while (*str++) {
-            if (*str == '\r') {
-                *str = '\n';
-                str++;
-                *str = '\0';
-            }
-        }
-        cur->line->len = strlen(line->data);
-        waddstr(win->curses_win, line->data);
+    if (fold) {
+        line = fold_last(fold, line, no);
+        no = fold->last_no;
+    }
+    if (!line->next) {
+        return NULL;
+    }
+    *line_no = no + 1;
+    return line->next;
+}
 
-        if (i >= (win->maxlines - 2)) {
-            break;
-        }
+/* the line shown before line, the first line of a closed fold for a fold */
+static struct Text *line_above(
+    struct Cursor *cur,
+    struct Text *line,
+    size_t *line_no
+) {
+    struct Fold *fold = folded(cur, *line_no);
+    size_t no = *line_no;
+
+    if (fold) {
+        line = fold_first(fold, line, no);
+        no = fold->first_no;
+    }
+    if (!line->prev) {
+        return NULL;
     }
+    line = line->prev;
+    no--;
+    if ((fold = folded(cur, no))) {
+        line = fold_first(fold, line, no);
+        no = fold->first_no;
+    }
+    *line_no = no;
+    return line;
+}
 
-    /* draw '~' when no lines exist at end of file */
-    if (!line) {
-        for (; i < (win->maxlines - 1); i++) {
-            waddstr(win->curses_win, "~\n");
-        }
+/*
+ * how many lines are shown from top, numbered top_no, until the line
+ * numbered line_no below it, with a closed fold counted as one. counting
+ * stops at limit
+ */
+static size_t lines_shown(
+    struct Cursor *cur,
+    struct Text *top,
+    size_t top_no,
+    size_t line_no,
+    size_t limit
+) {
+    size_t shown;
+
+    if (!folds_shown(cur)) {
+        return line_no - top_no;
     }
+    for (shown = 0; top && top_no < line_no && shown < limit; shown++) {
+        top = line_below(cur, top, &top_no);
+    }
+    return shown;
+}
 
-    switch (mode) {
-        case INSERT:
-            wmove(win->curses_win, win->maxlines - 1, 0);
-            waddstr(win->curses_win, msg);
-            wmove(win->curses_win, win->maxlines - 1, 0);
-            waddstr(win->curses_win, "-- INSERT --");
-            break;
+/*
+ * puts the top of the screen rows lines shown above the cursor, or at the
+ * top of the text if there are fewer
+ */
+static void cursor_place(struct Cursor *cur, size_t rows) {
+    struct Text *top = cur->line;
+    struct Text *above;
+    size_t top_no = cur->line_no;
 
-        case EX:
-        case QUIT:
-        case NORMAL:
-        case SEARCH:
-        default:
-            break;
+    for (; rows > 0 && (above = line_above(cur, top, &top_no)); rows--) {
+        top = above;
     }
+    cur->top_of_screen = top;
+    cur->y = cur->line_no - top_no;
+}
 
-    wmove(win->curses_win, win->maxlines - 1, 55);
-    sprintf(msg, "%lu - %lu", cur->x + 1, cur->line_no);
-    waddstr(win->curses_win, msg);
-    /* count tabs to the left of the cursor, and add 8 spaces per tab */
-    screen_pos = 0;
-    for (i = 0; i <= cur->x; i++) {
-        if (cur->line && cur->line->data) {
-            if (cur->line->data[i] == '\t') {
-                screen_pos += 8;
-            } else {
-                screen_pos++;
-            }
-        }
+/*
+ * how many lines of text the count lines shown from the cursor on take up,
+ * as dd and yy see them
+ */
+static size_t lines_held(struct Cursor *cur, size_t count) {
+    struct Text *line = cur->line;
+    struct Fold *fold;
+    size_t line_no = cur->line_no;
+
+    if (!folds_shown(cur)) {
+        return count;
+    }
+    for (; count > 1 && line; count--) {
+        line = line_below(cur, line, &line_no);
+    }
+    if ((fold = folded(cur, line_no))) {
+        line_no = fold->last_no;
     }
+    return line_no - cur->line_no + 1;
+}
 
-    wmove(win->curses_win, win->maxlines - 1, 0);
-    waddstr(win->curses_win, cur->buf);
-    wmove(win->curses_win, win->maxlines - 1, 0);
+/* moves down up to n lines and returns how many it moved */
+static size_t cursor_down(struct Window *win, struct Cursor *cur, size_t n) {
+    size_t moved = 0;
+    size_t bottom = win->maxlines - 2;
+    size_t top_no = cur->line_no - cur->y;
+    size_t line_no = cur->line_no;
+    struct Text *from = cur->line;
+    struct Text *next;
 
-    wmove(win->curses_win, cur->y, screen_pos - 1);
-    wrefresh(win->curses_win);
+    for (; moved < n && (next = line_below(cur, cur->line, &line_no));
+        moved++
+    ) {
+        cur->line = next;
+    }
+    if (moved == 0) {
+        return 0;
+    }
+
+    cur->line_no = line_no;
+    cursor_keep_column(cur, from);
+
+    if (lines_shown(cur, cur->top_of_screen, top_no, line_no, bottom + 1) <=
+        bottom
+    ) {
+        cur->y = line_no - top_no;
+    } else {
+        /*
+         * walk back from the cursor to find the new top of the screen
+         * instead of stepping it forward over every line that scrolled by
+         */
+        cursor_place(cur, bottom);
+    }
+    return moved;
 }
 
-static enum Todo handle_normal_mode(
+static size_t cursor_up(struct Window *win, struct Cursor *cur, size_t n) {
+    size_t moved = 0;
+    size_t top_no = cur->line_no - cur->y;
+    size_t line_no = cur->line_no;
+    struct Text *from = cur->line;
+    struct Text *prev;
+    UNUSED(win);
+
+    for (; moved < n && (prev = line_above(cur, cur->line, &line_no));
+        moved++
+    ) {
+        cur->line = prev;
+    }
+    if (moved == 0) {
+        return 0;
+    }
+
+    cur->line_no = line_no;
+    cursor_keep_column(cur, from);
+
+    if (line_no >= top_no) {
+        cur->y = line_no - top_no;
+    } else {
+        cur->y = 0;
+        cur->top_of_screen = cur->line;
+    }
+    return moved;
+}
+
+/*
+ * moves the cursor to a line whose number is already known, such as where
+ * an undo left the text, keeping it on the same screen row where it can
+ */
+static void cursor_restore(
     struct Window *win,
     struct Cursor *cur,
-    enum Mode *mode,
-    int c,
-    struct Command *cmd
-);
+    struct Text *line,
+    size_t line_no,
+    size_t x
+) {
+    size_t y = MIN(cur->y, win->maxlines - 2);
 
-static enum Todo handle_ex_mode(
+    cur->line = line;
+    cur->line_no = line_no;
+    cur->x = MIN(x, last_col(line));
+    cur->old_x = text_column(line, cur->x);
+
+    /* the old top of the screen may have been taken out of the text */
+    cursor_place(cur, y);
+}
+
+/*
+ * moves the cursor to line, numbered line_no, which was found some other
+ * way than walking to it. the screen scrolls as little as it would have
+ */
+static void cursor_jump(
     struct Window *win,
     struct Cursor *cur,
-    enum Mode *mode,
-    char *filename,
-    int c
+    struct Text *line,
+    size_t line_no,
+    size_t x
 ) {
-    char buf[80] = {0};
-    size_t buf_index = 0;
-    size_t new_l = 0;
-    size_t i;
-    size_t difference;
-    char *p;
-    int do_write = 0;
+    size_t bottom = win->maxlines - 2;
+    size_t top_no = cur->line_no - cur->y;
+    int on_screen = line_no >= top_no && lines_shown(cur,
+        cur->top_of_screen, top_no, line_no, bottom + 1) <= bottom;
 
-    do {
-        cur->buf[cur->buf_idx++] = c;
-        redraw_screen(win, cur, *mode);
-        wputchar(win, cur, c);
-        switch (c) {
-            case 27: /* escape key */
-                *mode = NORMAL;
-                wmove(win->curses_win, win->maxlines - 1, 0);
-                waddstr(win->curses_win, blank);
-                cur->x = cur->old_x;
-                cur->y = cur->old_y;
-                cur->buf[cur->buf_idx] = '0';
-                cur->buf_idx = 0;
-                memset(cur->buf, 0, 80);
-                goto leave_ex;
+    cur->line = line;
+    cur->line_no = line_no;
+    cur->x = x;
+    cur->old_x = text_column(line, x);
 
-            case '\n':
-                if (*mode == QUIT) {
-                    goto leave_ex;
-                }
-                new_l = strtol(buf, &p, 10);
-                if (*p == 0) {
-                    if (new_l > cur->line_no) {
-                        difference = new_l - cur->line_no;
-                        for (i = 0; i < difference; i++) {
-                            handle_normal_mode(win, cur, mode, 'j', NULL);
-                        }
-                        handle_normal_mode(win, cur, mode, '0', NULL);
-
-                    } else if (new_l == cur->line_no) {
-                        /* do nothing */
-                    } else {
-                        /* no idea why this isn't working. disabling for now
-                        difference = cur->line_no - new_l;
-                        for (i = 0; i < difference; i++) {
-                            handle_normal_mode(win, cur, mode, 'k', NULL);
-                        }
-                        handle_normal_mode(win, cur, mode, '0', NULL);
-                        */
-                    }
+    if (on_screen) {
+        cur->y = line_no - top_no;
+    } else if (line_no > top_no) {
+        cursor_place(cur, bottom);
+    } else {
+        cur->top_of_screen = line;
+        cur->y = 0;
+    }
+}
 
-                }
-                *mode = NORMAL;
-                wmove(win->curses_win, win->maxlines - 1, 0);
-                waddstr(win->curses_win, blank);
-                cur->x = cur->old_x;
-                cur->y = cur->old_y;
+/*
+ * moves the cursor to the start of the line numbered line_no, or of the
+ * last line, passing closed folds on the way in one step
+ */
+static void cursor_goto_line(
+    struct Window *win,
+    struct Cursor *cur,
+    size_t line_no
+) {
+    struct Text *line = cur->line;
+    struct Text *next;
+    size_t no = cur->line_no;
+    size_t next_no;
 
-                cur->buf[cur->buf_idx] = '0';
-                cur->buf_idx = 0;
-                memset(cur->buf, 0, 80);
-                goto leave_ex;
+    line_no = MAX(line_no, 1);
+    while (no > line_no && (next = line_above(cur, line, &no))) {
+        line = next;
+    }
+    next_no = no;
+    while (no < line_no && (next = line_below(cur, line, &next_no)) &&
+        next_no <= line_no
+    ) {
+        line = next;
+        no = next_no;
+    }
+    /* the rest of the way is inside a fold */
+    for (; no < line_no && line->next; no++) {
+        line = line->next;
+    }
+    cursor_jump(win, cur, line, no, 0);
+}
 
-            case 'q':
-                *mode = QUIT;
-                break;
+/*
+ * a cursor put inside a closed fold other than by moving over lines, as by
+ * a search or a new fold, goes to the line the fold is shown on, and so
+ * does the top of the screen
+ */
+static void fold_settle(struct Window *win, struct Cursor *cur) {
+    size_t top_no = cur->line_no - cur->y;
+    struct Fold *fold = folded(cur, top_no);
 
-            case 'w':
-                /* write out */
-                do_write = 1;
-                break;
+    if (fold && fold->first_no < top_no) {
+        cur->top_of_screen = fold_first(fold, cur->top_of_screen, top_no);
+        cur->y += top_no - fold->first_no;
+    }
+    fold = folded(cur, cur->line_no);
+    if (fold && fold->first_no < cur->line_no) {
+        cursor_jump(win, cur, fold_first(fold, cur->line, cur->line_no),
+            fold->first_no, 0);
+    }
+}
 
-            default:
-                buf[buf_index++] = c;
-                break;
+/* reads the key after an operator, folding a count such as d3d into count */
+static int read_operator_key(
+    struct Window *win,
+    struct Cursor *cur,
+    size_t *count
+) {
+    struct Command motion;
+    int c;
+
+    command_clear(&motion);
+    while (command_is_count(&motion, c = next_key(win, cur))) {
+        command_add_char(&motion, c);
+    }
+    if (motion.len > 0) {
+        *count *= command_count(&motion);
+    }
+    return c;
+}
+
+/* one past the end of the characters covered by count words, as dw sees it */
+static size_t word_end(struct Text *line, size_t x, size_t count) {
+    char *data;
+    text_thaw(line);
+    data = line->data;
+    for (; count && data[x] != '\n' && data[x] != '\0'; count--) {
+        x++;
+        if (data[x] == ' ' || data[x] == '\t') {
+            while (data[x] == ' ' || data[x] == '\t') {
+                x++;
+            }
+        } else {
+            while (isalnum((unsigned char)data[x]) || data[x] == '_') {
+                x++;
+            }
+        }
+    }
+    return x;
+}
+
+/* cuts from the cursor up to end into a register */
+static void delete_chars(struct Cursor *cur, int reg, size_t end) {
+    if (cur->x >= end) {
+        return;
+    }
+    change_begin(cur, 1);
+    register_delete(
+        &cur->registers,
+        reg,
+        text_cut_chars(cur->line, cur->x, end - cur->x),
+        1
+    );
+    change_end(cur, 1);
+    cur->x = MIN(cur->x, last_col(cur->line));
+}
+
+/* moves count lines starting at the cursor into a register */
+static void delete_lines(struct Cursor *cur, int reg, size_t count) {
+    struct Text *first = cur->line;
+    struct Text *prev = first->prev;
+    struct Text *next;
+
+    change_begin(cur, lines_from(first, count));
+    next = text_cut_lines(first, count);
+    register_delete(&cur->registers, reg, first, 0);
+
+    if (!prev && !next) {
+        next = text_make_line();
+        change_end(cur, 1);
+    } else {
+        change_end(cur, 0);
+    }
+
+    if (cur->top_of_text == first) {
+        cur->top_of_text = next;
+    }
+
+    if (next) {
+        cur->line = next;
+        if (cur->top_of_screen == first) {
+            cur->top_of_screen = next;
         }
-    } while ((c = wgetch(win->curses_win)));
-leave_ex:
-    if (do_write) {
-        char msg[1024];
-        if (filename != NULL) {
-            text_write(cur->top_of_text, filename);
-            sprintf(msg, "wrote file: '%s'", filename);
-            FLASH_MSG(msg);
+    } else {
+        cur->line = prev;
+        cur->line_no--;
+        if (cur->y > 0) {
+            cur->y--;
         } else {
-            FLASH_MSG("no file open");
+            cur->top_of_screen = prev;
         }
-        wgetch(win->curses_win);
     }
-    if (*mode == QUIT) {
-        return TERMINATE;
+    text_thaw(cur->line);
+    cur->line->len = strlen(cur->line->data);
+    cur->x = MIN(cur->x, last_col(cur->line));
+}
+
+/* puts count copies of text that spans several lines after the cursor */
+static void put_span(struct Cursor *cur, struct Text *clip, size_t count) {
+    struct Text *line = cur->line;
+    struct Text *rest;
+    size_t index = 0;
+
+    if (line_end(line) > 0) {
+        index = cur->x + 1;
+    }
+    change_begin(cur, 1);
+    rest = text_cut_chars(line, index, TEXT_ALL_LINES);
+    text_thaw(clip);
+    for (; count; count--) {
+        text_insert_chars(line, TEXT_ALL_LINES, clip->data, strlen(clip->data));
+        line = text_splice_lines(
+            line,
+            text_copy_lines(clip->next, TEXT_ALL_LINES)
+        );
     }
+    text_insert_chars(line, TEXT_ALL_LINES, rest->data, rest->len);
+    text_free_lines(rest);
+    change_end(cur, 1 + (text_total_lines(clip) - 1) * count);
+    cur->x = index;
+}
 
-    return GET_CHAR;
+/* puts count copies of a charwise register after the cursor */
+static void put_chars(struct Cursor *cur, struct Text *clip, size_t count) {
+    size_t index = 0;
+    size_t n;
+    char *chars;
+
+    if (clip->next) {
+        put_span(cur, clip, count);
+        return;
+    }
+    if ((clip->len == 0) || (count > ((size_t)-1) / clip->len)) {
+        return;
+    }
+    n = clip->len * count;
+    chars = malloc(n);
+    text_thaw(clip);
+    for (; count; count--) {
+        memcpy(chars + ((count - 1) * clip->len), clip->data, clip->len);
+    }
+    if (line_end(cur->line) > 0) {
+        index = cur->x + 1;
+    }
+    change_begin(cur, 1);
+    text_insert_chars(cur->line, index, chars, n);
+    change_end(cur, 1);
+    cur->x = index + n - 1;
+    free(chars);
+}
+
+/*
+ * puts count copies of a register below the cursor in one splice. the copies
+ * share their bytes with the register, so only the list nodes are new
+ */
+static void put_lines(struct Cursor *cur, int name, size_t count) {
+    struct Register *reg = register_get(&cur->registers, name);
+    struct Text *list;
+    struct Text *tail;
+    size_t n;
+
+    if (!reg->text) {
+        return;
+    }
+    if (reg->charwise) {
+        put_chars(cur, reg->text, count);
+        return;
+    }
+    list = text_copy_lines(reg->text, TEXT_ALL_LINES);
+    for (tail = list; tail->next; tail = tail->next) {
+    }
+    n = text_total_lines(list) * count;
+    while (--count) {
+        tail = text_splice_lines(
+            tail,
+            text_copy_lines(reg->text, TEXT_ALL_LINES)
+        );
+    }
+    undo_begin(&cur->history, NULL, cur->line_no + 1, 0, cur->x);
+    text_splice_lines(cur->line, list);
+    change_end(cur, n);
+}
+
+/* the visual selection, ordered from top to bottom */
+struct Selection {
+    struct Text *first;
+    struct Text *last;
+    size_t first_no;
+    size_t last_no;
+    size_t start;
+    size_t end;
+};
+
+static int is_visual(enum Mode mode) {
+    return (mode == VISUAL) || (mode == VISUAL_LINE);
 }
 
-static void handle_insert_mode(
-    struct Window *win,
-    struct Cursor *cur,
-    enum Mode *mode,
-    int c
-) {
-    switch (c) {
-        case 27: /* escape key */
-            *mode = NORMAL;
-            if (cur->x > 0) {
-                cur->x--;
+static void get_selection(
+    struct Cursor *cur,
+    enum Mode mode,
+    struct Selection *sel
+) {
+    struct Fold *fold;
+    size_t last_x;
+    if ((cur->visual_line_no < cur->line_no) ||
+        ((cur->visual_line_no == cur->line_no) && (cur->visual_x < cur->x))
+    ) {
+        sel->first = cur->visual_line;
+        sel->first_no = cur->visual_line_no;
+        sel->start = cur->visual_x;
+        sel->last = cur->line;
+        sel->last_no = cur->line_no;
+        last_x = cur->x;
+    } else {
+        sel->first = cur->line;
+        sel->first_no = cur->line_no;
+        sel->start = cur->x;
+        sel->last = cur->visual_line;
+        sel->last_no = cur->visual_line_no;
+        last_x = cur->visual_x;
+    }
+
+    /* a closed fold at either end is taken whole */
+    if ((fold = folded(cur, sel->first_no))) {
+        sel->first = fold_first(fold, sel->first, sel->first_no);
+        sel->first_no = fold->first_no;
+        sel->start = 0;
+    }
+    if ((fold = folded(cur, sel->last_no))) {
+        sel->last = fold_last(fold, sel->last, sel->last_no);
+        sel->last_no = fold->last_no;
+        last_x = line_end(sel->last);
+    }
+
+    if (mode == VISUAL_LINE) {
+        sel->start = 0;
+        sel->end = line_end(sel->last);
+    } else {
+        sel->start = MIN(sel->start, line_end(sel->first));
+        sel->end = MIN(text_next_char(sel->last, last_x), line_end(sel->last));
+    }
+}
+
+/* columns of the line at line_no covered by the selection */
+static void selected_columns(
+    struct Selection *sel,
+    struct Text *line,
+    size_t line_no,
+    size_t *start,
+    size_t *end
+) {
+    *start = 0;
+    *end = 0;
+    if (!sel || (line_no < sel->first_no) || (line_no > sel->last_no)) {
+        return;
+    }
+    *end = (line_no == sel->last_no) ? sel->end : line_end(line);
+    if (line_no == sel->first_no) {
+        *start = sel->start;
+    }
+}
+
+/*
+ * gives each kind of token a colour, using the terminal's own background, or
+ * bold or dim text where there are no colours
+ */
+static void init_colors(void) {
+    static const struct {
+        int kind;
+        short color;
+        attr_t mono;
+    } styles[] = {
+        {KIND_COMMENT, COLOR_BLUE, A_DIM},
+        {KIND_STRING, COLOR_RED, 0},
+        {KIND_NUMBER, COLOR_MAGENTA, 0},
+        {KIND_KEYWORD, COLOR_YELLOW, A_BOLD},
+        {KIND_TYPE, COLOR_GREEN, A_BOLD},
+        {KIND_PREPROC, COLOR_MAGENTA, A_BOLD},
+        {KIND_KEY, COLOR_CYAN, A_BOLD},
+        {KIND_VARIABLE, COLOR_CYAN, 0}
+    };
+    short background = COLOR_BLACK;
+    int colors = has_colors() && (start_color() == OK);
+    size_t i;
+
+    if (colors && (use_default_colors() == OK)) {
+        background = -1;
+    }
+    for (i = 0; i < sizeof(styles) / sizeof(styles[0]); i++) {
+        if (colors && (init_pair((short)(i + 1), styles[i].color,
+            background) == OK)
+        ) {
+            kind_attrs[styles[i].kind] = COLOR_PAIR(i + 1);
+        } else {
+            kind_attrs[styles[i].kind] = styles[i].mono;
+        }
+    }
+}
+
+/* adds n spaces to the window, reversed if selected */
+static void draw_spaces(struct Window *win, size_t n, int selected) {
+    if (selected) {
+        wattron(win->curses_win, A_REVERSE);
+    }
+    for (; n; n--) {
+        waddch(win->curses_win, ' ');
+    }
+    if (selected) {
+        wattroff(win->curses_win, A_REVERSE);
+    }
+}
+
+/*
+ * adds the bytes from, to of a line to the window. tabs are drawn as spaces,
+ * since curses would line them up with the edge of the window rather than
+ * the start of the line, and carriage returns and backspaces, which curses
+ * would act on, as ^M and ^H
+ */
+static void draw_bytes(
+    struct Window *win,
+    struct Text *line,
+    size_t from,
+    size_t to,
+    attr_t attrs
+) {
+    const char *chars = line->data;
+    size_t run;
+
+    if (from >= to) {
+        return;
+    }
+    wattron(win->curses_win, attrs);
+    while (from < to) {
+        for (run = from; run < to && chars[run] != '\t' &&
+            chars[run] != '\r' && chars[run] != '\b'; run++
+        ) {
+        }
+        if (run > from) {
+            waddnstr(win->curses_win, chars + from, (int)(run - from));
+        }
+        if (run < to) {
+            if (chars[run] == '\t') {
+                draw_spaces(win,
+                    text_column(line, run + 1) - text_column(line, run), 0);
+            } else {
+                waddstr(win->curses_win, unctrl((chtype)chars[run]));
+            }
+            run++;
+        }
+        from = run;
+    }
+    wattroff(win->curses_win, attrs);
+}
+
+/*
+ * adds the bytes from, to of a line to the window, each drawn as the kind of
+ * token it is part of
+ */
+static void draw_tokens(
+    struct Window *win,
+    struct Text *line,
+    size_t from,
+    size_t to,
+    attr_t attrs
+) {
+    const struct Highlight *highlight = line->highlight;
+    const struct Token *token;
+    size_t lo = 0;
+    size_t hi;
+    size_t mid;
+    size_t end;
+
+    if (!highlight) {
+        draw_bytes(win, line, from, to, attrs);
+        return;
+    }
+    /* the first token that ends after from */
+    hi = highlight->n;
+    while (lo < hi) {
+        mid = lo + (hi - lo) / 2;
+        if (highlight->tokens[mid].end <= from) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    for (; lo < highlight->n && highlight->tokens[lo].start < to; lo++) {
+        token = &highlight->tokens[lo];
+        if (token->start > from) {
+            draw_bytes(win, line, from, token->start, attrs);
+            from = token->start;
+        }
+        end = MIN(token->end, to);
+        draw_bytes(win, line, from, end, attrs | kind_attrs[token->kind]);
+        from = end;
+    }
+    draw_bytes(win, line, from, to, attrs);
+}
+
+/*
+ * draws the screen columns from, to of a line with the bytes start, end of
+ * it selected. only the bytes in those columns are looked at, and the part
+ * of a tab or wide character cut by either edge is drawn as spaces
+ */
+static void draw_span(
+    struct Window *win,
+    struct Text *line,
+    size_t from,
+    size_t to,
+    size_t start,
+    size_t end
+) {
+    size_t i = text_column_index(line, from);
+    size_t stop = text_column_index(line, to);
+    size_t next;
+    size_t first;
+    size_t last;
+
+    if (i < stop && text_column(line, i) < from) {
+        next = text_next_char(line, i);
+        draw_spaces(win, text_column(line, next) - from,
+            (i >= start) && (i < end));
+        i = next;
+    }
+    if (i < stop) {
+        if (start < end) {
+            first = MIN(MAX(start, i), stop);
+            last = MIN(MAX(end, i), stop);
+            draw_tokens(win, line, i, first, 0);
+            draw_tokens(win, line, first, last, A_REVERSE);
+            draw_tokens(win, line, last, stop, 0);
+        } else {
+            draw_tokens(win, line, i, stop, 0);
+        }
+    }
+    if (stop < line_end(line) && text_column(line, stop) < to &&
+        text_column(line, stop) >= from
+    ) {
+        draw_spaces(win, to - text_column(line, stop),
+            (stop >= start) && (stop < end));
+    }
+}
+
+/* indents n lines by a tab, or takes one level of indent away */
+static void shift_lines(struct Text *line, size_t n, int right) {
+    size_t spaces;
+    for (; line && n; line = line->next, n--) {
+        text_thaw(line);
+        if (right) {
+            if (line_end(line) > 0) {
+                text_insert_chars(line, 0, "\t", 1);
+            }
+        } else if (line->data[0] == '\t') {
+            text_delete_chars(line, 0, 1);
+        } else {
+            for (spaces = 0; spaces < 8 && line->data[spaces] == ' '; spaces++) {
+            }
+            text_delete_chars(line, 0, spaces);
+        }
+    }
+}
+
+/* toggles (~), lowers (u) or raises (U) the case of the columns from, to */
+static void change_case(struct Text *line, size_t from, size_t to, int how) {
+    unsigned char *c;
+    text_unshare(line);
+    for (c = (unsigned char *)line->data + from; from < to && *c; c++, from++) {
+        if ((how == 'u') || ((how == '~') && isupper(*c))) {
+            *c = tolower(*c);
+        } else {
+            *c = toupper(*c);
+        }
+    }
+}
+
+/* applies an operator to the whole selection at once */
+static void visual_operate(
+    struct Window *win,
+    struct Cursor *cur,
+    enum Mode mode,
+    struct Selection *sel,
+    int op,
+    int reg
+) {
+    size_t n = sel->last_no - sel->first_no + 1;
+    size_t start;
+    size_t end;
+    size_t line_no;
+    struct Text *line;
+
+    cursor_goto_line(win, cur, sel->first_no);
+    cur->x = sel->start;
+
+    switch (op) {
+        case 'd':
+        case 'x':
+            if (mode == VISUAL_LINE) {
+                delete_lines(cur, reg, n);
+            } else {
+                change_begin(cur, n);
+                register_delete(
+                    &cur->registers,
+                    reg,
+                    text_cut_span(sel->first, sel->start, sel->last, sel->end),
+                    1
+                );
+                change_end(cur, 1);
+                cur->x = MIN(cur->x, last_col(cur->line));
+            }
+            break;
+
+        case 'y':
+            if (mode == VISUAL_LINE) {
+                register_yank(
+                    &cur->registers,
+                    reg,
+                    text_copy_lines(sel->first, n),
+                    0
+                );
+            } else {
+                register_yank(
+                    &cur->registers,
+                    reg,
+                    text_copy_span(sel->first, sel->start, sel->last, sel->end),
+                    1
+                );
+            }
+            break;
+
+        case '>':
+        case '<':
+            change_begin(cur, n);
+            shift_lines(sel->first, n, op == '>');
+            change_end(cur, n);
+            cur->x = 0;
+            break;
+
+        default:
+            change_begin(cur, n);
+            line = sel->first;
+            for (line_no = sel->first_no; line_no <= sel->last_no; line_no++) {
+                selected_columns(sel, line, line_no, &start, &end);
+                change_case(line, start, end, op);
+                line = line->next;
+            }
+            change_end(cur, n);
+            break;
+    }
+}
+
+/*
+ * draws the row a closed fold is shown on: how many lines it hides and its
+ * first line from its first character that is not a space, filled out to
+ * the edge of the window with dashes
+ */
+static void draw_fold(
+    struct Window *win,
+    struct Fold *fold,
+    struct Text *line,
+    int selected
+) {
+    attr_t attrs = selected ? A_REVERSE : A_BOLD;
+    char head[40];
+    size_t width;
+    size_t from = 0;
+    size_t to;
+
+    sprintf(head, "+--%4lu lines: ", fold->last_no - fold->first_no + 1);
+    width = MIN(strlen(head), win->maxcols);
+    text_thaw(line);
+    while (from < line->len && isspace((unsigned char)line->data[from])) {
+        from++;
+    }
+    to = text_column_index(line,
+        text_column(line, from) + win->maxcols - width);
+    to = MIN(to, line_end(line));
+    from = MIN(from, to);
+
+    wattron(win->curses_win, attrs);
+    waddnstr(win->curses_win, head, (int)width);
+    wattroff(win->curses_win, attrs);
+    draw_bytes(win, line, from, to, attrs);
+    width += text_column(line, to) - text_column(line, from);
+    wattron(win->curses_win, attrs);
+    for (; width < win->maxcols; width++) {
+        waddch(win->curses_win, '-');
+    }
+    wattroff(win->curses_win, attrs);
+}
+
+/*
+ * draws the text rows of a window, starting with the line top which is
+ * numbered top_no. a line takes one row, showing the columns from left on,
+ * or as many rows as it wraps to, the first skip of which are scrolled off
+ * the top when it is the skip_line. rows are only drawn again when the text
+ * was changed or when they show a different line, part of a line or part
+ * of the selection than last time, so moving around in visual mode repaints
+ * just the rows the selection moved over. a closed fold takes one row
+ */
+static void draw_rows(
+    struct Window *win,
+    struct Text *top,
+    size_t top_no,
+    struct Selection *sel,
+    struct Syntax *syntax,
+    struct Folds *folds
+) {
+    struct Text *line = top;
+    struct Fold *fold;
+    struct Row *row;
+    size_t i = 0;
+    size_t line_no = top_no;
+    size_t part = (top == win->skip_line) ? win->skip : 0;
+    size_t parts;
+    size_t from;
+    size_t to;
+    size_t start;
+    size_t end;
+
+    if (win->nrows != win->maxlines) {
+        free(win->rows);
+        win->rows = calloc(win->maxlines, sizeof(struct Row));
+        win->nrows = win->maxlines;
+        win->damaged = 1;
+    }
+    if (win->damaged) {
+        werase(win->curses_win);
+    }
+    syntax_update(syntax, top, top_no, win->maxlines - 1);
+
+    for (; line && i < win->maxlines - 1; line = line->next, part = 0) {
+        fold = folds ? fold_at(folds, line_no) : NULL;
+        if (fold) {
+            selected_columns(sel, line, line_no, &start, &end);
+            row = &win->rows[i++];
+            if (win->damaged || row->stale || (row->line != line) ||
+                (row->part != FOLD_ROW) || (row->sel_start != start) ||
+                (row->sel_end != end)
+            ) {
+                row->line = line;
+                row->part = FOLD_ROW;
+                row->sel_start = start;
+                row->sel_end = end;
+                row->stale = 0;
+                wmove(win->curses_win, i - 1, 0);
+                wclrtoeol(win->curses_win);
+                draw_fold(win, fold, line, start < end);
+            }
+            line = fold_last(fold, line, line_no);
+            line_no = fold->last_no + 1;
+            if (line->next) {
+                syntax_update(syntax, line->next, line_no,
+                    win->maxlines - 1 - i);
+            }
+            continue;
+        }
+        text_thaw(line);
+        selected_columns(sel, line, line_no++, &start, &end);
+        parts = win->wrap ? text_rows(line, win->maxcols) : 1;
+        /* the line may have got shorter since it was scrolled */
+        part = MIN(part, parts - 1);
+        for (; part < parts && i < win->maxlines - 1; part++, i++) {
+            if (win->wrap) {
+                from = text_row_column(line, win->maxcols, part);
+                to = text_row_column(line, win->maxcols, part + 1);
+                to = (part + 1 < parts) ? to : from + win->maxcols;
+            } else {
+                from = win->left;
+                to = win->left + win->maxcols;
+            }
+            row = &win->rows[i];
+            if (win->damaged || row->stale || (row->line != line) ||
+                (row->part != part) ||
+                (row->sel_start != start) || (row->sel_end != end)
+            ) {
+                row->line = line;
+                row->part = part;
+                row->sel_start = start;
+                row->sel_end = end;
+                row->stale = 0;
+                wmove(win->curses_win, i, 0);
+                wclrtoeol(win->curses_win);
+                draw_span(win, line, from, to, start, end);
+            }
+        }
+    }
+
+    /* draw '~' when no lines exist at end of file */
+    for (; i < (win->maxlines - 1); i++) {
+        row = &win->rows[i];
+        if (win->damaged || row->stale || row->line) {
+            row->line = NULL;
+            row->stale = 0;
+            wmove(win->curses_win, i, 0);
+            wclrtoeol(win->curses_win);
+            waddstr(win->curses_win, "~");
+        }
+    }
+    win->damaged = 0;
+}
+
+/*
+ * the line numbered *line_no, or the last line if the text has got shorter
+ * than that, with *line_no set to match
+ */
+static struct Text *line_or_last(struct Cursor *cur, size_t *line_no) {
+    struct Text *line = line_at(cur, *line_no);
+
+    if (!line) {
+        line = cur->line;
+        *line_no = cur->line_no;
+        for (; line->next; line = line->next) {
+            (*line_no)++;
+        }
+    }
+    return line;
+}
+
+/* draws a window other than the one in use, with its name on its status line */
+static void redraw_window(struct Window *win, struct Cursor *cur) {
+    const char *filename = cur->buffers.list[cur->buffers.current].filename;
+    int damaged = win->damaged;
+
+    if (!win->top) {
+        win->top = line_or_last(cur, &win->top_no);
+        win->skip = 0;
+    }
+    draw_rows(win, win->top, win->top_no, NULL,
+        &cur->buffers.list[cur->buffers.current].syntax, folds_shown(cur));
+    if (damaged) {
+        wmove(win->curses_win, win->maxlines - 1, 0);
+        wclrtoeol(win->curses_win);
+        wattron(win->curses_win, A_REVERSE);
+        waddnstr(win->curses_win, filename ? filename : "[No Name]",
+            (int)win->maxcols);
+        wattroff(win->curses_win, A_REVERSE);
+    }
+    wnoutrefresh(win->curses_win);
+}
+
+/* the screen column of the cursor, which sits on the last cell of a tab */
+static size_t cursor_column(struct Cursor *cur) {
+    text_thaw(cur->line);
+    if (cur->line->data[MIN(cur->x, cur->line->len)] == '\t') {
+        return text_column(cur->line, cur->x + 1) - 1;
+    }
+    return text_column(cur->line, cur->x);
+}
+
+/*
+ * how many rows the line numbered line_no takes on a window wrapped at
+ * width, which is one for a closed fold
+ */
+static size_t line_rows(
+    struct Cursor *cur,
+    struct Text *line,
+    size_t line_no,
+    size_t width
+) {
+    return folded(cur, line_no) ? 1 : text_rows(line, width);
+}
+
+/*
+ * scrolls the window in use until the cursor is on it: sideways when lines
+ * are cut off, or down by rows, which may stop part way through a line, when
+ * they wrap. sets *y and *x to where the cursor is on the window
+ */
+static void window_scroll(
+    struct Window *win,
+    struct Cursor *cur,
+    size_t *y,
+    size_t *x
+) {
+    size_t column = cursor_column(cur);
+    size_t width = win->maxcols;
+    size_t bottom = win->maxlines - 2;
+    size_t top_no = cur->line_no - cur->y;
+    size_t line_no;
+    size_t after;
+    size_t part;
+    size_t shown;
+    struct Text *line;
+    int on_fold = folded(cur, cur->line_no) != NULL;
+
+    if (!win->wrap) {
+        /* keep all of a wide character on the screen */
+        after = text_column(cur->line, text_next_char(cur->line, cur->x));
+        after = (after > column + 1) ? after - 1 : column;
+        if (text_column(cur->line, cur->x) < win->left) {
+            win->left = text_column(cur->line, cur->x);
+            win->damaged = 1;
+        } else if (after >= win->left + width) {
+            win->left = after - width + 1;
+            win->damaged = 1;
+        }
+        *y = lines_shown(cur, cur->top_of_screen, top_no, cur->line_no,
+            bottom + 1);
+        if (*y > bottom) {
+            cursor_place(cur, bottom);
+            *y = lines_shown(cur, cur->top_of_screen,
+                cur->line_no - cur->y, cur->line_no, bottom + 1);
+            win->damaged = 1;
+        }
+        *x = on_fold ? 0 : column - win->left;
+        return;
+    }
+
+    if (win->skip_line != cur->top_of_screen) {
+        win->skip_line = cur->top_of_screen;
+        win->skip = 0;
+    }
+    win->skip = MIN(win->skip,
+        line_rows(cur, cur->top_of_screen, top_no, width) - 1);
+    part = on_fold ? 0 : text_column_row(cur->line, width, column);
+    if (cur->line == cur->top_of_screen && part < win->skip) {
+        win->skip = part;
+        win->damaged = 1;
+    }
+
+    *y = part;
+    for (line = cur->top_of_screen, line_no = top_no;
+        line && line_no < cur->line_no;
+        line = line_below(cur, line, &line_no)
+    ) {
+        *y += line_rows(cur, line, line_no, width);
+    }
+    *y -= win->skip;
+
+    /* take whole lines off the top, then rows of the line left at the top */
+    while (*y > bottom) {
+        shown = line_rows(cur, cur->top_of_screen, top_no, width) - win->skip;
+        if (cur->top_of_screen != cur->line && *y - shown >= bottom) {
+            cur->top_of_screen = line_below(cur, cur->top_of_screen, &top_no);
+            cur->y = cur->line_no - top_no;
+            win->skip = 0;
+            *y -= shown;
+        } else {
+            win->skip += *y - bottom;
+            *y = bottom;
+        }
+        win->skip_line = cur->top_of_screen;
+        win->damaged = 1;
+    }
+    if (on_fold) {
+        *x = 0;
+    } else {
+        *x = MIN(column - text_row_column(cur->line, width, part), width - 1);
+    }
+}
+
+static void redraw_screen(
+    struct Window *win,
+    struct Cursor *cur,
+    enum Mode mode
+) {
+    struct Selection selection;
+    struct Selection *sel = NULL;
+    struct Split *leaf;
+    size_t y;
+    size_t x;
+    char msg[80] = {0};
+
+    /* a replaying macro only draws the screen once it has finished */
+    if (cur->macro.playing) {
+        return;
+    }
+    memset(msg, ' ', 79);
+
+    for (leaf = split_first(split_root(win->split)); leaf;
+        leaf = split_next(leaf)
+    ) {
+        if (leaf->win != win) {
+            redraw_window(leaf->win, cur);
+        }
+    }
+
+    if (is_visual(mode)) {
+        get_selection(cur, mode, &selection);
+        sel = &selection;
+    }
+    if (cur->prompt) {
+        /* the text stays as it was under a prompt, which has the cursor */
+        y = win->maxlines - 1;
+        x = cur->x;
+        draw_rows(win, cur->top_of_screen, cur->line_no - cur->old_y, sel,
+            &cur->buffers.list[cur->buffers.current].syntax,
+            folds_shown(cur));
+    } else {
+        window_scroll(win, cur, &y, &x);
+        draw_rows(win, cur->top_of_screen, cur->line_no - cur->y, sel,
+            &cur->buffers.list[cur->buffers.current].syntax,
+            folds_shown(cur));
+    }
+
+    wmove(win->curses_win, win->maxlines - 1, 0);
+    wclrtoeol(win->curses_win);
+    switch (mode) {
+        case INSERT:
+            wmove(win->curses_win, win->maxlines - 1, 0);
+            waddstr(win->curses_win, msg);
+            wmove(win->curses_win, win->maxlines - 1, 0);
+            waddstr(win->curses_win, "-- INSERT --");
+            break;
+
+        case VISUAL:
+            waddstr(win->curses_win, "-- VISUAL --");
+            break;
+
+        case VISUAL_LINE:
+            waddstr(win->curses_win, "-- VISUAL LINE --");
+            break;
+
+        case EX:
+        case QUIT:
+        case NORMAL:
+        case SEARCH:
+        default:
+            break;
+    }
+
+    if (cur->macro.recording) {
+        wmove(win->curses_win, win->maxlines - 1, 20);
+        sprintf(msg, "recording @%c", cur->macro.recording);
+        waddstr(win->curses_win, msg);
+    }
+
+    wmove(win->curses_win, win->maxlines - 1, 55);
+    sprintf(msg, "%lu - %lu", cur->x + 1, cur->line_no);
+    waddstr(win->curses_win, msg);
+
+    wmove(win->curses_win, win->maxlines - 1, 0);
+    waddstr(win->curses_win, cur->buf);
+    wmove(win->curses_win, win->maxlines - 1, 0);
+
+    wmove(win->curses_win, y, x);
+    wrefresh(win->curses_win);
+}
+
+static enum Todo handle_normal_mode(
+    struct Window *win,
+    struct Cursor *cur,
+    enum Mode *mode,
+    int c,
+    struct Command *cmd
+);
+
+/*
+ * the line numbered line_no, walking from the cursor or from the top of
+ * the text, whichever is closer. NULL past the end of the text
+ */
+static struct Text *line_at(struct Cursor *cur, size_t line_no) {
+    struct Text *line = cur->line;
+    size_t no = cur->line_no;
+
+    if (line_no == 0) {
+        return NULL;
+    }
+    if ((line_no < no) && (line_no - 1 < no - line_no)) {
+        line = cur->top_of_text;
+        no = 1;
+    }
+    for (; line && no < line_no; no++) {
+        line = line->next;
+    }
+    for (; line && no > line_no; no--) {
+        line = line->prev;
+    }
+    return line;
+}
+
+/*
+ * links a detached list of lines in below after, or above every line when
+ * after is NULL, and returns the last of them
+ */
+static struct Text *insert_lines(
+    struct Cursor *cur,
+    struct Text *after,
+    struct Text *list
+) {
+    struct Text *last;
+
+    if (after) {
+        return text_splice_lines(after, list);
+    }
+    for (last = list; last->next; last = last->next) {
+    }
+    last->next = cur->top_of_text;
+    cur->top_of_text->prev = last;
+    cur->top_of_text = list;
+    return last;
+}
+
+/*
+ * joins n lines from the cursor into one as J does, with a space where each
+ * line break was. the joined line is sized in one pass and filled in the
+ * next, so joining many lines stays linear
+ */
+static void join_lines(struct Cursor *cur, size_t n) {
+    struct Text *line;
+    size_t size = 0;
+    size_t skip;
+    size_t end;
+    size_t i;
+    char *joined;
+    char *p;
+    char *data;
+
+    n = lines_from(cur->line, n);
+    if (n < 2) {
+        macro_abort(&cur->macro);
+        return;
+    }
+    for (line = cur->line, i = 0; i < n; i++, line = line->next) {
+        text_thaw(line);
+        size += strlen(line->data) + 1;
+    }
+
+    p = joined = malloc(size);
+    for (line = cur->line, i = 0; i < n; i++, line = line->next) {
+        data = line->data;
+        end = line_end(line);
+        if (i > 0) {
+            for (skip = 0; data[skip] == ' ' || data[skip] == '\t'; skip++) {
+            }
+            cur->x = p - joined;
+            if ((p > joined) && (p[-1] != ' ') && (skip < end) &&
+                (data[skip] != ')')
+            ) {
+                *p++ = ' ';
+            }
+            data += skip;
+            end -= skip;
+        }
+        memcpy(p, data, end);
+        p += end;
+        if ((i == n - 1) && (data[end] == '\n')) {
+            *p++ = '\n';
+        }
+    }
+
+    change_begin(cur, n);
+    line = cur->line->next;
+    text_cut_lines(line, n - 1);
+    text_free_lines(line);
+    text_delete_chars(cur->line, 0, TEXT_ALL_LINES);
+    text_insert_chars(cur->line, 0, joined, p - joined);
+    change_end(cur, 1);
+    free(joined);
+}
+
+/*
+ * moves n lines starting at line number first to below line number dest,
+ * where 0 is above the first line. the lines are relinked, not copied
+ */
+static const char *move_lines(
+    struct Window *win,
+    struct Cursor *cur,
+    size_t first,
+    size_t n,
+    size_t dest
+) {
+    struct Text *list;
+    struct Text *prev;
+    struct Text *after;
+    size_t after_no;
+    size_t to;
+
+    if ((dest >= first) && (dest < first + n - 1)) {
+        return "cannot move lines into themselves";
+    }
+    if ((dest == first - 1) || (dest == first + n - 1)) {
+        cursor_goto_line(win, cur, first + n - 1);
+        return NULL;
+    }
+
+    cursor_goto_line(win, cur, first);
+    list = cur->line;
+    prev = list->prev;
+
+    undo_group_begin(&cur->history);
+    change_begin(cur, n);
+    after = text_cut_lines(list, n);
+    change_end(cur, 0);
+    if (cur->top_of_text == list) {
+        cur->top_of_text = after;
+    }
+
+    /* counted in the text as it is without the moved lines */
+    to = (dest < first) ? dest : dest - n;
+    after_no = first;
+    if (prev) {
+        after = prev;
+        after_no = first - 1;
+    }
+    for (; after_no < to; after_no++) {
+        after = after->next;
+    }
+    for (; after_no > to && after_no > 1; after_no--) {
+        after = after->prev;
+    }
+
+    undo_begin(&cur->history, NULL, to + 1, 0, 0);
+    after = insert_lines(cur, to ? after : NULL, list);
+    change_end(cur, n);
+    undo_group_end(&cur->history);
+
+    cursor_restore(win, cur, after, to + n, 0);
+    return NULL;
+}
+
+/* copies n lines from first to below line number dest, 0 meaning the top */
+static void copy_lines(
+    struct Window *win,
+    struct Cursor *cur,
+    struct Text *first,
+    size_t n,
+    size_t dest
+) {
+    struct Text *list = text_copy_lines(first, n);
+    struct Text *last;
+
+    undo_begin(&cur->history, NULL, dest + 1, 0, 0);
+    last = insert_lines(cur, line_at(cur, dest), list);
+    change_end(cur, n);
+    cursor_restore(win, cur, last, dest + n, 0);
+}
+
+/*
+ * sorts n lines from the cursor, or with uniq only drops repeated lines.
+ * flags are the letters after :sort
+ */
+static const char *sort_range(
+    struct Window *win,
+    struct Cursor *cur,
+    size_t n,
+    const char *flags,
+    int uniq
+) {
+    struct Text *first = cur->line;
+    struct Text *dropped = NULL;
+    int how = 0;
+
+    for (; *flags; flags++) {
+        switch (*flags) {
+            case 'n':
+                how |= SORT_NUMERIC;
+                break;
+
+            case 'r':
+                how |= SORT_REVERSE;
+                break;
+
+            case 'u':
+                how |= SORT_UNIQUE;
+                break;
+
+            case ' ':
+            case '\t':
+                break;
+
+            default:
+                return "invalid argument";
+        }
+    }
+
+    change_begin(cur, n);
+    if (uniq) {
+        sort_uniq(first, &n, &dropped);
+    } else {
+        first = sort_lines(first, &n, how, &dropped);
+    }
+    if (!first->prev) {
+        cur->top_of_text = first;
+    }
+    change_end(cur, n);
+    text_free_lines(dropped);
+    cursor_restore(win, cur, first, cur->line_no, 0);
+    return NULL;
+}
+
+/*
+ * replaces n lines from the cursor with what cmd prints when they are
+ * written to it, as :{range}!cmd does
+ */
+static const char *filter_range(
+    struct Window *win,
+    struct Cursor *cur,
+    size_t n,
+    const char *cmd
+) {
+    static char msg[32];
+    struct Text *first = cur->line;
+    struct Text *prev = first->prev;
+    struct Text *next;
+    struct Text *list;
+    struct Text *last;
+    struct Text *line;
+    size_t line_no = cur->line_no;
+    size_t lines;
+    int status;
+
+    if (!*cmd) {
+        return "missing command";
+    }
+    status = filter_lines(first, n, cmd, &list, &lines);
+    if (status < 0) {
+        return "cannot run command";
+    }
+
+    change_begin(cur, n);
+    next = text_cut_lines(first, n);
+    text_free_lines(first);
+    if (!list && !prev && !next) {
+        list = text_make_line();
+        lines = 1;
+    }
+    if (list) {
+        for (last = list; last->next; last = last->next) {
+        }
+        /* output that does not end in a newline must not run into the rest */
+        if (next && (last->data[strlen(last->data) - 1] != '\n')) {
+            text_push_char(last, '\n');
+        }
+        list->prev = prev;
+        if (prev) {
+            prev->next = list;
+        }
+        last->next = next;
+        if (next) {
+            next->prev = last;
+        }
+        line = list;
+    } else if (next) {
+        line = next;
+        if (prev) {
+            prev->next = next;
+        }
+        next->prev = prev;
+    } else {
+        line = prev;
+        line_no--;
+    }
+    if (!line->prev) {
+        cur->top_of_text = line;
+    }
+    change_end(cur, lines);
+    cursor_restore(win, cur, line, line_no, 0);
+
+    if (status) {
+        sprintf(msg, "shell returned %d", status);
+        return msg;
+    }
+    return NULL;
+}
+
+/*
+ * runs an ex command that works on a range of lines. each one is a single
+ * operation on the line list, walking no further than it has to
+ */
+static const char *ex_range(
+    struct Window *win,
+    struct Cursor *cur,
+    struct ExCommand *ex
+) {
+    const char *name = ex->name;
+    struct Text *first = line_at(cur, ex->first);
+    size_t n = ex->last - ex->first + 1;
+    size_t lines;
+    size_t i;
+
+    if (!first) {
+        return "invalid range";
+    }
+    lines = lines_from(first, n);
+    if (lines < n) {
+        /* a count may run past the end, as it does in normal mode */
+        if ((ex->count == 1) || (strcmp(name, "d") && strcmp(name, "y"))) {
+            return "invalid range";
+        }
+        n = lines;
+    }
+    if (ex->reg && !register_valid(ex->reg)) {
+        return "invalid register";
+    }
+
+    if (!strcmp(name, "d")) {
+        cursor_goto_line(win, cur, ex->first);
+        delete_lines(cur, ex->reg, n);
+    } else if (!strcmp(name, "y")) {
+        register_yank(&cur->registers, ex->reg, text_copy_lines(first, n), 0);
+    } else if (!strcmp(name, ">") || !strcmp(name, "<")) {
+        cursor_goto_line(win, cur, ex->first);
+        change_begin(cur, n);
+        for (i = 0; i < ex->count; i++) {
+            shift_lines(cur->line, n, name[0] == '>');
+        }
+        change_end(cur, n);
+    } else if (!strcmp(name, "sort") || !strcmp(name, "uniq")) {
+        cursor_goto_line(win, cur, ex->first);
+        return sort_range(win, cur, n, ex->arg, name[0] == 'u');
+    } else if (!strcmp(name, "!")) {
+        if (!ex->addresses) {
+            return "filter needs a range";
+        }
+        cursor_goto_line(win, cur, ex->first);
+        return filter_range(win, cur, n, ex->arg);
+    } else if (!strcmp(name, "j")) {
+        cursor_goto_line(win, cur, ex->first);
+        join_lines(cur, MAX(n, 2));
+    } else if (!strcmp(name, "m") || !strcmp(name, "t")) {
+        if ((ex->dest > 0) && !line_at(cur, ex->dest)) {
+            return "invalid address";
+        }
+        if (name[0] == 'm') {
+            return move_lines(win, cur, ex->first, n, ex->dest);
+        }
+        copy_lines(win, cur, first, n, ex->dest);
+    } else {
+        return "not an editor command";
+    }
+    return NULL;
+}
+
+/* true if the line numbered line_no is far from what every window shows */
+static int is_cold(struct Window *win, struct Cursor *cur, size_t line_no) {
+    struct Split *leaf;
+    size_t top;
+
+    for (leaf = split_first(split_root(win->split)); leaf;
+        leaf = split_next(leaf)
+    ) {
+        top = (leaf->win == win) ? cur->line_no - cur->y : leaf->win->top_no;
+        if (line_no + COLD_DISTANCE >= top &&
+            line_no <= top + leaf->win->maxlines + COLD_DISTANCE
+        ) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/*
+ * with :set compress, looks at the next COLD_BATCH lines of the text after
+ * each key, going round from the top once it reaches the end, and freezes
+ * runs of cold lines in blocks of about COLD_BLOCK bytes. lines above the
+ * first one changed are still the same lines, so the place it got to is
+ * only lost when it is at or below a change, and then it goes on from the
+ * cursor instead
+ */
+static void freeze_cold(struct Window *win, struct Cursor *cur, size_t changed) {
+    struct Text *line = cur->cold_line;
+    size_t line_no = cur->cold_no;
+    struct Text *first;
+    size_t first_no;
+    size_t bytes;
+    size_t seen = 0;
+
+    if (!cur->compress) {
+        return;
+    }
+    if (!line || (changed && changed <= line_no)) {
+        line = cur->line;
+        line_no = cur->line_no;
+    }
+    while (seen < COLD_BATCH) {
+        first = line;
+        first_no = line_no;
+        for (bytes = 0; line && bytes < COLD_BLOCK && is_cold(win, cur, line_no);
+            line = line->next, line_no++
+        ) {
+            bytes += line->len;
+        }
+        if (line_no > first_no) {
+            text_freeze(first, line_no - first_no);
+            seen += line_no - first_no;
+        } else {
+            line = line->next;
+            line_no++;
+            seen++;
+        }
+        if (!line) {
+            line = cur->top_of_text;
+            line_no = 1;
+        }
+    }
+    cur->cold_line = line;
+    cur->cold_no = line_no;
+}
+
+/*
+ * counts the words of the next WORDS_BATCH lines after each key, from the
+ * top of the text down to its end. a change goes back to the first line
+ * changed, as the lines above it are still counted, and the whole of the
+ * rest is counted at once when a completion needs it. words no longer in
+ * the text are swept out while no completion holds on to them
+ */
+static void count_words(struct Cursor *cur, size_t changed, size_t batch) {
+    struct Text *line = cur->words_line;
+    size_t line_no = cur->words_no;
+    size_t seen;
+
+    if (changed && (!line || changed <= line_no)) {
+        line = line_at(cur, changed);
+        line_no = changed;
+    }
+    for (seen = 0; line && seen < batch; seen++) {
+        words_count(line);
+        line = line->next;
+        line_no++;
+    }
+    cur->words_line = line;
+    cur->words_no = line_no;
+    if (!cur->completion.matches) {
+        words_sweep();
+    }
+}
+
+/*
+ * moves the marks along with the text after the lines from first up to end
+ * were changed and shift lines were added. a mark on a line that went is
+ * forgotten, as in vi
+ */
+static void marks_changed(
+    struct Cursor *cur,
+    size_t first,
+    size_t end,
+    long shift
+) {
+    size_t new_end = shift < 0 ? end - (size_t)-shift : end + (size_t)shift;
+    size_t i;
+
+    for (i = 0; i < EX_MARKS; i++) {
+        if (cur->marks[i] >= end) {
+            cur->marks[i] = cur->marks[i] - end + new_end;
+        } else if (cur->marks[i] >= first && cur->marks[i] >= new_end) {
+            cur->marks[i] = 0;
+        }
+    }
+}
+
+/*
+ * lines from line number first on were changed. other windows showing any
+ * of them draw those rows again, and leave the rows above alone. with
+ * closed folds a row may show any line below the first, so they all go
+ */
+static void damage_windows(
+    struct Window *win,
+    struct Cursor *cur,
+    size_t first
+) {
+    struct Split *leaf;
+    struct Window *other;
+    int folds = folds_shown(cur) != NULL;
+    size_t i;
+
+    for (leaf = split_first(split_root(win->split)); leaf;
+        leaf = split_next(leaf)
+    ) {
+        other = leaf->win;
+        if ((other == win) ||
+            (!folds && first >= other->top_no + other->nrows)
+        ) {
+            continue;
+        }
+        i = 0;
+        if (first <= other->top_no) {
+            /* the first line it shows may be gone */
+            other->top = NULL;
+        } else if (!folds) {
+            i = first - other->top_no;
+        }
+        for (; i < other->nrows; i++) {
+            other->rows[i].stale = 1;
+        }
+    }
+}
+
+/* draws the bars between windows that are side by side */
+static void draw_bars(struct Split *node) {
+    if (!node->first) {
+        return;
+    }
+    if (node->vertical) {
+        mvvline(
+            (int)node->top,
+            (int)(node->left + node->first->cols),
+            '|',
+            (int)node->lines
+        );
+    }
+    draw_bars(node->first);
+    draw_bars(node->second);
+}
+
+/* gives every window a curses window where the layout now puts it */
+static void windows_place(struct Window *win, struct Cursor *cur) {
+    struct Split *leaf;
+    struct Window *other;
+
+    werase(stdscr);
+    draw_bars(split_root(win->split));
+    wnoutrefresh(stdscr);
+    for (leaf = split_first(split_root(win->split)); leaf;
+        leaf = split_next(leaf)
+    ) {
+        other = leaf->win;
+        delwin(other->curses_win);
+        other->curses_win = newwin(
+            (int)leaf->lines,
+            (int)leaf->cols,
+            (int)leaf->top,
+            (int)leaf->left
+        );
+        other->maxlines = leaf->lines;
+        other->maxcols = leaf->cols;
+        other->damaged = 1;
+    }
+    cursor_restore(win, cur, cur->line, cur->line_no, cur->x);
+}
+
+/* fits the windows to the new size of the terminal, once it stops changing */
+static void screen_resize(struct Window *win, struct Cursor *cur) {
+    struct Split *root = split_root(win->split);
+    struct winsize size;
+    size_t prompt_x = cur->x;
+    int waits;
+
+    for (waits = 0; resized && waits < RESIZE_WAITS; waits++) {
+        resized = 0;
+        napms(RESIZE_SETTLE);
+    }
+    resized = 0;
+    if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &size) != 0 || size.ws_row < 2 ||
+        (size.ws_row == root->lines && size.ws_col == root->cols)
+    ) {
+        return;
+    }
+
+    /* only the lines drawn again are wrapped to the new width */
+    resizeterm(size.ws_row, size.ws_col);
+    root->lines = size.ws_row;
+    root->cols = size.ws_col;
+    split_layout(root);
+
+    /*
+     * only a prompt puts the cursor on the last row, keeping where it was in
+     * the text in old_x and old_y. the prompt is put back on the new last row
+     */
+    if (!cur->prompt) {
+        windows_place(win, cur);
+        return;
+    }
+    cur->x = cur->old_x;
+    cur->y = cur->old_y;
+    cur->prompt = 0;
+    windows_place(win, cur);
+    redraw_screen(win, cur, NORMAL);
+    cur->prompt = 1;
+    cur->old_x = cur->x;
+    cur->old_y = cur->y;
+    cur->x = prompt_x;
+    cur->y = win->maxlines - 1;
+    wmove(win->curses_win, cur->y, 0);
+    wclrtoeol(win->curses_win);
+    waddstr(win->curses_win, cur->buf);
+    wmove(win->curses_win, cur->y, cur->x);
+    wrefresh(win->curses_win);
+}
+
+static void window_free(struct Window *win) {
+    delwin(win->curses_win);
+    free(win->rows);
+    free(win);
+}
+
+/* remembers where the cursor is in the window it is about to leave */
+static void window_leave(struct Window *win, struct Cursor *cur) {
+    win->top = cur->top_of_screen;
+    win->top_no = cur->line_no - cur->y;
+    win->line_no = cur->line_no;
+    win->x = cur->x;
+    win->y = cur->y;
+}
+
+/* puts the cursor back where it was left in win */
+static void window_restore(struct Window *win, struct Cursor *cur) {
+    size_t line_no = win->line_no;
+    struct Text *line = line_or_last(cur, &line_no);
+
+    cur->y = win->y;
+    cursor_restore(win, cur, line, line_no, win->x);
+}
+
+/*
+ * the window in use is always the one at win, so moving to another window
+ * swaps what the two hold
+ */
+static void window_enter(
+    struct Window *win,
+    struct Cursor *cur,
+    struct Window *other
+) {
+    struct Window tmp;
+
+    window_leave(win, cur);
+    tmp = *win;
+    *win = *other;
+    *other = tmp;
+    win->split->win = win;
+    other->split->win = other;
+    win->damaged = 1;
+    other->damaged = 1;
+    window_restore(win, cur);
+}
+
+/* splits the window in use, with a new window on the same place below it */
+static const char *window_split(
+    struct Window *win,
+    struct Cursor *cur,
+    int vertical
+) {
+    struct Window *added = calloc(1, sizeof(struct Window));
+
+    added->split = split_add(win->split, added, vertical);
+    if (!added->split) {
+        free(added);
+        return "not enough room";
+    }
+    window_leave(added, cur);
+    added->wrap = win->wrap;
+    added->left = win->left;
+    windows_place(win, cur);
+    if (added->y > added->maxlines - 2) {
+        added->y = added->maxlines - 2;
+        added->top = NULL;
+        added->top_no = added->line_no - added->y;
+    }
+    return NULL;
+}
+
+/* closes the window in use and moves to the one that takes its place */
+static const char *window_close(struct Window *win, struct Cursor *cur) {
+    struct Split *leaf = split_remove(win->split);
+    struct Window *other;
+
+    if (!leaf) {
+        return "cannot close last window";
+    }
+    other = leaf->win;
+    delwin(win->curses_win);
+    free(win->rows);
+    *win = *other;
+    leaf->win = win;
+    free(other);
+    windows_place(win, cur);
+    window_restore(win, cur);
+    return NULL;
+}
+
+/* closes every window but the one in use */
+static void window_only(struct Window *win, struct Cursor *cur) {
+    struct Split *leaf;
+
+    for (;;) {
+        leaf = split_first(split_root(win->split));
+        if (leaf == win->split) {
+            leaf = split_next(leaf);
+        }
+        if (!leaf) {
+            break;
+        }
+        window_free(leaf->win);
+        split_remove(leaf);
+    }
+    windows_place(win, cur);
+}
+
+/* frees every window but the one in use, and the layout */
+static void windows_free(struct Window *win) {
+    struct Split *root = split_root(win->split);
+    struct Split *leaf;
+
+    for (leaf = split_first(root); leaf; leaf = split_next(leaf)) {
+        if (leaf->win != win) {
+            window_free(leaf->win);
+        }
+    }
+    split_free(root);
+}
+
+/*
+ * the key after ctrl-w: s and v split, c and q close, o closes the others,
+ * w goes round the windows and h, j, k and l move to the one on that side
+ */
+static const char *window_command(
+    struct Window *win,
+    struct Cursor *cur,
+    int c
+) {
+    struct Split *leaf = win->split;
+    struct Split *root = split_root(leaf);
+    struct Split *to = NULL;
+    size_t y = leaf->top + cur->y;
+    size_t x = leaf->left + MIN(cur->x, leaf->cols - 1);
+
+    switch (c) {
+        case 's':
+        case 'S':
+        case 19: /* ctrl-s */
+            return window_split(win, cur, 0);
+
+        case 'v':
+        case 22: /* ctrl-v */
+            return window_split(win, cur, 1);
+
+        case 'c':
+        case 'q':
+            return window_close(win, cur);
+
+        case 'o':
+            window_only(win, cur);
+            return NULL;
+
+        case 'w':
+        case 23: /* ctrl-w */
+            to = split_next(leaf);
+            if (!to) {
+                to = split_first(root);
+            }
+            break;
+
+        case 'j':
+            to = split_at(root, leaf->top + leaf->lines, x);
+            break;
+
+        case 'k':
+            to = leaf->top ? split_at(root, leaf->top - 1, x) : NULL;
+            break;
+
+        case 'h':
+            to = (leaf->left > 1) ? split_at(root, y, leaf->left - 2) : NULL;
+            break;
+
+        case 'l':
+            to = split_at(root, y, leaf->left + leaf->cols + 1);
+            break;
+
+        default:
+            break;
+    }
+    if (to && (to != leaf)) {
+        window_enter(win, cur, to->win);
+    }
+    return NULL;
+}
+
+/* keeps the state of the current buffer that the cursor holds */
+static void buffer_save(struct Cursor *cur) {
+    struct Buffer *buf = &cur->buffers.list[cur->buffers.current];
+
+    buf->top_of_text = cur->top_of_text;
+    buf->line = cur->line;
+    buf->line_no = cur->line_no;
+    buf->x = cur->x;
+    buf->y = cur->y;
+    buf->history = cur->history;
+    memcpy(buf->marks, cur->marks, sizeof(buf->marks));
+}
+
+static void buffer_switch(struct Window *win, struct Cursor *cur, size_t i) {
+    struct Buffer *buf;
+    int grouping = cur->history.grouping;
+
+    /* a macro that moves between buffers keeps its changes grouped in each */
+    cur->history.grouping = 0;
+    buffer_save(cur);
+    cur->cold_line = NULL;
+
+    buf = buffers_get(&cur->buffers, i);
+    cur->buffers.current = i;
+    cur->top_of_text = buf->top_of_text;
+    cur->history = buf->history;
+    cur->words_line = cur->top_of_text;
+    cur->words_no = 1;
+    for (; grouping > 0; grouping--) {
+        undo_group_begin(&cur->history);
+    }
+    memcpy(cur->marks, buf->marks, sizeof(cur->marks));
+    cur->y = buf->y;
+    cursor_restore(win, cur, buf->line, buf->line_no, buf->x);
+    win->damaged = 1;
+    damage_windows(win, cur, 1);
+}
+
+/* :n and :N move through the buffers in order, :b N goes to buffer N */
+static const char *buffer_command(
+    struct Window *win,
+    struct Cursor *cur,
+    struct ExCommand *ex
+) {
+    size_t i = cur->buffers.current;
+    const char *p = ex->arg;
+
+    if (ex->name[0] == 'n') {
+        if (i + 1 >= cur->buffers.n) {
+            return "no more files";
+        }
+        i++;
+    } else if (ex->name[0] == 'N') {
+        if (i == 0) {
+            return "no previous file";
+        }
+        i--;
+    } else {
+        if (!isdigit((unsigned char)*p)) {
+            return "missing buffer number";
+        }
+        for (i = 0; isdigit((unsigned char)*p) && i <= cur->buffers.n; p++) {
+            i = (i * 10) + (*p - '0');
+        }
+        if (i == 0 || i > cur->buffers.n) {
+            return "no such buffer";
+        }
+        i--;
+    }
+    buffer_switch(win, cur, i);
+    return NULL;
+}
+
+/* opens the file of match i of the quickfix list on the line it is on */
+static void quickfix_jump(struct Window *win, struct Cursor *cur, size_t i) {
+    struct Match *match = &cur->quickfix.matches[i];
+    size_t buf = buffers_add(
+        &cur->buffers,
+        cur->quickfix.files[match->file]
+    );
+
+    cur->quickfix.current = i;
+    if (buf != cur->buffers.current) {
+        buffer_switch(win, cur, buf);
+    }
+    cursor_goto_line(win, cur, match->line_no);
+    cur->x = MIN(match->col, last_col(cur->line));
+    cur->old_x = text_column(cur->line, cur->x);
+}
+
+/* :grep fills the quickfix list, :cn and :cp go through it */
+static const char *quickfix_command(
+    struct Window *win,
+    struct Cursor *cur,
+    struct ExCommand *ex
+) {
+    struct Quickfix *qf = &cur->quickfix;
+    const char *err;
+    size_t i = qf->current;
+
+    if (ex->name[0] == 'g') {
+        if ((err = grep(qf, ex->arg))) {
+            return err;
+        }
+        i = 0;
+    } else if (qf->n == 0) {
+        return "no quickfix list";
+    } else if (!strcmp(ex->name, "cn")) {
+        if (i + 1 >= qf->n) {
+            return "no more items";
+        }
+        i++;
+    } else {
+        if (i == 0) {
+            return "no previous item";
+        }
+        i--;
+    }
+    quickfix_jump(win, cur, i);
+    return NULL;
+}
+
+/*
+ * :set wrap makes long lines go on over more rows, :set nowrap cuts them off.
+ * :set compress freezes lines far from every window, :set nocompress stops
+ * doing so, leaving lines already frozen to thaw as they are used.
+ * :set undofile keeps the history in an undo file beside each file written,
+ * which is kept up to date from then on even after :set noundofile
+ */
+static const char *set_option(
+    struct Window *win,
+    struct Cursor *cur,
+    const char *arg
+) {
+    if (!strcmp(arg, "compress") || !strcmp(arg, "nocompress")) {
+        cur->compress = (arg[0] == 'c');
+        return NULL;
+    }
+    if (!strcmp(arg, "undofile") || !strcmp(arg, "noundofile")) {
+        cur->undofile = (arg[0] == 'u');
+        return NULL;
+    }
+    /* indent folds are made once, and kept from then on like any other */
+    if (!strcmp(arg, "foldmethod=indent") || !strcmp(arg, "fdm=indent")) {
+        fold_indent(&cur->buffers.list[cur->buffers.current].folds,
+            cur->top_of_text);
+        damage_windows(win, cur, 1);
+        win->damaged = 1;
+        return NULL;
+    }
+    if (!strcmp(arg, "foldmethod=manual") || !strcmp(arg, "fdm=manual")) {
+        return NULL;
+    }
+    if (!strcmp(arg, "wrap")) {
+        win->wrap = 1;
+    } else if (!strcmp(arg, "nowrap")) {
+        win->wrap = 0;
+    } else {
+        return "unknown option";
+    }
+    win->left = 0;
+    win->skip = 0;
+    win->damaged = 1;
+    return NULL;
+}
+
+/* fills the window with the lines of report until a key is pressed */
+static void show_report(
+    struct Window *win,
+    struct Cursor *cur,
+    const char *report
+) {
+    const char *line;
+    const char *end;
+    int y = 0;
+
+    werase(win->curses_win);
+    for (line = report; *line && (size_t)y < win->maxlines - 1; line = end) {
+        end = line + strcspn(line, "\n");
+        mvwaddnstr(win->curses_win, y++, 0, line, (int)(end - line));
+        end += (*end == '\n');
+    }
+    wmove(win->curses_win, win->maxlines - 1, 0);
+    waddstr(win->curses_win, "press a key");
+    wait_key(win, cur);
+    win->damaged = 1;
+}
+
+/*
+ * :stats shows how long keys took and what was allocated, and :stats file
+ * writes the same out as json
+ */
+static const char *stats_command(
+    struct Window *win,
+    struct Cursor *cur,
+    const char *arg
+) {
+#ifdef PROFILE
+    char report[PROFILE_REPORT_SIZE];
+
+    if (arg[0]) {
+        return profile_write(arg) ? "cannot write stats" : NULL;
+    }
+    profile_report(report, sizeof(report));
+    show_report(win, cur, report);
+    return NULL;
+#else
+    UNUSED(win);
+    UNUSED(cur);
+    UNUSED(arg);
+    return "built without profiling";
+#endif
+}
+
+static size_t memory_total(const struct TextMemory *mem) {
+    return mem->nodes + mem->data + mem->headers + mem->slack + mem->caches +
+        mem->frozen;
+}
+
+/* adds a line of the :mem report for bytes spread over lines */
+static size_t memory_line(
+    char *report,
+    const char *name,
+    size_t bytes,
+    size_t lines
+) {
+    return (size_t)sprintf(report, "%-16s %12lu %10.1f\n", name,
+        (unsigned long)bytes, lines ? (double)bytes / (double)lines : 0.0);
+}
+
+/*
+ * :mem shows what the current buffer costs: its lines, split into the
+ * nodes, the text, the headers and unused capacity of the payloads and the
+ * caches worked out from them, then the registers, the undo history, the
+ * rows kept by each window and the word index, with each part per line and
+ * the whole against the size of the file
+ */
+static const char *mem_command(struct Window *win, struct Cursor *cur) {
+    const char *filename = cur->buffers.list[cur->buffers.current].filename;
+    struct TextMemory text;
+    struct TextMemory registers;
+    struct TextMemory undo;
+    struct Split *leaf;
+    struct stat st;
+    char report[1024];
+    size_t steps;
+    size_t rows = 0;
+    size_t file;
+    size_t total;
+    size_t len = 0;
+
+    memset(&text, 0, sizeof(text));
+    memset(&registers, 0, sizeof(registers));
+    memset(&undo, 0, sizeof(undo));
+    text_measure(cur->top_of_text, &text);
+    register_measure(&cur->registers, &registers);
+    steps = undo_measure(&cur->history, &undo);
+    for (leaf = split_first(split_root(win->split)); leaf;
+        leaf = split_next(leaf)
+    ) {
+        rows += leaf->win->nrows * sizeof(struct Row);
+    }
+    file = (filename && !stat(filename, &st)) ? (size_t)st.st_size : text.data;
+    total = memory_total(&text) + memory_total(&registers) +
+        memory_total(&undo) + steps + rows + text_spare() + words_measure();
+
+    len += sprintf(report + len, "%-16s %12s %10s\n", "", "bytes", "per line");
+    len += memory_line(report + len, "file", file, text.lines);
+    len += memory_line(report + len, "line nodes", text.nodes, text.lines);
+    len += memory_line(report + len, "text", text.data, text.lines);
+    len += memory_line(report + len, "payload headers", text.headers,
+        text.lines);
+    len += memory_line(report + len, "slack", text.slack, text.lines);
+    len += memory_line(report + len, "layouts, syntax", text.caches,
+        text.lines);
+    len += memory_line(report + len, "compressed", text.frozen, text.lines);
+    len += memory_line(report + len, "registers", memory_total(&registers),
+        text.lines);
+    len += memory_line(report + len, "undo", memory_total(&undo) + steps,
+        text.lines);
+    len += memory_line(report + len, "window rows", rows, text.lines);
+    len += memory_line(report + len, "spare nodes", text_spare(), text.lines);
+    len += memory_line(report + len, "word index", words_measure(),
+        text.lines);
+    len += memory_line(report + len, "total", total, text.lines);
+    sprintf(report + len, "\n%lu lines, %.2f times the size of the file\n",
+        (unsigned long)text.lines, file ? (double)total / (double)file : 0.0);
+    show_report(win, cur, report);
+    return NULL;
+}
+
+/* the most bytes a row of the hex view shows */
+#define HEX_WIDTH 16
+
+/* whether byte is drawn as itself on the text side of the hex view */
+static int hex_printable(int byte) {
+    return byte >= ' ' && byte < 0x7f;
+}
+
+/* the value of a hex digit, or -1 if c is not one */
+static int hex_digit(int c) {
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    } else if (c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    } else if (c >= 'A' && c <= 'F') {
+        return c - 'A' + 10;
+    }
+    return -1;
+}
+
+/*
+ * fits the rows of the hex view to the window and scrolls them so that the
+ * cursor is on the screen, with every row starting at a multiple of width
+ */
+static void hex_layout(
+    struct Window *win,
+    struct Hex *hex,
+    struct HexView *view
+) {
+    size_t rows = win->maxlines - 1;
+
+    for (view->digits = 8; view->digits < 2 * sizeof(size_t) &&
+        (hex->size >> (4 * view->digits)); view->digits++) {
+    }
+    view->width = win->maxcols > view->digits + 7 ?
+        MIN((win->maxcols - view->digits - 3) / 4, HEX_WIDTH) : 1;
+    view->top -= view->top % view->width;
+    if (view->at < view->top) {
+        view->top = view->at - view->at % view->width;
+    } else if (view->at >= view->top + rows * view->width) {
+        view->top = (view->at / view->width - (rows - 1)) * view->width;
+    }
+}
+
+/*
+ * draws the rows of the hex view from the bytes they show and no others:
+ * the offset, the bytes in hex, then the bytes as text, with bytes written
+ * over in bold and the one under the cursor shown on the other side too
+ */
+static void hex_draw(
+    struct Window *win,
+    struct Hex *hex,
+    struct HexView *view
+) {
+    size_t rows = win->maxlines - 1;
+    size_t row;
+    size_t offset;
+    size_t i;
+    int byte;
+    attr_t attrs;
+    char text[64];
+
+    werase(win->curses_win);
+    for (row = 0; row < rows; row++) {
+        offset = view->top + row * view->width;
+        wmove(win->curses_win, (int)row, 0);
+        if (offset >= hex->size && (offset || row)) {
+            waddch(win->curses_win, '~');
+            continue;
+        }
+        sprintf(text, "%0*lx: ", (int)view->digits, (unsigned long)offset);
+        waddstr(win->curses_win, text);
+        for (i = 0; i < view->width && offset + i < hex->size; i++) {
+            byte = hex_byte(hex, offset + i);
+            attrs = hex_patched(hex, offset + i) ? A_BOLD : 0;
+            if (view->text && offset + i == view->at) {
+                attrs |= A_REVERSE;
+            }
+            sprintf(text, "%02x", byte);
+            wattron(win->curses_win, attrs);
+            waddstr(win->curses_win, text);
+            wattroff(win->curses_win, attrs);
+            waddch(win->curses_win, ' ');
+        }
+        wmove(win->curses_win, (int)row,
+            (int)(view->digits + 3 + 3 * view->width));
+        for (i = 0; i < view->width && offset + i < hex->size; i++) {
+            byte = hex_byte(hex, offset + i);
+            attrs = hex_patched(hex, offset + i) ? A_BOLD : 0;
+            if (!view->text && offset + i == view->at) {
+                attrs |= A_REVERSE;
+            }
+            wattron(win->curses_win, attrs);
+            waddch(win->curses_win, hex_printable(byte) ? byte : '.');
+            wattroff(win->curses_win, attrs);
+        }
+    }
+
+    wmove(win->curses_win, (int)rows, 0);
+    sprintf(text, "%lu patched", (unsigned long)hex->n);
+    waddnstr(win->curses_win, hex->filename, 40);
+    waddstr(win->curses_win, "  ");
+    waddstr(win->curses_win, view->replace ? "-- REPLACE --" : text);
+    sprintf(text, "%lx / %lx", (unsigned long)view->at,
+        (unsigned long)hex->size);
+    if (win->maxcols > strlen(text) + 1) {
+        mvwaddstr(win->curses_win, (int)rows,
+            (int)(win->maxcols - strlen(text) - 1), text);
+    }
+
+    row = (view->at - view->top) / view->width;
+    i = view->at % view->width;
+    wmove(win->curses_win, (int)row, (int)(view->text ?
+        view->digits + 3 + 3 * view->width + i :
+        view->digits + 2 + 3 * i + (size_t)view->low));
+    wrefresh(win->curses_win);
+}
+
+/*
+ * types c over the byte under the cursor, a character on the text side or
+ * half a byte at a time on the hex side, and moves on once it is written
+ */
+static void hex_type(struct Hex *hex, struct HexView *view, int c) {
+    int byte;
+    int digit = hex_digit(c);
+
+    if (view->at >= hex->size) {
+        return;
+    }
+    byte = hex_byte(hex, view->at);
+    if (view->text) {
+        if (!hex_printable(c)) {
+            return;
+        }
+        hex_set(hex, view->at, (unsigned char)c);
+    } else if (digit < 0) {
+        return;
+    } else if (!view->low) {
+        hex_set(hex, view->at, (unsigned char)((digit << 4) | (byte & 0x0f)));
+        view->low = 1;
+        return;
+    } else {
+        hex_set(hex, view->at, (unsigned char)((byte & 0xf0) | digit));
+        view->low = 0;
+    }
+    if (view->at + 1 < hex->size) {
+        view->at++;
+    }
+}
+
+/* reads a command for the hex view on the last row, or 0 if escaped */
+static int hex_prompt(
+    struct Window *win,
+    struct Cursor *cur,
+    char *line,
+    size_t size
+) {
+    size_t n = 0;
+    int c;
+
+    line[0] = '\0';
+    for (;;) {
+        wmove(win->curses_win, (int)win->maxlines - 1, 0);
+        wclrtoeol(win->curses_win);
+        waddch(win->curses_win, ':');
+        waddstr(win->curses_win, line);
+        wrefresh(win->curses_win);
+        c = next_key(win, cur);
+        if (c == 27) { /* escape key */
+            return 0;
+        } else if (c == '\n') {
+            return 1;
+        } else if (c == 127) { /* backspace key */
+            if (n == 0) {
+                return 0;
+            }
+            line[--n] = '\0';
+        } else if (n + 1 < size && hex_printable(c)) {
+            line[n++] = (char)c;
+            line[n] = '\0';
+        }
+    }
+}
+
+/*
+ * runs a command typed in the hex view: :w writes the patches into the
+ * file, :wq and :x write them and leave, :q and :hex leave once nothing is
+ * left unwritten, :q! leaves throwing the patches away, and an offset moves
+ * to it. returns whether to leave
+ */
+static int hex_command(
+    struct Window *win,
+    struct Cursor *cur,
+    struct Hex *hex,
+    struct HexView *view,
+    const char *line
+) {
+    const char *err = NULL;
+    char msg[1024];
+    char *end;
+    unsigned long offset;
+    int written;
+
+    if (!strcmp(line, "q!")) {
+        return 1;
+    } else if (!strcmp(line, "q") || !strcmp(line, "hex")) {
+        if (!hex->n) {
+            return 1;
+        }
+        err = "patches not written";
+    } else if (!strcmp(line, "w") || !strcmp(line, "wq") ||
+        !strcmp(line, "x")
+    ) {
+        written = hex->n > 0;
+        err = hex_save(hex);
+        view->written |= written && !err;
+        if (!err && strcmp(line, "w")) {
+            return 1;
+        } else if (!err) {
+            /* not an error, but shown the same way */
+            sprintf(msg, "wrote file: '%.1000s'", hex->filename);
+            err = msg;
+        }
+    } else if (isdigit((unsigned char)line[0])) {
+        offset = strtoul(line, &end, 0);
+        if (*end) {
+            err = "not an offset";
+        } else if (hex->size) {
+            view->at = MIN(offset, hex->size - 1);
+            view->low = 0;
+        }
+    } else if (line[0]) {
+        err = "not an editor command";
+    }
+    if (err) {
+        wmove(win->curses_win, (int)win->maxlines - 1, 0);
+        wclrtoeol(win->curses_win);
+        waddstr(win->curses_win, err);
+        wait_key(win, cur);
+    }
+    return 0;
+}
+
+/*
+ * looks at hex as bytes in the window until it is left. moving goes by
+ * bytes and rows, tab goes between the hex and text sides, r writes over
+ * the byte under the cursor, R keeps writing over bytes until escape, and
+ * u puts back the byte the file has. returns whether the file was written
+ */
+static int hex_view(struct Window *win, struct Cursor *cur, struct Hex *hex) {
+    struct HexView view;
+    char line[80];
+    size_t last = 0;
+    size_t page;
+    size_t at;
+    int c;
+
+    memset(&view, 0, sizeof(view));
+    for (;;) {
+        hex_layout(win, hex, &view);
+        hex_draw(win, hex, &view);
+        c = next_key(win, cur);
+        last = hex->size ? hex->size - 1 : 0;
+        page = (win->maxlines - 1) * view.width;
+        if (view.replace) {
+            if (c == 27) { /* escape key */
+                view.replace = 0;
+                view.low = 0;
+            } else if (c != KEY_RESIZE) {
+                hex_type(hex, &view, c);
+            }
+            continue;
+        }
+        view.low = 0;
+        switch (c) {
+            case 'h':
+                view.at -= view.at > 0;
+                break;
+
+            case 'l':
+            case ' ':
+                view.at += view.at < last;
+                break;
+
+            case 'k':
+                view.at -= view.at >= view.width ? view.width : 0;
+                break;
+
+            case 'j':
+            case '\n':
+                view.at += view.at + view.width <= last ? view.width : 0;
+                break;
+
+            case '0':
+                view.at -= view.at % view.width;
+                break;
+
+            case '$':
+                view.at = MIN(view.at - view.at % view.width + view.width - 1,
+                    last);
+                break;
+
+            case 'g':
+                if (next_key(win, cur) == 'g') {
+                    view.at = 0;
+                }
+                break;
+
+            case 'G':
+                view.at = last;
+                break;
+
+            case 6: /* Ctrl-F */
+                view.top += view.top + page <= last ? page : 0;
+                view.at = MIN(view.at + page, last);
+                break;
+
+            case 2: /* Ctrl-B */
+                view.top -= MIN(view.top, page);
+                view.at -= MIN(view.at, page);
+                break;
+
+            case '\t':
+                view.text = !view.text;
+                break;
+
+            case 'r':
+                c = next_key(win, cur);
+                at = view.at;
+                if (view.text) {
+                    hex_type(hex, &view, c);
+                } else if (hex_digit(c) >= 0) {
+                    hex_type(hex, &view, c);
+                    hex_type(hex, &view, next_key(win, cur));
+                }
+                view.at = at;
+                view.low = 0;
+                break;
+
+            case 'R':
+                view.replace = 1;
+                break;
+
+            case 'u':
+                if (hex->size) {
+                    hex_set(hex, view.at, hex->map[view.at]);
+                }
+                break;
+
+            case '\f':
+                redrawwin(win->curses_win);
+                break;
+
+            case ':':
+                if (hex_prompt(win, cur, line, sizeof(line)) &&
+                    hex_command(win, cur, hex, &view, line)
+                ) {
+                    return view.written;
+                }
+                break;
+        }
+    }
+}
+
+/* the group of the last change to the text in use, 0 if there is none */
+static unsigned long last_change(struct Cursor *cur) {
+    return cur->history.undo ? cur->history.undo->group : 0;
+}
+
+/*
+ * reads the file back into the buffer in use after the hex view wrote to
+ * it, as one change that u takes back, so that the next :w does not write
+ * the old bytes over the new ones
+ */
+static void buffer_reload(struct Window *win, struct Cursor *cur) {
+    struct Buffer *buf = &cur->buffers.list[cur->buffers.current];
+    struct Text *list = text_load(buf->filename, &buf->crlf);
+    struct Text *line;
+    size_t line_no = cur->line_no;
+    size_t x = cur->x;
+    size_t n = text_total_lines(cur->top_of_text);
+
+    cur->line = cur->top_of_text;
+    cur->line_no = 1;
+    cur->x = 0;
+    change_begin(cur, n);
+    text_cut_lines(cur->top_of_text, n);
+    text_free_lines(cur->top_of_text);
+    cur->top_of_text = list;
+    cur->line = list;
+    change_end(cur, text_total_lines(list));
+    buf->written = last_change(cur);
+    line = line_or_last(cur, &line_no);
+    cursor_restore(win, cur, line, line_no, x);
+}
+
+/*
+ * opens filename as bytes in the window until the hex view is left. with
+ * vin -b there is no buffer of the file to read the bytes written back into
+ */
+static const char *hex_file(
+    struct Window *win,
+    struct Cursor *cur,
+    const char *filename
+) {
+    struct Hex hex;
+    const char *err = hex_open(&hex, filename);
+    int written;
+
+    if (err) {
+        return err;
+    }
+    written = hex_view(win, cur, &hex);
+    hex_close(&hex);
+    if (written && cur->buffers.list[cur->buffers.current].filename) {
+        buffer_reload(win, cur);
+    }
+    win->damaged = 1;
+    return NULL;
+}
+
+/* parses and runs a command line typed at the ex prompt */
+static enum Todo ex_run(
+    struct Window *win,
+    struct Cursor *cur,
+    enum Mode *mode,
+    const char *line
+) {
+    char *filename = cur->buffers.list[cur->buffers.current].filename;
+    struct ExContext ctx;
+    struct ExCommand ex;
+    const char *err;
+    const char *name = ex.name;
+
+    ctx.top_of_text = cur->top_of_text;
+    ctx.line = cur->line;
+    ctx.line_no = cur->line_no;
+    ctx.total = 0;
+    ctx.marks = cur->marks;
+
+    err = ex_parse(&ctx, line, &ex);
+    if (!err && !name[0]) {
+        if (ex.addresses) {
+            cursor_goto_line(win, cur, ex.last);
+        }
+        return GET_CHAR;
+    } else if (!err && (!strcmp(name, "w") || !strcmp(name, "wq") ||
+        !strcmp(name, "x") || !strcmp(name, "q"))
+    ) {
+        if (name[0] != 'q') {
+            char msg[1024];
+            if (filename != NULL) {
+                text_write(
+                    cur->top_of_text,
+                    filename,
+                    cur->buffers.list[cur->buffers.current].crlf
+                );
+                cur->buffers.list[cur->buffers.current].written =
+                    last_change(cur);
+                err = undo_save(
+                    &cur->history,
+                    cur->top_of_text,
+                    filename,
+                    cur->undofile
+                );
+                if (err) {
+                    sprintf(msg, "wrote file: '%s', %s", filename, err);
+                } else {
+                    sprintf(msg, "wrote file: '%s'", filename);
+                }
+                FLASH_MSG(msg);
+            } else {
+                FLASH_MSG("no file open");
+            }
+            wait_key(win, cur);
+        }
+        if (strcmp(name, "w")) {
+            /* with other windows open only this one goes */
+            if (!window_close(win, cur)) {
+                return GET_CHAR;
+            }
+            *mode = QUIT;
+            return TERMINATE;
+        }
+        return GET_CHAR;
+    } else if (!err && (!strcmp(name, "n") || !strcmp(name, "N") ||
+        !strcmp(name, "b"))
+    ) {
+        err = buffer_command(win, cur, &ex);
+    } else if (!err && (!strcmp(name, "grep") || !strcmp(name, "cn") ||
+        !strcmp(name, "cp"))
+    ) {
+        err = quickfix_command(win, cur, &ex);
+    } else if (!err && (!strcmp(name, "sp") || !strcmp(name, "vs"))) {
+        err = window_split(win, cur, name[0] == 'v');
+    } else if (!err && !strcmp(name, "clo")) {
+        err = window_close(win, cur);
+    } else if (!err && !strcmp(name, "on")) {
+        window_only(win, cur);
+    } else if (!err && !strcmp(name, "set")) {
+        err = set_option(win, cur, ex.arg);
+    } else if (!err && !strcmp(name, "fo")) {
+        err = fold_add(&cur->buffers.list[cur->buffers.current].folds,
+            ex.first, ex.last);
+        damage_windows(win, cur, 1);
+    } else if (!err && !strcmp(name, "stats")) {
+        err = stats_command(win, cur, ex.arg);
+    } else if (!err && !strcmp(name, "mem")) {
+        err = mem_command(win, cur);
+    } else if (!err && !strcmp(name, "hex")) {
+        if (!filename) {
+            err = "no file open";
+        } else if (last_change(cur) !=
+            cur->buffers.list[cur->buffers.current].written
+        ) {
+            /* the file is read back into the buffer if the view writes it */
+            err = "changes not written";
+        } else {
+            err = hex_file(win, cur, filename);
+        }
+    } else if (!err) {
+        err = ex_range(win, cur, &ex);
+    }
+
+    if (err) {
+        FLASH_MSG(err);
+        wait_key(win, cur);
+        macro_abort(&cur->macro);
+    }
+    return GET_CHAR;
+}
+
+static enum Todo handle_ex_mode(
+    struct Window *win,
+    struct Cursor *cur,
+    enum Mode *mode,
+    int c
+) {
+    size_t capacity = 80;
+    char *buf = malloc(capacity);
+    size_t buf_index = 0;
+    enum Todo todo;
+
+    do {
+        if (c == KEY_RESIZE) {
+            continue;
+        }
+        if (cur->buf_idx < 79) {
+            cur->buf[cur->buf_idx++] = c;
+        }
+        redraw_screen(win, cur, *mode);
+        wputchar(win, cur, c);
+        if ((c == 27) || (c == '\n')) {
+            break;
+        }
+        /* only the prompt shown is cut short, never the command */
+        if (buf_index + 1 == capacity) {
+            capacity *= 2;
+            buf = realloc(buf, capacity);
+        }
+        buf[buf_index++] = c;
+    } while ((c = next_key(win, cur)));
+    buf[buf_index] = '\0';
+
+    *mode = NORMAL;
+    wmove(win->curses_win, win->maxlines - 1, 0);
+    waddstr(win->curses_win, blank);
+    cur->x = cur->old_x;
+    cur->y = cur->old_y;
+    cur->prompt = 0;
+    cur->buf_idx = 0;
+    memset(cur->buf, 0, 80);
+
+    if (c == 27) { /* escape key */
+        free(buf);
+        return GET_CHAR;
+    }
+    /* drawing the prompt used up the damage the key made */
+    win->damaged = 1;
+    todo = ex_run(win, cur, mode, buf);
+    free(buf);
+    return todo;
+}
+
+/* starts a new edit for . to repeat, forgetting what was typed last time */
+static void edit_begin(
+    struct Cursor *cur,
+    int op,
+    int motion,
+    size_t count,
+    int reg
+) {
+    cur->edit.op = op;
+    cur->edit.motion = motion;
+    cur->edit.count = count;
+    cur->edit.reg = reg;
+    cur->edit.lines = 0;
+    cur->edit.cols = 0;
+    cur->edit.erased = 0;
+    cur->edit.len = 0;
+}
+
+/* remembers a key typed in insert mode as part of the edit */
+static void edit_typed(struct Cursor *cur, char c) {
+    struct Edit *edit = &cur->edit;
+    if (edit->len >= edit->capacity) {
+        edit->capacity = 1 + (edit->capacity * 2);
+        edit->text = realloc(edit->text, edit->capacity);
+    }
+    edit->text[edit->len++] = c;
+}
+
+/*
+ * inserts n characters at the cursor in one splice, starting a new line
+ * after every newline, and leaves the cursor after the last of them
+ */
+static void insert_text(
+    struct Window *win,
+    struct Cursor *cur,
+    const char *chars,
+    size_t n
+) {
+    struct Text *list;
+    struct Text *tail;
+    struct Text *rest;
+    size_t lines;
+
+    if (!memchr(chars, '\n', n)) {
+        text_insert_chars(cur->line, cur->x, chars, n);
+        cur->x += n;
+        return;
+    }
+    list = text_from_chars(chars, n);
+    lines = text_total_lines(list) - 1;
+    rest = text_cut_chars(cur->line, cur->x, TEXT_ALL_LINES);
+    text_insert_chars(cur->line, TEXT_ALL_LINES, list->data, list->len);
+    tail = text_splice_lines(cur->line, list->next);
+    list->next = NULL;
+    text_free_lines(list);
+
+    n = tail->len;
+    text_insert_chars(tail, TEXT_ALL_LINES, rest->data, rest->len);
+    text_free_lines(rest);
+    if (cur->history.open) {
+        undo_grow(&cur->history,
+            cur->line_no + lines - cur->history.open->line_no + 1);
+    }
+    cursor_down(win, cur, lines);
+    cur->x = n;
+}
+
+/* leaves insert mode, closing the change that entering it started */
+static void insert_end(struct Cursor *cur, enum Mode *mode) {
+    *mode = NORMAL;
+    if (cur->x > 0) {
+        cur->x--;
+    }
+    if (cur->history.open) {
+        change_end(cur, cur->line_no - cur->history.open->line_no + 1);
+    }
+}
+
+/* moves the cursor to where an insert command starts typing */
+static void insert_begin(
+    struct Window *win,
+    struct Cursor *cur,
+    enum Mode *mode,
+    int op
+) {
+    struct Folds *folds = &cur->buffers.list[cur->buffers.current].folds;
+    struct Text *new_line;
+    *mode = INSERT;
+
+    /* typing goes into the lines of a closed fold, so it is opened */
+    if (!cur->history.changed && fold_open(folds, cur->line_no)) {
+        while (fold_open(folds, cur->line_no)) {
+        }
+        damage_windows(win, cur, 1);
+    }
+
+    switch (op) {
+        case 'a':
+            change_begin(cur, 1);
+            if (line_end(cur->line) > 0) {
+                cursor_advance(cur);
+            }
+            break;
+
+        case 'A':
+            change_begin(cur, 1);
+            cur->x = line_end(cur->line);
+            break;
+
+        case 'O':
+            new_line = text_make_line();
+            undo_begin(&cur->history, NULL, cur->line_no, 0, cur->x);
+            text_insert_line(cur->line->prev, new_line, cur->line);
+            if (cur->top_of_text == cur->line) {
+                cur->top_of_text = new_line;
+            }
+            if (cur->top_of_screen == cur->line) {
+                cur->top_of_screen = new_line;
+            }
+            cur->x = 0;
+            cur->line = new_line;
+            break;
+
+        case 'o':
+            new_line = text_make_line();
+            undo_begin(&cur->history, NULL, cur->line_no + 1, 0, cur->x);
+            text_insert_line(cur->line, new_line, cur->line->next);
+            cursor_down(win, cur, 1);
+            cur->x = 0;
+            break;
+
+        default:
+            change_begin(cur, 1);
+            break;
+    }
+}
+
+/*
+ * selects what a repeated visual edit covers: as many lines as before, and
+ * as many characters when it was within one line
+ */
+static void repeat_selection(
+    struct Cursor *cur,
+    struct Edit *edit,
+    struct Selection *sel
+) {
+    sel->first = cur->line;
+    sel->first_no = cur->line_no;
+    sel->last = cur->line;
+    sel->last_no = cur->line_no;
+    for (; sel->last_no - sel->first_no + 1 < edit->lines; sel->last_no++) {
+        if (!sel->last->next) {
+            break;
+        }
+        sel->last = sel->last->next;
+    }
+
+    if (edit->op == 'V') {
+        sel->start = 0;
+        sel->end = line_end(sel->last);
+    } else if (sel->first == sel->last) {
+        sel->start = MIN(cur->x, line_end(sel->first));
+        sel->end = MIN(sel->start + edit->cols, line_end(sel->last));
+    } else {
+        sel->start = MIN(cur->x, line_end(sel->first));
+        sel->end = MIN(edit->cols, line_end(sel->last));
+    }
+}
+
+/*
+ * makes a change described by an edit. normal mode builds the edit from the
+ * keys it reads and . runs the last one again, so both go through here
+ */
+static void edit_apply(
+    struct Window *win,
+    struct Cursor *cur,
+    enum Mode *mode,
+    struct Edit *edit
+) {
+    struct Selection sel;
+    size_t count = edit->count;
+    int reg = edit->reg;
+    size_t pos;
+
+    switch (edit->op) {
+        case 'x':
+            pos = line_end(cur->line);
+            if (cur->x < pos) {
+                delete_chars(cur, reg, chars_after(cur->line, cur->x, count, pos));
+            }
+            break;
+
+        case 'r':
+            if (cur->x < line_end(cur->line)) {
+                /* the whole of a character made of several bytes goes */
+                pos = text_next_char(cur->line, cur->x);
+                change_begin(cur, 1);
+                text_delete_chars(cur->line, cur->x + 1, pos - cur->x - 1);
+                text_unshare(cur->line);
+                cur->line->data[cur->x] = edit->motion;
+                change_end(cur, 1);
+            }
+            break;
+
+        case '~':
+            pos = chars_after(cur->line, cur->x, count, line_end(cur->line));
+            change_begin(cur, 1);
+            change_case(cur->line, cur->x, pos, '~');
+            change_end(cur, 1);
+            cur->x = MIN(pos, last_col(cur->line));
+            break;
+
+        case 'p':
+            put_lines(cur, reg, count);
+            break;
+
+        case '>':
+        case '<':
+            count = lines_from(cur->line, count);
+            change_begin(cur, count);
+            shift_lines(cur->line, count, edit->op == '>');
+            change_end(cur, count);
+            cur->x = 0;
+            break;
+
+        case 'd':
+            switch (edit->motion) {
+                case 'd':
+                    delete_lines(cur, reg, count);
+                    break;
+
+                case 'w':
+                    if (cur->line->data[cur->x] == '\n') {
+                        delete_lines(cur, reg, 1);
+                        break;
+                    }
+                    delete_chars(cur, reg, word_end(cur->line, cur->x, count));
+                    break;
+
+                case '$':
+                    delete_chars(cur, reg, line_end(cur->line));
+                    break;
+
+                default:
+                    break;
+            }
+            break;
+
+        case 'D':
+            delete_chars(cur, reg, line_end(cur->line));
+            break;
+
+        case 'J':
+            join_lines(cur, MAX(count, 2));
+            break;
+
+        case 'v':
+        case 'V':
+            repeat_selection(cur, edit, &sel);
+            visual_operate(
+                win,
+                cur,
+                edit->op == 'v' ? VISUAL : VISUAL_LINE,
+                &sel,
+                edit->motion,
+                reg
+            );
+            break;
+
+        case 'i':
+        case 'a':
+        case 'A':
+        case 'o':
+        case 'O':
+            insert_begin(win, cur, mode, edit->op);
+            break;
+
+        default:
+            break;
+    }
+}
+
+/*
+ * runs the last edit again, with count in place of its own count when one
+ * is given. what was typed into an insert goes in as one block of text
+ */
+static void edit_repeat(
+    struct Window *win,
+    struct Cursor *cur,
+    enum Mode *mode,
+    size_t count,
+    int have_count
+) {
+    struct Edit *edit = &cur->edit;
+    size_t erased;
+    size_t size;
+    int lines;
+    char *chars;
+    char *p;
+
+    if (have_count) {
+        edit->count = count;
+    }
+    edit_apply(win, cur, mode, edit);
+    if (*mode != INSERT) {
+        return;
+    }
+
+    erased = MIN(edit->erased, cur->x);
+    cur->x -= erased;
+    text_delete_chars(cur->line, cur->x, erased);
+
+    /* o and O with a count open that many lines */
+    count = edit->count;
+    lines = (edit->op == 'o') || (edit->op == 'O');
+    if ((edit->len > 0) && (count <= ((size_t)-1) / (edit->len + 1))) {
+        size = (edit->len * count) + (lines ? count - 1 : 0);
+        chars = malloc(size);
+        for (p = chars; count; count--) {
+            memcpy(p, edit->text, edit->len);
+            p += edit->len;
+            if (lines && count > 1) {
+                *p++ = '\n';
+            }
+        }
+        insert_text(win, cur, chars, size);
+        free(chars);
+    }
+    insert_end(cur, mode);
+}
+
+static void completion_end(struct Cursor *cur) {
+    free(cur->completion.matches);
+    memset(&cur->completion, 0, sizeof(cur->completion));
+}
+
+/*
+ * ctrl-n and ctrl-p put the next or the previous word that starts with the
+ * one before the cursor in its place, going round through the word as it
+ * was typed. the matches are looked up once, on the first key
+ */
+static void insert_complete(struct Cursor *cur, int forward) {
+    struct Completion *comp = &cur->completion;
+    const char *word;
+    size_t start;
+    size_t len;
+
+    if (!comp->matches) {
+        for (start = cur->x;
+            start > 0 && words_char((unsigned char)cur->line->data[start - 1]);
+            start--
+        ) {
+        }
+        if (start == cur->x) {
+            return;
+        }
+        count_words(cur, 0, TEXT_ALL_LINES);
+        comp->n = words_complete(
+            cur->line->data + start,
+            cur->x - start,
+            &comp->matches
+        );
+        if (comp->n == 0) {
+            return;
+        }
+        comp->at = comp->n;
+        comp->start = start;
+        comp->prefix = cur->x - start;
+    }
+
+    comp->at = (comp->at + (forward ? 1 : comp->n)) % (comp->n + 1);
+    word = comp->matches[comp->at == comp->n ? 0 : comp->at];
+    len = comp->at == comp->n ? comp->prefix : strlen(word);
+
+    /* the word is typed over the old one, so . puts in what is there now */
+    text_delete_chars(cur->line, comp->start, cur->x - comp->start);
+    for (; cur->x > comp->start; cur->x--) {
+        if (cur->edit.len > 0) {
+            cur->edit.len--;
+        } else {
+            cur->edit.erased++;
+        }
+    }
+    text_insert_chars(cur->line, cur->x, word, len);
+    for (; cur->x < comp->start + len; cur->x++) {
+        edit_typed(cur, word[cur->x - comp->start]);
+    }
+}
+
+static void handle_insert_mode(
+    struct Window *win,
+    struct Cursor *cur,
+    enum Mode *mode,
+    int c
+) {
+    size_t prev;
+    UNUSED(win);
+
+    if (c != 14 && c != 16) {
+        completion_end(cur);
+    }
+
+    switch (c) {
+        case 14: /* ctrl-n */
+        case 16: /* ctrl-p */
+            insert_complete(cur, c == 14);
+            break;
+
+        case 27: /* escape key */
+            insert_end(cur, mode);
+            break;
+
+        case 127: /* backspace key */
+            if (cur->x > 0) {
+                /* takes every byte of the character before the cursor */
+                prev = text_prev_char(cur->line, cur->x);
+                text_delete_chars(cur->line, prev, cur->x - prev);
+                for (; cur->x > prev; cur->x--) {
+                    if (cur->edit.len > 0) {
+                        cur->edit.len--;
+                    } else {
+                        cur->edit.erased++;
+                    }
+                }
+            }
+            break;
+
+        case '\n':
+            edit_typed(cur, c);
+            cur->line = text_split_line(cur->line, cur->x);
+            cur->line_no++;
+            cur->x = 0;
+            if (cur->history.open) {
+                undo_grow(&cur->history,
+                    cur->line_no - cur->history.open->line_no + 1);
+            }
+            /* the window scrolls down to it once it is drawn */
+            cur->y++;
+            break;
+
+        case '\t':
+            edit_typed(cur, c);
+            text_insert_char(cur->line, cur->x, '\t');
+            cur->x++;
+            break;
+
+        default:
+            edit_typed(cur, c);
+            text_insert_char(cur->line, cur->x, c);
+            cursor_advance(cur);
+    }
+}
+
+/*
+ * the z commands. zf and a motion, or zF and a count, fold the lines they
+ * cover. zo and zc open and close the fold at the cursor, za does
+ * whichever it can and zO opens every fold there. zR and zM open and close
+ * all folds, and zd and zE delete the fold at the cursor or all of them
+ */
+static const char *fold_command(
+    struct Window *win,
+    struct Cursor *cur,
+    size_t count
+) {
+    struct Folds *folds = &cur->buffers.list[cur->buffers.current].folds;
+    struct Fold *fold = folded(cur, cur->line_no);
+    size_t first = cur->line_no;
+    size_t last = fold ? fold->last_no : first;
+    const char *err = NULL;
+    int found = 1;
+
+    switch (next_key(win, cur)) {
+        case 'f':
+            switch (read_operator_key(win, cur, &count)) {
+                case 'j':
+                    last = cur->line_no + lines_held(cur, count + 1) - 1;
+                    break;
+
+                case 'k':
+                    first = (count < first) ? first - count : 1;
+                    break;
+
+                case 'G':
+                    last = text_total_lines(cur->top_of_text);
+                    break;
+
+                case 'g':
+                    if (next_key(win, cur) != 'g') {
+                        return NULL;
+                    }
+                    first = 1;
+                    break;
+
+                default:
+                    return NULL;
             }
+            err = fold_add(folds, first, last);
             break;
 
-        case 127: /* backspace key */
-            if (cur->x > 0) {
-                cur->x--;
-                if (cur->line && cur->line->len > 0) {
-                    cur->line->len--;
-                }
-                text_backspace(cur->line, cur->x);
+        case 'F':
+            last = cur->line_no + lines_held(cur, count) - 1;
+            err = fold_add(folds, first, last);
+            break;
+
+        case 'o':
+            found = fold_open(folds, cur->line_no);
+            break;
+
+        case 'O':
+            found = fold_open(folds, cur->line_no);
+            while (fold_open(folds, cur->line_no)) {
             }
             break;
 
-        case '\n':
-            cur->y++;
-            cur->line = text_split_line(cur->line, cur->x);
-            cur->x = 0;
+        case 'c':
+            found = fold_close(folds, cur->line_no) || fold;
             break;
 
-        case '\t':
-            text_insert_char(cur->line, cur->x, '\t');
-            cur->x++;
+        case 'a':
+            found = fold_open(folds, cur->line_no) ||
+                fold_close(folds, cur->line_no);
+            break;
+
+        case 'R':
+            fold_all(folds, 0);
+            break;
+
+        case 'M':
+            fold_all(folds, 1);
+            break;
+
+        case 'd':
+            found = fold_delete(folds, cur->line_no);
+            break;
+
+        case 'E':
+            fold_free(folds);
             break;
 
         default:
-            text_insert_char(cur->line, cur->x, c);
-            cursor_advance(cur);
-            wmove(win->curses_win, cur->y, 0);
-            waddstr(win->curses_win, cur->line->data);
-            wmove(win->curses_win, cur->y, cur->x);
+            return NULL;
     }
+    win->damaged = 1;
+    damage_windows(win, cur, 1);
+    return found ? err : "no fold found";
 }
 
 static enum Todo handle_normal_mode(
@@ -328,100 +3689,122 @@ static enum Todo handle_normal_mode(
     struct Command *cmd
 ) {
     size_t pos;
+    size_t count = 1;
+    int have_count = 0;
+    int reg = 0;
     char msg_buf[80];
     enum Todo todo = GET_CHAR;
+    text_thaw(cur->line);
     cur->line->len = strlen(cur->line->data);
+
+    if (cmd) {
+        if (command_is_count(cmd, c)) {
+            command_add_char(cmd, c);
+            return todo;
+        }
+        if (c == '"') {
+            c = next_key(win, cur);
+            if (register_valid(c)) {
+                cmd->reg = c;
+            }
+            return todo;
+        }
+        have_count = cmd->len > 0;
+        reg = cmd->reg;
+        count = command_count(cmd);
+        command_clear(cmd);
+    }
+
     switch (c) {
         case 27: /* escape key */
-            memset(cmd, 0, 80);
             break;
 
         case 'k':
-            if (cur->line && cur->line->prev) {
-                cur->line_no--;
-                cur->line = cur->line->prev;
-                if (cur->line->len > 2) {
-                    pos = cur->line->len - 2;
-                } else {
-                    pos = 0;
-                }
+            if (!cursor_up(win, cur, count)) {
+                macro_abort(&cur->macro);
+            }
+            break;
 
-                cur->old_x = MAX(cur->x, cur->old_x);
-                cur->x = MIN(cur->old_x, pos);
-                if (cur->y > 0) {
-                    cur->y--;
-                } else {
-                    if (cur->top_of_screen && cur->top_of_screen->prev) {
-                        cur->top_of_screen = cur->top_of_screen->prev;
-                    }
-                }
+        case 23: /* ctrl-w */ {
+            const char *err = window_command(win, cur, next_key(win, cur));
+            if (err) {
+                FLASH_MSG(err);
+                wait_key(win, cur);
+                macro_abort(&cur->macro);
             }
             break;
+        }
 
-        case 'u': {
-            if (!cur->before) {
-                break;
-            } else {
-                char *tmp = cur->line->data;
-                cur->line->data = cur->before;
-                cur->before = tmp;
-                cur->line->len = strlen(cur->line->data);
-                cur->line->capacity = strlen(cur->line->data) + 1;
-                cur->x = 0;
+        case 'z': {
+            const char *err = fold_command(win, cur, count);
+            if (err) {
+                FLASH_MSG(err);
+                wait_key(win, cur);
+                macro_abort(&cur->macro);
             }
             break;
         }
 
-        case '\n':
-        case 'j':
-            if (cur->line && cur->line->next) {
-                cur->line_no++;
-                cur->line = cur->line->next;
-                if (cur->line->len > 2) {
-                    pos = cur->line->len - 2;
-                } else {
-                    pos = 0;
+        case 'u':
+        case 18: /* ctrl-r */ {
+            struct Text *line;
+            size_t line_no;
+            size_t x;
+            for (; count; count--) {
+                line = (c == 'u' ? undo_undo : undo_redo)(
+                    &cur->history,
+                    &cur->top_of_text,
+                    cur->line,
+                    cur->line_no,
+                    &line_no,
+                    &x
+                );
+                if (!line) {
+                    break;
                 }
+                cursor_restore(win, cur, line, line_no, x);
+            }
+            break;
+        }
 
-                cur->old_x = MAX(cur->x, cur->old_x);
-                cur->x = MIN(cur->old_x, pos);
-                if (cur->y < win->maxlines - 2) {
-                    cur->y++;
-                } else {
-                    if (cur->top_of_screen && cur->top_of_screen->next) {
-                        cur->top_of_screen = cur->top_of_screen->next;
-                    }
-                }
+        case '\n':
+        case 'j':
+            if (!cursor_down(win, cur, count)) {
+                macro_abort(&cur->macro);
             }
             break;
 
         case ' ':
         case 'l':
-            if (cur->line->len > 2) {
-                pos = cur->line->len - 2;
-            } else {
-                pos = 0;
-            }
+            pos = last_col(cur->line);
             if (cur->x < pos) {
-                if (cur->x < win->maxcols - 1) {
-                    cur->x++;
-                }
+                cur->x = chars_after(cur->line, cur->x, count, pos);
+            } else {
+                macro_abort(&cur->macro);
             }
-            cur->old_x = cur->x;
+            cur->old_x = text_column(cur->line, cur->x);
             break;
 
         case 'h':
-            if (cur->x > 0) {
-                cur->x--;
+            if (cur->x == 0) {
+                macro_abort(&cur->macro);
+            }
+            for (; count && cur->x > 0; count--) {
+                cur->x = text_prev_char(cur->line, cur->x);
             }
             break;
 
         case 'x':
-            set_clipboard(cur);
-            if ((cur->x < cur->line->len)
-                    && (cur->line->data[cur->x] != '\n')) {
-                text_shift_left(cur->line, cur->x);
-            }
+        case '~':
+        case 'p':
+        case 'D':
+        case 'J':
+            edit_begin(cur, c, 0, count, reg);
+            edit_apply(win, cur, mode, &cur->edit);
+            break;
+
+        case '.':
+            edit_repeat(win, cur, mode, count, have_count);
             break;
 
         case '/':
@@ -433,12 +3816,16 @@ static enum Todo handle_normal_mode(
             cur->old_y = cur->y;
             cur->x = 0;
             cur->y = win->maxlines - 1;
+            cur->prompt = 1;
             cur->x++;
             wmove(win->curses_win, win->maxlines - 1, 0);
             waddstr(win->curses_win, blank);
             wmove(win->curses_win, win->maxlines - 1, 0);
             FLASH_MSG(cur->buf);
-            while ((c = wgetch(win->curses_win))) {
+            while ((c = next_key(win, cur))) {
+                if (c == KEY_RESIZE) {
+                    continue;
+                }
                 if ((c == '\n') || (c == 27)) {
                     break;
                 }
@@ -451,6 +3838,8 @@ static enum Todo handle_normal_mode(
                 wmove(win->curses_win, cur->y, cur->x);
             }
             cur->x = cur->old_x;
+            cur->y = cur->old_y;
+            cur->prompt = 0;
             if (c != 27) {
                 todo = DONT_GET_CHAR;
             } else {
@@ -465,30 +3854,40 @@ static enum Todo handle_normal_mode(
             break;
 
         case 'r':
-            if ((cur->x < cur->line->len)
-                    && (cur->line->data[cur->x] != '\n')) {
-                cur->line->data[cur->x] = wgetch(win->curses_win);
-            }
-            break;
-
-        case '~': {
-            char *under_cursor = &cur->line->data[cur->x];
-            if (isalpha(*under_cursor)) {
-                *under_cursor ^= 0x20;
-            }
-            cursor_advance(cur);
+            edit_begin(cur, c, next_key(win, cur), count, reg);
+            edit_apply(win, cur, mode, &cur->edit);
             break;
-        }
 
         case 'y': {
-            char next_cmd = wgetch(win->curses_win);
+            int next_cmd = read_operator_key(win, cur, &count);
             switch (next_cmd) {
                 case 'y':
-                    if (cur->clipboard) {
-                        free(cur->clipboard->data);
-                        free(cur->clipboard);
-                    }
-                    cur->clipboard = text_copy_line(cur->line);
+                    register_yank(
+                        &cur->registers,
+                        reg,
+                        text_copy_lines(cur->line, lines_held(cur, count)),
+                        0
+                    );
+                    break;
+
+                case 'w':
+                    pos = word_end(cur->line, cur->x, count);
+                    register_yank(
+                        &cur->registers,
+                        reg,
+                        text_copy_chars(cur->line, cur->x, pos - cur->x),
+                        1
+                    );
+                    break;
+
+                case '$':
+                    pos = line_end(cur->line);
+                    register_yank(
+                        &cur->registers,
+                        reg,
+                        text_copy_chars(cur->line, cur->x, pos - cur->x),
+                        1
+                    );
                     break;
 
                 default:
@@ -498,156 +3897,78 @@ static enum Todo handle_normal_mode(
         }
 
         case 'w':
-            c = cur->line->data[cur->x];
-            if ((cur->line->data[cur->x] == '\n') ||
-                (cur->line->data[cur->x + 1] == '\n')
-            ) {
-                handle_normal_mode(win, cur, mode, '0', cmd);
-                handle_normal_mode(win, cur, mode, 'j', cmd);
-            }
-            while (c != ' ' && c != '\n' && c != '\0') {
-                c = cur->line->data[++cur->x];
-            }
-            while (c == ' ' && c != '\n' && c != '\0') {
-                c = cur->line->data[++cur->x];
-            }
-            if ((cur->x > 0) && ((c == '\n') || (c == '\0'))) {
-                cur->x--;
+            for (; count; count--) {
+                c = cur->line->data[cur->x];
+                if ((cur->line->data[cur->x] == '\n') ||
+                    (cur->line->data[cur->x + 1] == '\n')
+                ) {
+                    handle_normal_mode(win, cur, mode, '0', cmd);
+                    handle_normal_mode(win, cur, mode, 'j', cmd);
+                }
+                while (c != ' ' && c != '\n' && c != '\0') {
+                    c = cur->line->data[++cur->x];
+                }
+                while (c == ' ' && c != '\n' && c != '\0') {
+                    c = cur->line->data[++cur->x];
+                }
+                if ((cur->x > 0) && ((c == '\n') || (c == '\0'))) {
+                    cur->x = last_col(cur->line);
+                }
             }
             break;
 
-        case 'p': {
-            if (cur->clipboard) {
-                struct Text *line = text_copy_line(cur->clipboard);
-                text_insert_line(cur->line, line, cur->line->next);
-            }
+        case 'v':
+        case 'V':
+            *mode = (c == 'v') ? VISUAL : VISUAL_LINE;
+            cur->visual_line = cur->line;
+            cur->visual_x = cur->x;
+            cur->visual_line_no = cur->line_no;
             break;
-        }
-
-        case 'd': {
-            char next_c = wgetch(win->curses_win);
-            switch (next_c) {
-                case 'd':
-del_line:
-                    if (cur->top_of_text == cur->line) {
-                        cur->top_of_text = cur->line->next;
-                        cur->top_of_screen = cur->top_of_text;
-                    }
-                    if (cur->y > 0) {
-                        struct Text *tmp;
-                        if (cur->clipboard) {
-                            free(cur->clipboard->data);
-                            free(cur->clipboard);
-                        }
-                        cur->clipboard = text_copy_line(cur->line);
-                        cur->line->prev->next = cur->line->next;
-                        if (cur->line->next) {
-                            cur->line->next->prev = cur->line->prev;
-                            tmp = cur->line;
-                            cur->line = cur->line->next;
-                        } else {
-                            tmp = cur->line;
-                            cur->line = cur->line->prev;
-                            cur->line->next = NULL;
-                        }
-                        free(tmp->data);
-                        free(tmp);
-                        cmd->len = 0;
-                        memset(cmd, 0, 80);
-                    } else {
-                        handle_normal_mode(win, cur, mode, 'D', cmd);
-                        cur->y = 0;
-                        cur->x = 0;
-                    }
-                    break;
 
-                case 'w': {
-                    char was_on_space = 0;
-                    char *data = cur->line->data;
-                    set_clipboard(cur);
-                    if (data[cur->x] == '\n') {
-                        goto del_line;
-                    }
-                    text_shift_left(cur->line, cur->x);
-                    while (data[cur->x] == ' ' ||  data[cur->x] == '\t') {
-                        text_shift_left(cur->line, cur->x);
-                        was_on_space = 1;
-                    }
-                    if (!was_on_space) {
-                        for (;
-                            isalnum(data[cur->x]) ||
-                            data[cur->x] == '_';
-                        ) {
-                            text_shift_left(cur->line, cur->x);
-                        }
-                    }
-                    break;
-                }
+        case '>':
+        case '<':
+            if (read_operator_key(win, cur, &count) == c) {
+                edit_begin(cur, c, c, lines_held(cur, count), reg);
+                edit_apply(win, cur, mode, &cur->edit);
             }
             break;
-        }
 
-        case 'D': {
-            cur->line->data[cur->x] = '\n';
-            cur->line->data[cur->x + 1] = '\0';
-            cur->x--;
-            cur->line->len = cur->x;
+        case 'd': {
+            int next_c = read_operator_key(win, cur, &count);
+            if (next_c == 'd') {
+                count = lines_held(cur, count);
+            }
+            edit_begin(cur, c, next_c, count, reg);
+            edit_apply(win, cur, mode, &cur->edit);
             break;
         }
 
         case '$':
         case 'E':
-            if (cur->line->len > 2) {
-                pos = cur->line->len - 2;
-            } else {
-                pos = 0;
-            }
             cur->old_x = SIZE_MAX;
-            cur->x = pos;
-            break;
-
-        case 'O': {
-            struct Text *new_line = text_make_line();
-            *mode = INSERT;
-            set_clipboard(cur);
-            text_insert_line(cur->line->prev, new_line, cur->line);
-            cur->x = 0;
-            cur->line = new_line;
-            break;
-        }
-
-        case 'o': {
-            struct Text *new_line = text_make_line();
-            *mode = INSERT;
-            free(cur->before);
-            cur->before = strdup(cur->line->data);
-
-            cur->y++;
-            cur->line_no++;
-            cur->x = 0;
-
-            text_insert_line(cur->line, new_line, cur->line->next);
-
-            cur->line = new_line;
-            text_push_char(cur->line, '\n');
-
+            cur->x = last_col(cur->line);
             break;
-        }
 
         case 'i':
+        case 'a':
+        case 'A':
+        case 'o':
+        case 'O':
             memset(cur->buf, 0, 80);
             cur->buf_idx = 0;
-            *mode = INSERT;
-            free(cur->before);
-            cur->before = strdup(cur->line->data);
+            edit_begin(cur, c, 0, 1, reg);
+            edit_apply(win, cur, mode, &cur->edit);
             wmove(win->curses_win, cur->y, cur->x);
             break;
 
         case 'g': {
-            char next_c = wgetch(win->curses_win);
+            char next_c = next_key(win, cur);
             switch (next_c) {
                 case 'g':
-                    cur->x = 0;
+                    if (have_count) {
+                        cursor_goto_line(win, cur, count);
+                        break;
+                    }
                     cur->x = 0;
                     cur->y = 0;
                     cur->line_no = 1;
@@ -661,37 +3982,88 @@ del_line:
             break;
         }
 
-        case 'G':
+        case 'G': {
+            struct Text *below;
+            if (have_count) {
+                cursor_goto_line(win, cur, count);
+                break;
+            }
             cur->y = 0;
             cur->line_no = 1;
             cur->line = cur->top_of_text;
             cur->top_of_screen = cur->top_of_text;
             cur->x = 0;
-            for (; cur->line && cur->line->next; cur->line = cur->line->next) {
-                cur->line_no++;
+            while ((below = line_below(cur, cur->line, &cur->line_no))) {
+                cur->line = below;
             }
             cur->top_of_screen = cur->line;
             break;
+        }
 
-        case 'a':
-            free(cur->before);
-            cur->before = strdup(cur->line->data);
-            *mode = INSERT;
-            cursor_advance(cur);
-            wmove(win->curses_win, cur->y, cur->x);
+        case '0':
+            cur->old_x = 0;
+            cur->x = 0;
             break;
 
-        case 'A':
-            free(cur->before);
-            cur->before = strdup(cur->line->data);
-            *mode = INSERT;
-            cur->x = cur->line->len - 1;
+        case '%': {
+            struct Text *line = cur->line;
+            size_t line_no = cur->line_no;
+            pos = cur->x;
+            if (bracket_match(&line, &line_no, &pos)) {
+                cursor_jump(win, cur, line, line_no, pos);
+            }
+            break;
+        }
+
+        case 'm':
+            c = next_key(win, cur);
+            if (c >= 'a' && c <= 'z') {
+                cur->marks[c - 'a'] = cur->line_no;
+            }
             break;
 
-        case '0':
-            cur->old_x = 0;
-            cur->x = 0;
+        case '\'':
+            c = next_key(win, cur);
+            if (c >= 'a' && c <= 'z' && cur->marks[c - 'a']) {
+                cursor_goto_line(win, cur, cur->marks[c - 'a']);
+            }
+            break;
+
+        case 'q':
+            if (cur->macro.recording) {
+                c = cur->macro.recording;
+                register_set(&cur->registers, c, macro_stop(&cur->macro), 1);
+                break;
+            }
+            c = next_key(win, cur);
+            if (register_valid(c) && (c != '"')) {
+                macro_record(&cur->macro, c);
+            }
+            break;
+
+        case '@': {
+            struct Register *macro;
+            c = next_key(win, cur);
+            if (c == '@') {
+                c = cur->last_macro;
+            }
+            if (!register_valid(c) || (c == '"')) {
+                break;
+            }
+            macro = register_get(&cur->registers, c);
+            if (!macro->text) {
+                break;
+            }
+            cur->last_macro = c;
+
+            /* everything the replay changes is undone together */
+            if (!cur->macro.playing) {
+                cur->macro.playing = 1;
+                undo_group_begin(&cur->history);
+            }
+            macro_play(&cur->macro, macro->text, count);
             break;
+        }
 
         case ':':
             *mode = EX;
@@ -702,6 +4074,7 @@ del_line:
             cur->old_y = cur->y;
             cur->x = 0;
             cur->y = win->maxlines - 1;
+            cur->prompt = 1;
             wmove(win->curses_win, win->maxlines - 1, 0);
             waddstr(win->curses_win, blank);
             wmove(win->curses_win, win->maxlines - 1, 0);
@@ -728,6 +4101,113 @@ del_line:
     return todo;
 }
 
+static enum Todo handle_visual_mode(
+    struct Window *win,
+    struct Cursor *cur,
+    enum Mode *mode,
+    int c,
+    struct Command *cmd
+) {
+    struct Selection sel;
+    struct Text *line;
+    const char *err;
+    size_t x;
+    size_t line_no;
+    int reg = cmd->reg;
+
+    if (command_is_count(cmd, c)) {
+        return handle_normal_mode(win, cur, mode, c, cmd);
+    }
+
+    switch (c) {
+        case 27: /* escape key */
+            command_clear(cmd);
+            *mode = NORMAL;
+            break;
+
+        case 'v':
+            *mode = (*mode == VISUAL) ? NORMAL : VISUAL;
+            break;
+
+        case 'V':
+            *mode = (*mode == VISUAL_LINE) ? NORMAL : VISUAL_LINE;
+            break;
+
+        case 'o':
+            line = cur->visual_line;
+            x = cur->visual_x;
+            line_no = cur->visual_line_no;
+            cur->visual_line = cur->line;
+            cur->visual_x = cur->x;
+            cur->visual_line_no = cur->line_no;
+            cursor_goto_line(win, cur, line_no);
+            cur->x = MIN(x, last_col(line));
+            break;
+
+        case 'd':
+        case 'x':
+        case 'y':
+        case '>':
+        case '<':
+        case '~':
+        case 'u':
+        case 'U':
+            command_clear(cmd);
+            get_selection(cur, *mode, &sel);
+            if (c != 'y') {
+                edit_begin(cur, (*mode == VISUAL) ? 'v' : 'V', c, 1, reg);
+                cur->edit.lines = sel.last_no - sel.first_no + 1;
+                cur->edit.cols = sel.end;
+                if (sel.first == sel.last) {
+                    cur->edit.cols -= sel.start;
+                }
+            }
+            visual_operate(win, cur, *mode, &sel, c, reg);
+            *mode = NORMAL;
+            win->damaged = 1;
+            break;
+
+        case 'z':
+            command_clear(cmd);
+            if (next_key(win, cur) != 'f') {
+                break;
+            }
+            get_selection(cur, *mode, &sel);
+            err = fold_add(&cur->buffers.list[cur->buffers.current].folds,
+                sel.first_no, sel.last_no);
+            if (err) {
+                FLASH_MSG(err);
+                wait_key(win, cur);
+                macro_abort(&cur->macro);
+            }
+            *mode = NORMAL;
+            win->damaged = 1;
+            damage_windows(win, cur, 1);
+            break;
+
+        case 'h':
+        case 'j':
+        case 'k':
+        case 'l':
+        case ' ':
+        case '\n':
+        case 'w':
+        case '$':
+        case 'E':
+        case '0':
+        case '%':
+        case 'g':
+        case 'G':
+        case '"':
+        case '\f':
+            return handle_normal_mode(win, cur, mode, c, cmd);
+
+        default:
+            break;
+    }
+    return GET_CHAR;
+}
+
 static long get_index_in_str(const char *line, const char *search_term) {
     char *str;
     if ((str = strstr(line, search_term))) {
@@ -750,7 +4230,7 @@ static void handle_search_mode(
 
     FLASH_MSG(cur->buf);
     while (line) {
-        index = get_index_in_str(line->data, cur->buf + 1);
+        index = get_index_in_str(text_peek(line), cur->buf + 1);
         line_no++;
         if (index >= 0) {
             cur->x = index;
@@ -769,7 +4249,8 @@ static void handle_search_mode(
         char buf[80];
         sprintf(buf, "'%s': not found", cur->buf + 1);
         FLASH_MSG(buf);
-        wgetch(win->curses_win);
+        wait_key(win, cur);
+        macro_abort(&cur->macro);
         cur->x = 0;
         cur->y = 0;
     }
@@ -780,60 +4261,73 @@ static enum Todo handle_input(
     struct Cursor *cur,
     enum Mode *mode,
     int c,
-    struct Command *cmd,
-    char *filename
+    struct Command *cmd
 ) {
     enum Todo todo = GET_CHAR;
+
+    /* the windows were laid out again while waiting for the key */
+    if (c == KEY_RESIZE) {
+        return GET_CHAR;
+    }
+
+    /* only visual mode keeps track of which rows it changed */
+    if (!is_visual(*mode)) {
+        win->damaged = 1;
+    }
     switch (*mode) {
         case NORMAL:
             todo = handle_normal_mode(win, cur, mode, c, cmd);
-            getmaxyx(win->curses_win, win->maxlines, win->maxcols);
-            wmove(win->curses_win, cur->y, cur->x);
-            wrefresh(win->curses_win);
             break;
 
         case INSERT:
+            text_thaw(cur->line);
             cur->line->len = strlen(cur->line->data);
             handle_insert_mode(win, cur, mode, c);
             break;
 
         case EX:
-            todo = handle_ex_mode(win, cur, mode, filename, c);
+            todo = handle_ex_mode(win, cur, mode, c);
             break;
 
         case SEARCH:
             handle_search_mode(win, cur, mode);
             break;
 
+        case VISUAL:
+        case VISUAL_LINE:
+            todo = handle_visual_mode(win, cur, mode, c, cmd);
+            break;
+
         case QUIT:
             return TERMINATE;
     }
 
-    getmaxyx(win->curses_win, win->maxlines, win->maxcols);
-    wmove(win->curses_win, cur->y, cur->x);
-    wrefresh(win->curses_win);
+    if (!cur->macro.playing) {
+        wmove(win->curses_win, cur->y, cur->x);
+        wrefresh(win->curses_win);
+    }
     return todo;
 }
 
-static int event_loop(
-    struct Window *win,
-    struct Cursor *cur,
-    char *filename
-) {
+static int event_loop(struct Window *win, struct Cursor *cur) {
     int c = '\n';
     enum Todo todo = GET_CHAR;
     enum Mode mode = NORMAL;
     struct Command cmd;
+    size_t changed;
+    size_t end;
+    long shift;
     cur->x = 0;
     cur->y = 0;
-    cmd.len = 0;
-    memset(&cmd.data, 0, 80);
+    command_clear(&cmd);
     redraw_screen(win, cur, mode);
     while (1) {
         if (todo == GET_CHAR) {
-            c = wgetch(win->curses_win);
+            c = next_key(win, cur);
         }
-        todo = handle_input(win, cur, &mode, c, &cmd, filename);
+        PROFILE_BEGIN(PHASE_INPUT);
+        todo = handle_input(win, cur, &mode, c, &cmd);
+        PROFILE_END(PHASE_INPUT);
         switch (todo) {
             case DONT_GET_CHAR:
             case GET_CHAR:
@@ -841,7 +4335,26 @@ static int event_loop(
             case TERMINATE:
                 goto quit;
         }
+        changed = undo_changed(&cur->history, &end, &shift);
+        if (changed) {
+            fold_changed(&cur->buffers.list[cur->buffers.current].folds,
+                changed, end, shift);
+            marks_changed(cur, changed, end, shift);
+            damage_windows(win, cur, changed);
+            syntax_changed(&cur->buffers.list[cur->buffers.current].syntax,
+                changed);
+        }
+        fold_settle(win, cur);
+        freeze_cold(win, cur, changed);
+        count_words(cur, changed, WORDS_BATCH);
+        if (cur->macro.playing && !macro_pending(&cur->macro)) {
+            cur->macro.playing = 0;
+            undo_group_end(&cur->history);
+            win->damaged = 1;
+        }
+        PROFILE_BEGIN(PHASE_REDRAW);
         redraw_screen(win, cur, mode);
+        PROFILE_END(PHASE_REDRAW);
     }
 quit:
     return 1;
@@ -849,66 +4362,108 @@ quit:
 
 int main(int argc, char **argv) {
     struct Window win;
-    FILE *fp = NULL;
-    char *filename = NULL;
     struct Cursor cur;
-    struct Text *line;
-    struct Text *next;
+    const char *err = NULL;
+    int binary;
 
     signal(SIGINT, sigint_handler);
 
+    /* set before curses starts, so that it leaves resizes to us */
+    signal(SIGWINCH, sigwinch_handler);
+
     cur.x = 0;
     cur.old_x = 0;
     cur.y = 0;
     cur.old_y = 0;
-    cur.line = text_make_line();
-    cur.top_of_text = cur.line;
-    cur.clipboard = NULL;
+    cur.prompt = 0;
+    memset(&cur.registers, 0, sizeof(cur.registers));
+    cur.visual_line = NULL;
+    cur.visual_x = 0;
+    cur.visual_line_no = 0;
     cur.line_no = 1;
     cur.buf = calloc(1, 80);
     cur.buf_idx = 0;
-    cur.before = NULL;
+    memset(&cur.history, 0, sizeof(cur.history));
+    memset(&cur.macro, 0, sizeof(cur.macro));
+    cur.last_macro = 0;
+    memset(&cur.edit, 0, sizeof(cur.edit));
+    memset(cur.marks, 0, sizeof(cur.marks));
+    memset(&cur.quickfix, 0, sizeof(cur.quickfix));
+    cur.compress = 0;
+    cur.undofile = 0;
+    cur.cold_line = NULL;
+    cur.cold_no = 0;
+    memset(&cur.completion, 0, sizeof(cur.completion));
 
-    /* setup curses */
+    /* setup curses, drawing utf-8 if the terminal takes it */
+    setlocale(LC_CTYPE, "");
     initscr();
     cbreak();
     noecho();
+    init_colors();
 
     clear();
 
     win.maxlines = LINES;
     win.maxcols = COLS;
+    win.rows = NULL;
+    win.nrows = 0;
+    win.damaged = 1;
+    win.split = split_new(&win, win.maxlines, win.maxcols);
+    win.top = NULL;
+    win.top_no = 1;
+    win.wrap = 1;
+    win.left = 0;
+    win.skip_line = NULL;
+    win.skip = 0;
+    win.line_no = 1;
+    win.x = 0;
+    win.y = 0;
 
-    if (argc == 2) {
-        filename = argv[1];
-        fp = fopen(argv[1], "r");
-        if (fp) {
-            text_read_from_file(cur.line, fp);
-            fclose(fp);
-        }
+    /* vin -b file looks at the file as bytes, with no text loaded */
+    binary = argc == 3 && !strcmp(argv[1], "-b");
+    if (binary) {
+        buffers_open(&cur.buffers, NULL, 0);
+    } else {
+        buffers_open(&cur.buffers, argv + 1, argc - 1);
     }
-
+    cur.top_of_text = cur.buffers.list[0].top_of_text;
+    cur.history = cur.buffers.list[0].history;
     cur.line = cur.top_of_text;
     cur.top_of_screen = cur.top_of_text;
+    cur.words_line = cur.top_of_text;
+    cur.words_no = 1;
     win.curses_win = newwin(win.maxlines, win.maxcols, cur.x, cur.y);
-    event_loop(&win, &cur, filename);
-
-    line = cur.top_of_text;
-    while (line) {
-        next = line->next;
-        free(line->data);
-        free(line); 
-        line = next;
+    if (binary) {
+        err = hex_file(&win, &cur, argv[2]);
+    } else {
+        event_loop(&win, &cur);
     }
 
-    free(cur.clipboard);
+    buffer_save(&cur);
+    buffers_free(&cur.buffers);
+    completion_end(&cur);
+    words_free();
+    grep_free(&cur.quickfix);
+
+    register_free(&cur.registers);
     free(cur.buf);
-    free(cur.before);
+    macro_free(&cur.macro);
+    free(cur.edit.text);
+    windows_free(&win);
+    free(win.rows);
+#ifdef PROFILE
+    profile_exit();
+#endif
 
     /* exit curses */
     clrtoeol();
     refresh();
     endwin();
 
+    if (err) {
+        fprintf(stderr, "vin: %s: %s\n", argv[2], err);
+        return 1;
+    }
     return 0;
 }
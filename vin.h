@@ -21,29 +21,138 @@
 #include <stdio.h>
 #include <curses.h>
 
+#include "register.h"
+#include "undo.h"
+#include "macro.h"
+#include "ex.h"
+#include "buffer.h"
+#include "split.h"
+#include "grep.h"
+#include "hex.h"
+
 #ifndef SIZE_MAX
 #define SIZE_MAX sizeof(size_t)
 #endif
 
+/*
+ * the last change, compiled down to what . needs to make it again: the
+ * command and the key after it (d and w for dw), its count and register,
+ * the size of a visual selection, and what was typed in insert mode
+ */
+struct Edit {
+    int op;
+    int motion;
+    int reg;
+    size_t count;
+    size_t lines;
+    size_t cols;
+    size_t erased;
+    char *text;
+    size_t len;
+    size_t capacity;
+};
+
+/*
+ * the words Ctrl-N and Ctrl-P go through in insert mode. the word being
+ * completed starts at start on the cursor line, prefix bytes of it were
+ * typed, and at is the match in place, or n for the prefix as typed
+ */
+struct Completion {
+    const char **matches;
+    size_t n;
+    size_t at;
+    size_t start;
+    size_t prefix;
+};
+
 struct Cursor {
     size_t x;
     size_t y;
     size_t old_x;
     size_t old_y;
+    int prompt;
     size_t line_no;
     size_t buf_idx;
     struct Text *line;
     struct Text *top_of_text;
     struct Text *top_of_screen;
-    struct Text *clipboard;
+    struct Registers registers;
     char *buf;
-    char *before;
+    struct History history;
+    struct Macro macro;
+    int last_macro;
+    struct Edit edit;
+    size_t marks[EX_MARKS];
+    struct Buffers buffers;
+    struct Quickfix quickfix;
+    struct Text *visual_line;
+    size_t visual_x;
+    size_t visual_line_no;
+    int compress;
+    int undofile;
+    struct Text *cold_line;
+    size_t cold_no;
+    struct Text *words_line;
+    size_t words_no;
+    struct Completion completion;
 };
 
+/*
+ * what a screen row showed the last time it was drawn: a line, or which of
+ * the rows it wraps to. a stale row is drawn again because the text under it
+ * changed in another window
+ */
+struct Row {
+    struct Text *line;
+    size_t part;
+    size_t sel_start;
+    size_t sel_end;
+    int stale;
+};
+
+/*
+ * one view of the text. the cursor belongs to the window in use; the others
+ * keep where it was in them by line number, and the first line they show,
+ * which is forgotten when a change may have freed it. long lines either wrap,
+ * with the first skip rows of skip_line scrolled off the top when it is the
+ * first line shown, or are cut off, with the columns before left scrolled
+ * off to the side
+ */
 struct Window {
     WINDOW *curses_win;
     size_t maxlines;
     size_t maxcols;
+    struct Row *rows;
+    size_t nrows;
+    int damaged;
+    struct Split *split;
+    struct Text *top;
+    size_t top_no;
+    size_t line_no;
+    size_t x;
+    size_t y;
+    int wrap;
+    size_t left;
+    struct Text *skip_line;
+    size_t skip;
+};
+
+/*
+ * where the hex view is: the offset of the first byte shown and of the one
+ * under the cursor, how many bytes a row shows after an offset digits wide,
+ * whether the cursor is on the text side of the rows rather than the hex
+ * side, whether bytes are being typed over, with the next hex digit the
+ * low half of the byte, and whether anything has been written to the file
+ */
+struct HexView {
+    size_t top;
+    size_t at;
+    size_t width;
+    size_t digits;
+    int text;
+    int replace;
+    int low;
+    int written;
 };
 
 enum Mode {
@@ -51,7 +160,9 @@ enum Mode {
     INSERT,
     EX,
     QUIT,
-    SEARCH
+    SEARCH,
+    VISUAL,
+    VISUAL_LINE
 };
 
 #endif /* VIN_H */
@@ -0,0 +1,395 @@
+/*
+ *     Copyright (C) 2020 Kyle Kloberdanz
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "words.h"
+
+/*
+ * a word in the index, followed by its bytes and a nul. a word that is no
+ * longer in any line stays with a count of 0 until words_sweep, so that the
+ * words handed out by words_complete are not freed from under a completion
+ */
+struct Word {
+    size_t count;
+    size_t len;
+};
+
+#define WORD_TEXT(WORD) ((char *)((WORD) + 1))
+
+#define MAX(A, B) ((A) > (B) ? (A) : (B))
+
+/*
+ * the words starting with one byte, in no order until they are first asked
+ * for. once sorted, new words go straight into their place
+ */
+struct Bucket {
+    struct Word **words;
+    size_t n;
+    size_t capacity;
+    int sorted;
+};
+
+/*
+ * finds a word from its bytes, open addressed with a power of two size. the
+ * hash is kept in the slot so that going past other words does not have to
+ * look at them
+ */
+struct Slot {
+    unsigned long hash;
+    struct Word *word;
+};
+
+static struct Slot *table = NULL;
+static size_t table_size = 0;
+static size_t table_used = 0;
+
+/*
+ * the words are never freed one at a time, so they are handed out from
+ * blocks of WORDS_BLOCK bytes, or one of their own for a longer word
+ */
+struct Block {
+    struct Block *next;
+    size_t used;
+    size_t size;
+};
+
+static struct Block *blocks = NULL;
+
+static struct Bucket buckets[256];
+static size_t word_bytes = 0;
+
+/* how many words have a count of 0, and the bytes they take in blocks */
+static size_t dead = 0;
+static size_t dead_bytes = 0;
+
+#define WORDS_MIN_TABLE 1024
+#define WORDS_BLOCK 65536
+
+/* dead words are left until there are this many, or a block of them */
+#define WORDS_MIN_DEAD 1024
+
+#define ALIGN(N) (((N) + sizeof(size_t) - 1) & ~(sizeof(size_t) - 1))
+
+#define WORD_SIZE(N) ALIGN(sizeof(struct Word) + (N) + 1)
+
+int words_char(int c) {
+    return c >= 0x80 || isalnum(c) || c == '_';
+}
+
+static unsigned long hash_bytes(const char *p, size_t n) {
+    unsigned long hash = 2166136261UL;
+    for (; n > 0; n--, p++) {
+        hash = ((hash ^ (unsigned char)*p) * 16777619UL) & 0xffffffffUL;
+    }
+    return hash;
+}
+
+static struct Slot *table_slot(const char *p, size_t n, unsigned long hash) {
+    size_t i = hash & (table_size - 1);
+    for (; table[i].word; i = (i + 1) & (table_size - 1)) {
+        if (table[i].hash == hash && table[i].word->len == n &&
+            memcmp(WORD_TEXT(table[i].word), p, n) == 0
+        ) {
+            break;
+        }
+    }
+    return &table[i];
+}
+
+static void table_grow(void) {
+    struct Slot *old = table;
+    size_t old_size = table_size;
+    size_t i;
+    size_t j;
+
+    table_size = old_size ? old_size * 2 : WORDS_MIN_TABLE;
+    table = calloc(table_size, sizeof(struct Slot));
+    for (i = 0; i < old_size; i++) {
+        if (old[i].word) {
+            /* the words are all different, so only a free slot is needed */
+            for (j = old[i].hash & (table_size - 1); table[j].word;
+                j = (j + 1) & (table_size - 1)
+            ) {
+            }
+            table[j] = old[i];
+        }
+    }
+    free(old);
+}
+
+static struct Word *word_alloc(size_t n) {
+    size_t size = WORD_SIZE(n);
+    struct Block *block = blocks;
+    struct Word *word;
+
+    if (!block || block->used + size > block->size) {
+        block = malloc(sizeof(struct Block) + MAX(size, WORDS_BLOCK));
+        block->size = MAX(size, WORDS_BLOCK);
+        block->used = 0;
+        word_bytes += sizeof(struct Block) + block->size;
+        if (blocks && size > WORDS_BLOCK) {
+            /* the block being filled stays at the front */
+            block->next = blocks->next;
+            blocks->next = block;
+        } else {
+            block->next = blocks;
+            blocks = block;
+        }
+    }
+    word = (struct Word *)((char *)(block + 1) + block->used);
+    block->used += size;
+    return word;
+}
+
+static int compare_words(const void *a, const void *b) {
+    return strcmp(
+        WORD_TEXT(*(struct Word *const *)a),
+        WORD_TEXT(*(struct Word *const *)b)
+    );
+}
+
+/* the first word in a sorted bucket that is not before the n bytes at p */
+static size_t lower_bound(struct Bucket *bucket, const char *p, size_t n) {
+    size_t low = 0;
+    size_t high = bucket->n;
+    size_t mid;
+    struct Word *word;
+    int cmp;
+
+    while (low < high) {
+        mid = low + (high - low) / 2;
+        word = bucket->words[mid];
+        cmp = memcmp(WORD_TEXT(word), p, word->len < n ? word->len : n);
+        if (cmp < 0 || (cmp == 0 && word->len < n)) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    return low;
+}
+
+static void bucket_add(struct Word *word) {
+    struct Bucket *bucket = &buckets[(unsigned char)WORD_TEXT(word)[0]];
+    size_t i = bucket->n;
+
+    if (bucket->n == bucket->capacity) {
+        bucket->capacity = 1 + (bucket->capacity * 2);
+        bucket->words = realloc(
+            bucket->words,
+            bucket->capacity * sizeof(struct Word *)
+        );
+    }
+    if (bucket->sorted) {
+        i = lower_bound(bucket, WORD_TEXT(word), word->len);
+        memmove(
+            bucket->words + i + 1,
+            bucket->words + i,
+            (bucket->n - i) * sizeof(struct Word *)
+        );
+    }
+    bucket->words[i] = word;
+    bucket->n++;
+}
+
+static void word_adjust(const char *p, size_t n, int by) {
+    struct Slot *slot;
+    struct Word *word;
+    unsigned long hash;
+
+    if (n < 2) {
+        return;
+    }
+    if ((table_used + 1) * 4 > table_size * 3) {
+        table_grow();
+    }
+    hash = hash_bytes(p, n);
+    slot = table_slot(p, n, hash);
+    if (!slot->word && by < 0) {
+        return;
+    }
+    if (!slot->word) {
+        word = word_alloc(n);
+        word->count = 0;
+        word->len = n;
+        memcpy(WORD_TEXT(word), p, n);
+        WORD_TEXT(word)[n] = '\0';
+        slot->hash = hash;
+        slot->word = word;
+        table_used++;
+        dead++;
+        dead_bytes += WORD_SIZE(n);
+        bucket_add(word);
+    }
+    if (by > 0 && slot->word->count++ == 0) {
+        dead--;
+        dead_bytes -= WORD_SIZE(n);
+    } else if (by < 0 && slot->word->count > 0 && --slot->word->count == 0) {
+        dead++;
+        dead_bytes += WORD_SIZE(n);
+    }
+}
+
+static void line_words(struct Text *line, int by) {
+    const char *data = text_peek(line);
+    const char *start;
+
+    while (*data) {
+        for (; *data && !words_char((unsigned char)*data); data++) {
+        }
+        for (start = data; *data && words_char((unsigned char)*data); data++) {
+        }
+        word_adjust(start, data - start, by);
+    }
+}
+
+void words_count(struct Text *line) {
+    if (!line->words) {
+        line_words(line, 1);
+        line->words = 1;
+    }
+}
+
+void words_forget(struct Text *line) {
+    if (line->words) {
+        line_words(line, -1);
+        line->words = 0;
+    }
+}
+
+size_t words_complete(const char *prefix, size_t n, const char ***matches) {
+    struct Bucket *bucket;
+    struct Word *word;
+    size_t capacity = 0;
+    size_t found = 0;
+    size_t i;
+
+    *matches = NULL;
+    if (n == 0) {
+        return 0;
+    }
+    bucket = &buckets[(unsigned char)prefix[0]];
+    if (!bucket->sorted) {
+        qsort(bucket->words, bucket->n, sizeof(struct Word *), compare_words);
+        bucket->sorted = 1;
+    }
+    for (i = lower_bound(bucket, prefix, n); i < bucket->n; i++) {
+        word = bucket->words[i];
+        if (word->len < n || memcmp(WORD_TEXT(word), prefix, n) != 0) {
+            break;
+        }
+        if (word->count == 0 || word->len == n) {
+            continue;
+        }
+        if (found == capacity) {
+            capacity = 1 + (capacity * 2);
+            *matches = realloc(*matches, capacity * sizeof(char *));
+        }
+        (*matches)[found++] = WORD_TEXT(word);
+    }
+    return found;
+}
+
+void words_sweep(void) {
+    struct Block *old = blocks;
+    struct Block *next;
+    struct Bucket *bucket;
+    struct Word *word;
+    struct Slot *slot;
+    unsigned long hash;
+    size_t kept;
+    size_t i;
+    size_t j;
+
+    /* dead words go once they are as many, or as big, as the live ones */
+    if ((dead < WORDS_MIN_DEAD || dead * 2 < table_used) &&
+        (dead_bytes < WORDS_BLOCK || dead_bytes * 2 < word_bytes)
+    ) {
+        return;
+    }
+    blocks = NULL;
+    word_bytes = 0;
+    free(table);
+    table = NULL;
+    table_size = 0;
+    table_used = 0;
+    dead = 0;
+    dead_bytes = 0;
+
+    /* the live words move to new blocks, keeping their order in buckets */
+    for (i = 0; i < sizeof(buckets) / sizeof(buckets[0]); i++) {
+        bucket = &buckets[i];
+        for (j = 0, kept = 0; j < bucket->n; j++) {
+            if (bucket->words[j]->count == 0) {
+                continue;
+            }
+            word = word_alloc(bucket->words[j]->len);
+            memcpy(word, bucket->words[j],
+                sizeof(struct Word) + bucket->words[j]->len + 1);
+            bucket->words[kept++] = word;
+
+            if ((table_used + 1) * 4 > table_size * 3) {
+                table_grow();
+            }
+            hash = hash_bytes(WORD_TEXT(word), word->len);
+            slot = table_slot(WORD_TEXT(word), word->len, hash);
+            slot->hash = hash;
+            slot->word = word;
+            table_used++;
+        }
+        bucket->n = kept;
+    }
+
+    for (; old; old = next) {
+        next = old->next;
+        free(old);
+    }
+}
+
+size_t words_measure(void) {
+    size_t bytes = table_size * sizeof(struct Slot) + word_bytes;
+    size_t i;
+
+    for (i = 0; i < sizeof(buckets) / sizeof(buckets[0]); i++) {
+        bytes += buckets[i].capacity * sizeof(struct Word *);
+    }
+    return bytes;
+}
+
+void words_free(void) {
+    struct Block *next;
+    size_t i;
+
+    for (; blocks; blocks = next) {
+        next = blocks->next;
+        free(blocks);
+    }
+    free(table);
+    table = NULL;
+    table_size = 0;
+    table_used = 0;
+    for (i = 0; i < sizeof(buckets) / sizeof(buckets[0]); i++) {
+        free(buckets[i].words);
+    }
+    memset(buckets, 0, sizeof(buckets));
+    word_bytes = 0;
+    dead = 0;
+    dead_bytes = 0;
+}
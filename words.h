@@ -0,0 +1,67 @@
+/*
+ *     Copyright (C) 2020 Kyle Kloberdanz
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef WORDS_H
+#define WORDS_H
+
+#include "text.h"
+
+/*
+ * every word of two or more letters, digits and underscores in the lines
+ * counted so far, in all buffers, kept up to date as those lines change or
+ * go. bytes of utf-8 characters count as letters
+ */
+
+/**
+ * true if c, a byte, can be part of a word
+ */
+int words_char(int c);
+
+/**
+ * adds the words of line to the index, unless they are there already
+ */
+void words_count(struct Text *line);
+
+/**
+ * takes the words of line back out of the index. done before a counted
+ * line is written to, cut out of the text or freed
+ */
+void words_forget(struct Text *line);
+
+/**
+ * the words in the index that start with the n bytes at prefix and go on
+ * past them, in order. sets *matches to an array of them, which the caller
+ * frees, and returns how many there are. the words stay where they are
+ * until words_sweep or words_free
+ */
+size_t words_complete(const char *prefix, size_t n, const char ***matches);
+
+/**
+ * frees the words no longer in any line once there are as many of them as
+ * there are words still in use. the words handed out by words_complete go
+ * too, so it is not called while a completion may still use them
+ */
+void words_sweep(void);
+
+/**
+ * the bytes the index takes
+ */
+size_t words_measure(void);
+
+void words_free(void);
+
+#endif /* WORDS_H */